@@ -0,0 +1,479 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+using namespace std;
+#include "include/MersenneTwister.h"
+#include "mtrandsimd.h"
+#include "philoxrand.h"
+#include "midifile.h"
+#include "vlq.h"
+#include "generator.h"
+#include "style.h"
+#include "tables.h"
+#include "stylelibrary.h"
+#include "packfile.h"
+
+//The version the benchmarks were built from, set by the Makefile.
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+//Results are written here so the compiler can not throw away the work being timed.
+static volatile unsigned long sink;
+
+//The shortest time each benchmark is run for, in seconds.
+static double minimumTime = 0.25;
+//Only benchmarks whose name contains this are run.
+static const char* filter = "";
+
+//The work done by one run of a benchmark.
+struct BenchWork
+{
+	unsigned long long ops; //The number of operations timed.
+	unsigned long long bytes; //The number of bytes produced, 0 if the benchmark does not produce any.
+	unsigned long long bars; //The number of bars generated, 0 if the benchmark does not generate any.
+};
+
+//Get a monotonic time in nanoseconds.
+static double nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Time a benchmark and print its results as one line of JSON.
+   run(iterations) does the work the given number of times and returns how much work that was.
+   The number of iterations is doubled until a run takes at least minimumTime. */
+template<class Benchmark> void measure(const char* name, Benchmark run)
+{
+	if(!strstr(name, filter))
+		return;
+
+	//Warm up the caches and the branch predictors before timing anything.
+	run(1);
+
+	unsigned long long iterations = 1;
+	BenchWork work;
+	double elapsed;
+	while(true)
+	{
+		double start = nowNs();
+		work = run(iterations);
+		elapsed = nowNs() - start;
+		if(elapsed >= minimumTime * 1e9 || iterations >= (1ULL << 40))
+			break;
+		//Jump most of the way to the target time, then finish off with a single timed run.
+		double scale = elapsed > 0 ? minimumTime * 1e9 / elapsed * 1.2 : 10;
+		iterations = scale > 10 ? iterations * 10 : (unsigned long long)(iterations * scale) + 1;
+	}
+
+	std::cout << "{\"benchmark\":\"" << name << "\",\"version\":\"" << BENCH_VERSION << "\""
+		<< ",\"iterations\":" << iterations
+		<< ",\"ops\":" << work.ops
+		<< ",\"ns_per_op\":" << elapsed / work.ops
+		<< ",\"ops_per_s\":" << work.ops / elapsed * 1e9
+		<< ",\"bytes_per_s\":" << work.bytes / elapsed * 1e9;
+	if(work.bars)
+		std::cout << ",\"bars_per_s\":" << work.bars / elapsed * 1e9;
+	std::cout << "}" << std::endl;
+}
+
+//Make a style where every chord can move to every other chord, which gives the widest rows to sample from.
+static bool buildDenseStyle(Style& style)
+{
+	for(int i = 0; i < STYLE_CHORDS; i++)
+		for(int j = 0; j < STYLE_CHORDS; j++)
+			style.transitions[i][j] = 1.0 / STYLE_CHORDS;
+	style.startChord = CHORD_C;
+	return style.compile();
+}
+
+void printUsage(const char* programName)
+{
+	std::cout << "Usage: " << programName << " [options]" << std::endl
+		<< "Prints one line of JSON for each benchmark." << std::endl
+		<< "  --filter <text>  only run the benchmarks whose name contains the text" << std::endl
+		<< "  --time <s>       the shortest time each benchmark runs for (default 0.25)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	for(int i = 1; i < argc; i++)
+	{
+		if(i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
+
+		if(strcmp(argv[i], "--filter") == 0)
+			filter = argv[++i];
+		else if(strcmp(argv[i], "--time") == 0)
+			minimumTime = atof(argv[++i]);
+		else
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	//The built-in styles, followed by the dense style.
+	Style styles[BUILTIN_STYLES + 1];
+	if(!buildBuiltInStyles(styles) || !buildDenseStyle(styles[BUILTIN_STYLES]))
+		return 1;
+	const char* styleNames[BUILTIN_STYLES + 1] = { "table1", "table2", "table3", "dense" };
+
+	//Every benchmark uses the same seed, so each version of the code does the same work.
+	MTRand mtrand(12345UL);
+	//The generator draws from the SIMD version, in the mode that gives the same numbers as MTRand.
+	MTRandSIMD simdRand(12345U);
+
+	measure("mtrand_randint", [&](unsigned long long iterations) {
+		unsigned long total = 0;
+		for(unsigned long long i = 0; i < iterations; i++)
+			total += mtrand.randInt();
+		sink = total;
+		return BenchWork{iterations, iterations * 4, 0};
+	});
+
+	//Counter-based draws, including moving to a new stream for every bar's worth of numbers.
+	PhiloxRand philox(12345U);
+	measure("philox_randint", [&](unsigned long long iterations) {
+		unsigned long total = 0;
+		for(unsigned long long i = 0; i < iterations; i++)
+			total += philox.randInt();
+		sink = total;
+		return BenchWork{iterations, iterations * 4, 0};
+	});
+
+	measure("philox_bar_streams", [&](unsigned long long iterations) {
+		PhiloxRand::uint32 values[STYLE_MAX_BAR_NOTES + 1];
+		unsigned long total = 0;
+		for(unsigned long long i = 0; i < iterations; i++)
+		{
+			philox.setStream(i >> 16, i & 0xffff);
+			philox.fill(values, STYLE_MAX_BAR_NOTES + 1);
+			total += values[i % (STYLE_MAX_BAR_NOTES + 1)];
+		}
+		sink = total;
+		return BenchWork{iterations, iterations * (STYLE_MAX_BAR_NOTES + 1) * 4, iterations};
+	});
+
+	//Single draws and bulk fills from each mode of the SIMD version.
+	const MTRandSIMDMode modes[] = { MTRANDSIMD_MT19937, MTRANDSIMD_SFMT };
+	const char* modeNames[] = { "mt19937", "sfmt" };
+	MTRandSIMD::uint32 randoms[1024];
+	float floats[1024];
+	for(int m = 0; m < 2; m++)
+	{
+		MTRandSIMD rand(12345U, modes[m]);
+		string name = string("mtrandsimd_randint_") + modeNames[m];
+		measure(name.c_str(), [&](unsigned long long iterations) {
+			unsigned long total = 0;
+			for(unsigned long long i = 0; i < iterations; i++)
+				total += rand.randInt();
+			sink = total;
+			return BenchWork{iterations, iterations * 4, 0};
+		});
+
+		name = string("mtrandsimd_fill_") + modeNames[m];
+		measure(name.c_str(), [&](unsigned long long iterations) {
+			for(unsigned long long i = 0; i < iterations; i++)
+			{
+				rand.fill(randoms, 1024);
+				sink = randoms[i % 1024];
+			}
+			return BenchWork{iterations * 1024, iterations * 1024 * 4, 0};
+		});
+
+		name = string("mtrandsimd_fill_float_") + modeNames[m];
+		measure(name.c_str(), [&](unsigned long long iterations) {
+			for(unsigned long long i = 0; i < iterations; i++)
+			{
+				rand.fill(floats, 1024);
+				sink = (unsigned long)(floats[i % 1024] * 1000);
+			}
+			return BenchWork{iterations * 1024, iterations * 1024 * 4, 0};
+		});
+	}
+
+	for(int s = 0; s < BUILTIN_STYLES + 1; s++)
+	{
+		string name = string("choose_next_chord_") + styleNames[s];
+		const TransitionTable& table = styles[s].getTransitionTable();
+		measure(name.c_str(), [&](unsigned long long iterations) {
+			int chord = table.getStartState();
+			for(unsigned long long i = 0; i < iterations; i++)
+				chord = table.chooseNext(chord, mtrand);
+			sink = chord;
+			return BenchWork{iterations, 0, 0};
+		});
+	}
+
+	//A large vocabulary with and without an order 3 chord model over it. The contexts are the runs of a long walk
+	//of the transition table, so a chain through the model finds most of its contexts and falls back for the rest.
+	const int VOCABULARY = 4096;
+	TransitionTable vocabularyTable;
+	ChordModel vocabularyModel;
+	bool vocabularyBuilt = false;
+	if(strstr("choose_next_chord_4096", filter) || strstr("choose_next_chord_order3_4096", filter))
+	{
+		vector<TransitionTable::Transition> transitions;
+		for(int from = 0; from < VOCABULARY; from++)
+		{
+			for(int i = 0; i < 8; i++)
+			{
+				TransitionTable::Transition transition = { from, (int)mtrand.randInt(VOCABULARY - 1), (float)mtrand.rand() + 0.01f };
+				transitions.push_back(transition);
+			}
+		}
+
+		vector<ChordModel::Context> contexts;
+		if(vocabularyTable.build(transitions, VOCABULARY))
+		{
+			ChordHistory walk = startChordHistory(0);
+			for(int step = 1; step <= 200000; step++)
+			{
+				int next = vocabularyTable.chooseNext(getChordFromHistory(walk, 0), mtrand);
+				for(int order = 2; order <= 3 && order <= step; order++)
+				{
+					//The chord the walk took, and another which the chain can also take from here.
+					ChordModel::Context context = { order, { 0 }, next, 1 };
+					for(int j = 0; j < order; j++)
+						context.chords[j] = getChordFromHistory(walk, order - 1 - j);
+					contexts.push_back(context);
+					context.next = mtrand.randInt(VOCABULARY - 1);
+					contexts.push_back(context);
+				}
+				walk = addToChordHistory(walk, next);
+			}
+			vocabularyBuilt = vocabularyModel.build(contexts, VOCABULARY);
+		}
+	}
+	if(vocabularyBuilt)
+	{
+		measure("choose_next_chord_4096", [&](unsigned long long iterations) {
+			int chord = 0;
+			for(unsigned long long i = 0; i < iterations; i++)
+				chord = vocabularyTable.chooseNext(chord, mtrand);
+			sink = chord;
+			return BenchWork{iterations, 0, 0};
+		});
+
+		measure("choose_next_chord_order3_4096", [&](unsigned long long iterations) {
+			ChordHistory chords = startChordHistory(0);
+			for(unsigned long long i = 0; i < iterations; i++)
+			{
+				MTRand::uint32 random = mtrand.randInt();
+				int next;
+				if(!vocabularyModel.chooseNext(chords, random, next))
+					next = vocabularyTable.chooseNext(getChordFromHistory(chords, 0), random);
+				chords = addToChordHistory(chords, next);
+			}
+			sink = chords;
+			return BenchWork{iterations, 0, 0};
+		});
+	}
+
+	//Reading and compiling a style file, against opening a library of thousands of styles and taking one from it.
+	char styleName[64], libraryName[64];
+	snprintf(styleName, sizeof(styleName), "/tmp/autocomposition-bench-%d.style", (int)getpid());
+	snprintf(libraryName, sizeof(libraryName), "/tmp/autocomposition-bench-%d.acs", (int)getpid());
+	const int LIBRARY_STYLES = 4096;
+	vector<string> libraryNames;
+	vector<const Style*> libraryStyles;
+	for(int i = 0; i < LIBRARY_STYLES; i++)
+	{
+		libraryNames.push_back("style" + to_string(i));
+		libraryStyles.push_back(&styles[i % (BUILTIN_STYLES + 1)]);
+	}
+	if(styles[BUILTIN_STYLES].save(styleName) && StyleLibrary::write(libraryName, libraryNames, libraryStyles))
+	{
+		measure("style_load_compile", [&](unsigned long long iterations) {
+			Style style;
+			for(unsigned long long i = 0; i < iterations; i++)
+				sink = style.load(styleName) && style.compile();
+			return BenchWork{iterations, 0, 0};
+		});
+
+		measure("style_library_open_4096", [&](unsigned long long iterations) {
+			Style style;
+			for(unsigned long long i = 0; i < iterations; i++)
+			{
+				StyleLibrary library;
+				sink = library.open(libraryName) && library.getStyle(library.find(libraryNames[i % LIBRARY_STYLES].c_str()), style);
+			}
+			return BenchWork{iterations, 0, 0};
+		});
+	}
+	unlink(styleName);
+	unlink(libraryName);
+
+	//Taking pieces by id from a mapped pack, which should cost the same wherever they are in it.
+	char packName[64];
+	snprintf(packName, sizeof(packName), "/tmp/autocomposition-bench-%d.pack", (int)getpid());
+	const int PACK_PIECES = 16384;
+	PackWriter packWriter;
+	//Filling the pack takes a while, so it is only done if the benchmark is going to run.
+	if(strstr("pack_get_piece_16384", filter) && packWriter.create(packName, GENERATOR_RNG_MT19937, false))
+	{
+		generateBatch("", PACK_PIECES, 4, 4, styles[0], 1, false, false, GENERATOR_RNG_MT19937, NULL, FILEWRITER_SYNC, 0, &packWriter);
+		PackReader pack;
+		if(packWriter.finish() && pack.open(packName))
+		{
+			measure("pack_get_piece_16384", [&](unsigned long long iterations) {
+				unsigned long long bytes = 0;
+				PackPiece piece;
+				for(unsigned long long i = 0; i < iterations; i++)
+				{
+					if(pack.getPiece((i * 7919) % PACK_PIECES, piece))
+						bytes += piece.length + piece.data[piece.length - 1];
+				}
+				sink = bytes;
+				return BenchWork{iterations, 0, 0};
+			});
+		}
+	}
+	unlink(packName);
+
+	measure("choose_rhythm", [&](unsigned long long iterations) {
+		unsigned long total = 0;
+		const int* durations;
+		for(unsigned long long i = 0; i < iterations; i++)
+			total += styles[0].chooseRhythm(mtrand, durations) + durations[0];
+		sink = total;
+		return BenchWork{iterations, 0, iterations};
+	});
+
+	//Values with every encoded length, from 1 to 4 bytes.
+	unsigned long values[256];
+	for(int i = 0; i < 256; i++)
+		values[i] = (mtrand.randInt() & 0x0FFFFFFF) >> (7 * (i % 4));
+	unsigned char varLenBuffer[256 * MIDIFILE_MAX_VARLEN_LENGTH];
+
+	measure("write_var_len", [&](unsigned long long iterations) {
+		unsigned long long bytes = 0;
+		for(unsigned long long i = 0; i < iterations; i++)
+		{
+			unsigned char* end = varLenBuffer;
+			for(int j = 0; j < 256; j++)
+				end = writeVarLen(end, values[j]);
+			bytes += end - varLenBuffer;
+			sink = varLenBuffer[(i * 7) % (end - varLenBuffer)];
+		}
+		return BenchWork{iterations * 256, bytes, 0};
+	});
+
+	measure("var_len_len", [&](unsigned long long iterations) {
+		unsigned long total = 0;
+		for(unsigned long long i = 0; i < iterations; i++)
+			for(int j = 0; j < 256; j++)
+				total += varLenLen(values[j] + i);
+		sink = total;
+		return BenchWork{iterations * 256, 0, 0};
+	});
+
+	//A note dense track, with mostly short delta times, encoded by each version of the batch encoder.
+	std::vector<MidiEvent> events(4096);
+	for(int i = 0; i < events.size(); i++)
+	{
+		MidiEvent event = { (unsigned int)(i % 2 ? 0 : mtrand.randInt(300)), 0x90, (unsigned char)(60 + i % 12), 96 };
+		events[i] = event;
+	}
+	std::vector<unsigned char> eventBuffer(events.size() * 7 + VLQ_WRITE_PADDING);
+	const char* defaultImplementation = getVarLenImplementation();
+	const char* implementations[] = { "scalar", "ssse3", "avx2" };
+	for(int v = 0; v < 3; v++)
+	{
+		if(!setVarLenImplementation(implementations[v]))
+			continue;
+		string name = string("write_var_len_events_") + implementations[v];
+		measure(name.c_str(), [&](unsigned long long iterations) {
+			unsigned long long bytes = 0;
+			for(unsigned long long i = 0; i < iterations; i++)
+			{
+				size_t length = varLenEventsLength(&events[0], events.size());
+				bytes += writeVarLenEvents(&eventBuffer[0], &events[0], events.size()) - &eventBuffer[0];
+				sink = length;
+			}
+			return BenchWork{iterations * events.size(), bytes, 0};
+		});
+	}
+	setVarLenImplementation(defaultImplementation);
+
+	//A MIDI file with the four tracks the generator uses.
+	MidiFile midi;
+	for(int i = 0; i < 4; i++)
+		midi.addTrack();
+
+	measure("add_chord", [&](unsigned long long iterations) {
+		for(unsigned long long i = 0; i < iterations; i++)
+		{
+			//Clear the events now and then, so the tracks stay a realistic size.
+			if(i % 1024 == 0)
+				midi.clearEvents();
+			midi.addChord(0, STYLE_BAR_TICKS, 4, i % 12, i % 2 == 1);
+		}
+		midi.clearEvents();
+		return BenchWork{iterations, 0, 0};
+	});
+
+	measure("add_chord_ninth_inverted", [&](unsigned long long iterations) {
+		for(unsigned long long i = 0; i < iterations; i++)
+		{
+			if(i % 1024 == 0)
+				midi.clearEvents();
+			midi.addChord(0, 2, STYLE_BAR_TICKS, 4, i % 12, MIDIFILE_CHORD_SHAPES[MIDIFILE_CHORD_DOMINANT9], i % 5);
+		}
+		midi.clearEvents();
+		return BenchWork{iterations, 0, 0};
+	});
+
+	//Serialise a generated piece of 64 bars.
+	std::vector<unsigned char> buffer;
+	generatePiece(midi, 64, styles[0], simdRand);
+	measure("write_to_buffer_64_bars", [&](unsigned long long iterations) {
+		unsigned long long bytes = 0;
+		for(unsigned long long i = 0; i < iterations; i++)
+		{
+			buffer.clear();
+			midi.writeToBuffer(buffer);
+			bytes += buffer.size();
+		}
+		sink = buffer[buffer.size() / 2];
+		return BenchWork{iterations, bytes, 0};
+	});
+	midi.clearEvents();
+
+	//Generate and serialise whole pieces, without touching the disk.
+	const int pieceLengths[] = { 8, 64, 1024 };
+	for(int s = 0; s < BUILTIN_STYLES + 1; s++)
+	{
+		for(int l = 0; l < sizeof(pieceLengths) / sizeof(pieceLengths[0]); l++)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "piece_%s_%d_bars", styleNames[s], pieceLengths[l]);
+			int noOfBars = pieceLengths[l];
+			const Style& style = styles[s];
+			measure(name, [&](unsigned long long iterations) {
+				unsigned long long bytes = 0;
+				for(unsigned long long i = 0; i < iterations; i++)
+				{
+					midi.clearEvents();
+					generatePiece(midi, noOfBars, style, simdRand);
+					buffer.clear();
+					midi.writeToBuffer(buffer);
+					bytes += buffer.size();
+				}
+				sink = buffer.size();
+				return BenchWork{iterations, bytes, iterations * noOfBars};
+			});
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,323 @@
+#include "chordmodel.h"
+#include "hash.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+using namespace std;
+
+ChordModel::ChordModel() : noOfStates(0), maxOrder(1), shift(64)
+{
+	useBuiltArrays();
+}
+
+ChordModel::ChordModel(const ChordModel& other)
+{
+	*this = other;
+}
+
+ChordModel& ChordModel::operator=(const ChordModel& other)
+{
+	noOfStates = other.noOfStates;
+	maxOrder = other.maxOrder;
+	shift = other.shift;
+	builtSlots = other.builtSlots;
+	builtEntries = other.builtEntries;
+	if(other.slots == (other.builtSlots.empty() ? NULL : &other.builtSlots[0]))
+		useBuiltArrays();
+	else
+	{
+		slots = other.slots;
+		noOfSlots = other.noOfSlots;
+		entries = other.entries;
+		noOfEntries = other.noOfEntries;
+	}
+	return *this;
+}
+
+void ChordModel::useBuiltArrays()
+{
+	slots = builtSlots.empty() ? NULL : &builtSlots[0];
+	noOfSlots = builtSlots.size();
+	entries = builtEntries.empty() ? NULL : &builtEntries[0];
+	noOfEntries = builtEntries.size();
+}
+
+//A context's weight for one chord, with the context packed into its key, used to sort the contexts into rows.
+struct ChordModelWeight
+{
+	unsigned long long key;
+	int next;
+	double weight;
+
+	bool operator<(const ChordModelWeight& other) const
+	{
+		return key < other.key || (key == other.key && next < other.next);
+	}
+};
+
+bool ChordModel::build(const vector<Context>& contexts, int states)
+{
+	if(states <= 0 || states > CHORDMODEL_MAX_STATES)
+	{
+		std::cout << "ERROR: A chord model can have from 1 to " << CHORDMODEL_MAX_STATES << " states." << std::endl;
+		return false;
+	}
+
+	//Pack each context into its key, checking them as we go.
+	vector<ChordModelWeight> weights;
+	weights.reserve(contexts.size());
+	int newMaxOrder = 1;
+	for(int i = 0; i < contexts.size(); i++)
+	{
+		const Context& context = contexts[i];
+		bool valid = context.order >= 2 && context.order <= CHORDMODEL_MAX_ORDER && context.next >= 0 && context.next < states;
+		ChordHistory history = 0;
+		for(int j = 0; valid && j < context.order; j++)
+		{
+			valid = context.chords[j] >= 0 && context.chords[j] < states;
+			history = (history << CHORDMODEL_STATE_BITS) | context.chords[j];
+		}
+		if(!valid)
+		{
+			std::cout << "ERROR: Context " << i << " has an invalid order or refers to a chord outside the model." << std::endl;
+			return false;
+		}
+		if(!(context.weight >= 0) || isinf(context.weight))
+		{
+			std::cout << "ERROR: Context " << i << " has an invalid weight." << std::endl;
+			return false;
+		}
+		if(context.weight == 0)
+			continue;
+
+		ChordModelWeight weight = { getContextKey(history, context.order), context.next, context.weight };
+		weights.push_back(weight);
+		newMaxOrder = max(newMaxOrder, context.order);
+	}
+
+	//Sort the weights into a row for each context, adding up any listed more than once.
+	sort(weights.begin(), weights.end());
+	int merged = 0;
+	for(int i = 0; i < weights.size(); i++)
+	{
+		if(merged > 0 && weights[merged - 1].key == weights[i].key && weights[merged - 1].next == weights[i].next)
+			weights[merged - 1].weight += weights[i].weight;
+		else
+			weights[merged++] = weights[i];
+	}
+	weights.resize(merged);
+
+	vector<Slot> rows;
+	for(int i = 0; i < weights.size(); i++)
+	{
+		if(rows.empty() || rows.back().key != weights[i].key)
+		{
+			Slot row = { weights[i].key, i, 0 };
+			rows.push_back(row);
+		}
+		rows.back().count++;
+	}
+
+	//Build each row's alias table with Vose's alias method, as TransitionTable does.
+	vector<Entry> newEntries(weights.size());
+	vector<double> scaled(weights.size());
+	vector<int> small, large;
+	for(int row = 0; row < rows.size(); row++)
+	{
+		int first = rows[row].first;
+		int count = rows[row].count;
+
+		double sum = 0;
+		for(int i = first; i < first + count; i++)
+			sum += weights[i].weight;
+
+		small.clear();
+		large.clear();
+		for(int i = first; i < first + count; i++)
+		{
+			newEntries[i].state = weights[i].next;
+			scaled[i] = weights[i].weight / sum * count;
+			if(scaled[i] < 1)
+				small.push_back(i);
+			else
+				large.push_back(i);
+		}
+
+		while(!small.empty() && !large.empty())
+		{
+			int less = small.back();
+			int more = large.back();
+			small.pop_back();
+
+			newEntries[less].threshold = (unsigned int)(scaled[less] * 4294967296.0);
+			newEntries[less].alias = newEntries[more].state;
+
+			scaled[more] -= 1 - scaled[less];
+			if(scaled[more] < 1)
+			{
+				large.pop_back();
+				small.push_back(more);
+			}
+		}
+
+		//Whatever is left over is full (up to rounding), so it always keeps its own state.
+		for(int i = 0; i < large.size(); i++)
+		{
+			newEntries[large[i]].threshold = 0xffffffffUL;
+			newEntries[large[i]].alias = newEntries[large[i]].state;
+		}
+		for(int i = 0; i < small.size(); i++)
+		{
+			newEntries[small[i]].threshold = 0xffffffffUL;
+			newEntries[small[i]].alias = newEntries[small[i]].state;
+		}
+	}
+
+	//Size the hash table to at least twice the contexts, so probes stay short and there is always an empty slot to stop at.
+	int newShift = 64;
+	vector<Slot> newSlots;
+	if(!rows.empty())
+	{
+		int bits = 1;
+		while((1ULL << bits) < 2 * rows.size())
+			bits++;
+		newShift = 64 - bits;
+		Slot empty = { 0, 0, 0 };
+		newSlots.assign(1 << bits, empty);
+		for(int row = 0; row < rows.size(); row++)
+		{
+			unsigned int slot = (unsigned int)((rows[row].key * 0x9E3779B97F4A7C15ULL) >> newShift);
+			while(newSlots[slot].key != 0)
+				slot = (slot + 1) & (newSlots.size() - 1);
+			newSlots[slot] = rows[row];
+		}
+	}
+
+	noOfStates = states;
+	maxOrder = newMaxOrder;
+	shift = newShift;
+	builtSlots.swap(newSlots);
+	builtEntries.swap(newEntries);
+	useBuiltArrays();
+	return true;
+}
+
+int ChordModel::getNoOfContexts() const
+{
+	int contexts = 0;
+	for(int i = 0; i < noOfSlots; i++)
+	{
+		if(slots[i].key != 0)
+			contexts++;
+	}
+	return contexts;
+}
+
+unsigned long long ChordModel::hash(unsigned long long hash) const
+{
+	hash = hashValue(hash, noOfStates);
+	hash = hashValue(hash, maxOrder);
+	hash = hashValue(hash, noOfSlots);
+	for(int i = 0; i < noOfSlots; i++)
+	{
+		hash = hashValue(hash, slots[i].key);
+		hash = hashValue(hash, slots[i].first);
+		hash = hashValue(hash, slots[i].count);
+	}
+	for(int i = 0; i < noOfEntries; i++)
+	{
+		hash = hashValue(hash, (unsigned long long)entries[i].threshold);
+		hash = hashValue(hash, entries[i].state);
+		hash = hashValue(hash, entries[i].alias);
+	}
+	return hash;
+}
+
+/* The layout written by write(): four 4 byte words, noOfStates, maxOrder, noOfSlots and noOfEntries, then the
+   slots and the entries exactly as Slot and Entry lay them out, so attach() can point straight at them, then
+   enough zeros to make the length a multiple of 8 bytes. */
+static const int CHORDMODEL_HEADER_WORDS = 4;
+
+void ChordModel::write(vector<unsigned char>& buffer) const
+{
+	static_assert(sizeof(Slot) == 16 && sizeof(Entry) == 12, "ChordModel::Slot must be 16 bytes and ChordModel::Entry 12");
+	size_t start = buffer.size();
+	int header[CHORDMODEL_HEADER_WORDS] = { noOfStates, maxOrder, noOfSlots, noOfEntries };
+	const unsigned char* parts[3] = { (const unsigned char*)header, (const unsigned char*)slots, (const unsigned char*)entries };
+	size_t lengths[3] = { sizeof(header), noOfSlots * sizeof(Slot), noOfEntries * sizeof(Entry) };
+	for(int i = 0; i < 3; i++)
+		buffer.insert(buffer.end(), parts[i], parts[i] + lengths[i]);
+	buffer.resize(start + (buffer.size() - start + 7) / 8 * 8, 0);
+}
+
+bool ChordModel::attach(const unsigned char* data, size_t length)
+{
+	int header[CHORDMODEL_HEADER_WORDS];
+	if(length < sizeof(header) || (size_t)data % 8 != 0)
+	{
+		std::cout << "ERROR: The chord model is cut short or not 8 byte aligned." << std::endl;
+		return false;
+	}
+	memcpy(header, data, sizeof(header));
+	int states = header[0], order = header[1], slotCount = header[2], count = header[3];
+	size_t used = sizeof(header) + (size_t)slotCount * sizeof(Slot) + (size_t)count * sizeof(Entry);
+	if(states <= 0 || states > CHORDMODEL_MAX_STATES || order < 1 || order > CHORDMODEL_MAX_ORDER || slotCount < 0 || count < 0
+		|| (slotCount & (slotCount - 1)) != 0 || (slotCount == 0) != (order == 1) || slotCount == 1
+		|| length != (used + 7) / 8 * 8)
+	{
+		std::cout << "ERROR: The chord model has an invalid size." << std::endl;
+		return false;
+	}
+
+	//Check everything chooseNext() relies on, so a damaged model can never index outside itself or probe forever.
+	const Slot* newSlots = (const Slot*)(data + sizeof(header));
+	const Entry* newEntries = (const Entry*)(newSlots + slotCount);
+	bool hasEmptySlot = slotCount == 0;
+	for(int i = 0; i < slotCount; i++)
+	{
+		const Slot& slot = newSlots[i];
+		if(slot.key == 0)
+		{
+			hasEmptySlot = true;
+			continue;
+		}
+		int keyOrder = (int)(slot.key >> (CHORDMODEL_STATE_BITS * CHORDMODEL_MAX_ORDER));
+		bool valid = keyOrder >= 2 && keyOrder <= order && (slot.key & ~getContextKey(chordHistoryMask(keyOrder), keyOrder)) == 0
+			&& slot.first >= 0 && slot.count > 0 && slot.first <= count && slot.count <= count - slot.first;
+		for(int j = 0; valid && j < keyOrder; j++)
+			valid = getChordFromHistory(slot.key, j) < states;
+		if(!valid)
+		{
+			std::cout << "ERROR: Chord model slot " << i << " is invalid." << std::endl;
+			return false;
+		}
+	}
+	if(!hasEmptySlot)
+	{
+		std::cout << "ERROR: The chord model's hash table has no empty slot." << std::endl;
+		return false;
+	}
+	for(int i = 0; i < count; i++)
+	{
+		if(newEntries[i].state < 0 || newEntries[i].state >= states || newEntries[i].alias < 0 || newEntries[i].alias >= states)
+		{
+			std::cout << "ERROR: Chord model entry " << i << " refers to a state outside the model." << std::endl;
+			return false;
+		}
+	}
+
+	int newShift = 64;
+	while(newShift > 0 && (1ULL << (64 - newShift)) < (unsigned long long)slotCount)
+		newShift--;
+
+	noOfStates = states;
+	maxOrder = order;
+	shift = newShift;
+	builtSlots.clear();
+	builtEntries.clear();
+	slots = slotCount ? newSlots : NULL;
+	noOfSlots = slotCount;
+	entries = count ? newEntries : NULL;
+	noOfEntries = count;
+	return true;
+}
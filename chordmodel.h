@@ -0,0 +1,170 @@
+#ifndef CHORDMODEL_H
+#define CHORDMODEL_H
+
+#include <vector>
+#include "include/MersenneTwister.h"
+using namespace std;
+
+//The most chords the context of a chord model can hold, so the most chords the next one depends on.
+const int CHORDMODEL_MAX_ORDER = 4;
+//The bits each chord takes in a ChordHistory, and so the most states a chord model can have.
+const int CHORDMODEL_STATE_BITS = 15;
+const int CHORDMODEL_MAX_STATES = (1 << CHORDMODEL_STATE_BITS) - 1;
+//Stands in for the chords before the first one in a history.
+const int CHORDMODEL_NO_STATE = CHORDMODEL_MAX_STATES;
+
+/* The last CHORDMODEL_MAX_ORDER chords of a chain, packed CHORDMODEL_STATE_BITS bits to a chord with the
+   latest in the lowest bits, so a history is kept in one register and a context is a mask away. */
+typedef unsigned long long ChordHistory;
+
+//The bits of a history holding its last order chords.
+inline ChordHistory chordHistoryMask(int order)
+{
+	return (1ULL << (CHORDMODEL_STATE_BITS * order)) - 1;
+}
+
+//Start a history with a chord, with no chords before it.
+inline ChordHistory startChordHistory(int chord)
+{
+	return (chordHistoryMask(CHORDMODEL_MAX_ORDER) & ~chordHistoryMask(1)) | chord;
+}
+
+//Add the next chord to a history, forgetting the oldest.
+inline ChordHistory addToChordHistory(ChordHistory history, int chord)
+{
+	return ((history << CHORDMODEL_STATE_BITS) | chord) & chordHistoryMask(CHORDMODEL_MAX_ORDER);
+}
+
+//Get a chord of a history, counting back from the last, which is 0. Returns CHORDMODEL_NO_STATE before the first.
+inline int getChordFromHistory(ChordHistory history, int back)
+{
+	return (int)((history >> (CHORDMODEL_STATE_BITS * back)) & chordHistoryMask(1));
+}
+
+/* A higher order chord model: the chord following each run of 2 to CHORDMODEL_MAX_ORDER chords that has been
+   seen, compiled for sampling. It only holds the runs, or contexts, it has weights for. A chain asks for the
+   longest context first and falls back to shorter ones, and to the style's TransitionTable when none is known.
+   Contexts live in one open addressing hash table, keyed by the packed chords and the order so every order
+   shares it, and probed linearly. Each slot points at the context's row of a single array of alias table
+   entries, as TransitionTable lays its rows out, so choosing the next chord costs a few probes of adjacent
+   slots, one random number and one comparison, and allocates nothing.
+   Like TransitionTable, a built model can be written out with write() and used in place with attach(). */
+class ChordModel
+{
+	public:
+		//The weight of a chord following a context, used to build the model.
+		struct Context
+		{
+			int order; //The number of chords in the context, from 2 to CHORDMODEL_MAX_ORDER.
+			int chords[CHORDMODEL_MAX_ORDER]; //The chords of the context, oldest first.
+			int next;
+			float weight;
+		};
+
+	private:
+		//One slot of the hash table. A key of 0 marks an empty slot, as every context's key has its order in the top bits.
+		struct Slot
+		{
+			unsigned long long key;
+			//Where the context's entries start, and how many there are.
+			int first;
+			int count;
+		};
+
+		//One entry of a context's alias table, as in TransitionTable.
+		struct Entry
+		{
+			unsigned int threshold;
+			int state;
+			int alias;
+		};
+
+		//The number of states (chords), and the longest context held. A model with no contexts has an order of 1.
+		int noOfStates;
+		int maxOrder;
+		//The hash table, a power of two slots long, and the shift that takes a hashed key to a slot.
+		const Slot* slots;
+		int noOfSlots;
+		int shift;
+		//The alias table entries of every context, one after the other.
+		const Entry* entries;
+		int noOfEntries;
+
+		//The arrays slots and entries point at for a built model. An attached model leaves them empty.
+		vector<Slot> builtSlots;
+		vector<Entry> builtEntries;
+
+		//Point slots and entries at the built arrays.
+		void useBuiltArrays();
+		//Get the first slot to probe for a key.
+		unsigned int firstSlot(unsigned long long key) const
+		{
+			return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> shift);
+		}
+
+	public:
+		ChordModel(); //Class constructor. The model has no contexts until it is built.
+		ChordModel(const ChordModel& other); //Copy constructor. A copy of an attached model uses the same memory.
+		ChordModel& operator=(const ChordModel& other);
+		/* Build the model from the weights of the chords following each context, with states numbered 0 to
+		   states - 1. A context may be listed more than once, and its weights are added up. An empty list
+		   gives a model with no contexts. Returns false if a context or weight is invalid. */
+		bool build(const vector<Context>& contexts, int states);
+
+		//Get the key of the context made of a history's last order chords.
+		static unsigned long long getContextKey(ChordHistory history, int order)
+		{
+			return (history & chordHistoryMask(order)) | ((unsigned long long)order << (CHORDMODEL_STATE_BITS * CHORDMODEL_MAX_ORDER));
+		}
+
+		/* Choose the chord following a history from the longest context the model holds, using a 32 bit random
+		   number that has already been drawn. Returns false if the model holds none of the history's contexts. */
+		bool chooseNext(ChordHistory history, MTRand::uint32 random, int& next) const
+		{
+			for(int order = maxOrder; order >= 2; order--)
+			{
+				unsigned long long key = getContextKey(history, order);
+				for(unsigned int slot = firstSlot(key); slots[slot].key != 0; slot = (slot + 1) & (noOfSlots - 1))
+				{
+					if(slots[slot].key != key)
+						continue;
+					//The same sampling as TransitionTable::chooseNext(), over the context's row.
+					unsigned long long scaled = (unsigned long long)(random & 0xffffffffUL) * slots[slot].count;
+					const Entry& entry = entries[slots[slot].first + (int)(scaled >> 32)];
+					next = (scaled & 0xffffffffULL) < entry.threshold ? entry.state : entry.alias;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//Get the number of states in the model.
+		int getNoOfStates() const
+		{
+			return noOfStates;
+		}
+		//Get the longest context held, or 1 if there are none.
+		int getMaxOrder() const
+		{
+			return maxOrder;
+		}
+		//Get the number of contexts held.
+		int getNoOfContexts() const;
+		//Call a function with each chord that can follow a context, so it can be checked.
+		template<class Function> void forEachNext(Function function) const
+		{
+			for(int i = 0; i < noOfEntries; i++)
+				function(entries[i].state);
+		}
+		//Add the contents of the built model to a hash (see hash.h), so models that sample the same way hash the same.
+		unsigned long long hash(unsigned long long hash) const;
+
+		//Add the built model to the end of a buffer, in the layout attach() reads. Its length is a multiple of 8 bytes.
+		void write(vector<unsigned char>& buffer) const;
+		/* Use a model written by write() where it is, without copying it. The data must be 8 byte aligned and
+		   stay valid for as long as the model and any copies of it are used.
+		   Returns false, leaving this model as it was, if the data is not a valid model. */
+		bool attach(const unsigned char* data, size_t length);
+};
+
+#endif //CHORDMODEL_H
@@ -0,0 +1,427 @@
+#include "filewriter.h"
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <iostream>
+using namespace std;
+
+//The stages a file goes through in a slot.
+static const int FILEWRITER_OPEN = 0;
+static const int FILEWRITER_WRITE = 1;
+static const int FILEWRITER_CLOSE = 2;
+
+bool parseFileWriterBackend(const char* name, FileWriterBackend& backend)
+{
+	if(strcmp(name, "sync") == 0)
+		backend = FILEWRITER_SYNC;
+	else if(strcmp(name, "threads") == 0)
+		backend = FILEWRITER_THREADS;
+	else if(strcmp(name, "uring") == 0)
+		backend = FILEWRITER_URING;
+	else
+		return false;
+	return true;
+}
+
+const char* getFileWriterBackendName(FileWriterBackend backend)
+{
+	switch(backend)
+	{
+		case FILEWRITER_THREADS:
+			return "threads";
+		case FILEWRITER_URING:
+			return "uring";
+		default:
+			return "sync";
+	}
+}
+
+/* An io_uring, set up and driven through the raw system calls so nothing beyond the kernel headers is needed.
+   The submission and completion rings are shared with the kernel: this side moves the submission tail and
+   the completion head, and the kernel moves the others. */
+struct FileWriter::Ring
+{
+	int descriptor;
+	void* submissionMap;
+	size_t submissionMapLength;
+	void* completionMap;
+	size_t completionMapLength;
+	struct io_uring_sqe* entries;
+	size_t entriesLength;
+
+	unsigned* submissionHead;
+	unsigned* submissionTail;
+	unsigned submissionMask;
+	unsigned* submissionArray;
+	unsigned* completionHead;
+	unsigned* completionTail;
+	unsigned completionMask;
+	struct io_uring_cqe* completions;
+
+	//Operations queued in the submission ring but not yet passed to the kernel.
+	unsigned toSubmit;
+};
+
+FileWriter::Ring* FileWriter::setupRing(unsigned noOfEntries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int descriptor = syscall(__NR_io_uring_setup, noOfEntries, &params);
+	if(descriptor < 0)
+		return NULL;
+
+	//Opening and closing files through the ring came in the same kernel (5.6) as IORING_FEAT_RW_CUR_POS.
+	if(!(params.features & IORING_FEAT_RW_CUR_POS))
+	{
+		close(descriptor);
+		return NULL;
+	}
+
+	FileWriter::Ring* ring = new FileWriter::Ring;
+	memset(ring, 0, sizeof(*ring));
+	ring->descriptor = descriptor;
+	ring->submissionMapLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->completionMapLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	//Newer kernels map both rings with one call.
+	bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(singleMap)
+		ring->submissionMapLength = ring->completionMapLength = max(ring->submissionMapLength, ring->completionMapLength);
+	ring->entriesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->submissionMap = mmap(NULL, ring->submissionMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		descriptor, IORING_OFF_SQ_RING);
+	ring->completionMap = singleMap ? ring->submissionMap : mmap(NULL, ring->completionMapLength, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_CQ_RING);
+	void* entries = mmap(NULL, ring->entriesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		descriptor, IORING_OFF_SQES);
+	if(ring->submissionMap == MAP_FAILED || ring->completionMap == MAP_FAILED || entries == MAP_FAILED)
+	{
+		if(ring->submissionMap != MAP_FAILED)
+			munmap(ring->submissionMap, ring->submissionMapLength);
+		if(!singleMap && ring->completionMap != MAP_FAILED)
+			munmap(ring->completionMap, ring->completionMapLength);
+		if(entries != MAP_FAILED)
+			munmap(entries, ring->entriesLength);
+		close(descriptor);
+		delete ring;
+		return NULL;
+	}
+	ring->entries = (struct io_uring_sqe*)entries;
+
+	unsigned char* submission = (unsigned char*)ring->submissionMap;
+	ring->submissionHead = (unsigned*)(submission + params.sq_off.head);
+	ring->submissionTail = (unsigned*)(submission + params.sq_off.tail);
+	ring->submissionMask = *(unsigned*)(submission + params.sq_off.ring_mask);
+	ring->submissionArray = (unsigned*)(submission + params.sq_off.array);
+	unsigned char* completion = (unsigned char*)ring->completionMap;
+	ring->completionHead = (unsigned*)(completion + params.cq_off.head);
+	ring->completionTail = (unsigned*)(completion + params.cq_off.tail);
+	ring->completionMask = *(unsigned*)(completion + params.cq_off.ring_mask);
+	ring->completions = (struct io_uring_cqe*)(completion + params.cq_off.cqes);
+	return ring;
+}
+
+void FileWriter::closeRing(Ring* ring)
+{
+	munmap(ring->entries, ring->entriesLength);
+	if(ring->completionMap != ring->submissionMap)
+		munmap(ring->completionMap, ring->completionMapLength);
+	munmap(ring->submissionMap, ring->submissionMapLength);
+	close(ring->descriptor);
+	delete ring;
+}
+
+FileWriter::FileWriter(FileWriterBackend backend, int depth, int maxThreads)
+	: backend(backend), depth(depth > 0 ? depth : FILEWRITER_DEPTH), ok(true), ring(NULL), busySlots(0),
+	writing(0), stopping(false)
+{
+	if(backend == FILEWRITER_URING)
+	{
+		//Each file has one operation in flight at a time, so a ring with room for depth of them never fills.
+		ring = setupRing(this->depth);
+		if(ring)
+			slots.resize(this->depth);
+		else
+			this->backend = FILEWRITER_THREADS;
+	}
+
+	if(this->backend == FILEWRITER_THREADS)
+	{
+		for(int i = 0; i < max(1, min(this->depth, maxThreads)); i++)
+			threads.push_back(thread(&FileWriter::poolThread, this));
+	}
+}
+
+FileWriter::~FileWriter()
+{
+	finish();
+	if(!threads.empty())
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		workReady.notify_all();
+		for(int i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+	if(ring)
+		closeRing(ring);
+}
+
+bool FileWriter::writeNow(const string& name, const vector<unsigned char>& file)
+{
+	FILE* output = fopen(name.c_str(), "wb");
+	bool written = output && (file.empty() || fwrite(&file[0], 1, file.size(), output) == file.size());
+	if(output && fclose(output) != 0)
+		written = false;
+	if(written)
+		statsCount(STATS_BYTES_WRITTEN, file.size());
+	else
+		std::cout << "ERROR: Could not write " << name << "." << std::endl;
+	return written;
+}
+
+void FileWriter::takeSpare(vector<unsigned char>& file)
+{
+	if(!spareBuffers.empty())
+	{
+		file.swap(spareBuffers.back());
+		spareBuffers.pop_back();
+	}
+}
+
+void FileWriter::write(const char* name, vector<unsigned char>& file)
+{
+	StatsTimer timer(STATS_PHASE_WRITE);
+	if(backend == FILEWRITER_SYNC)
+	{
+		if(!writeNow(name, file))
+			ok = false;
+		file.clear();
+		return;
+	}
+
+	if(backend == FILEWRITER_THREADS)
+	{
+		unique_lock<mutex> guard(lock);
+		while(waiting.size() + writing >= depth)
+			workDone.wait(guard);
+		waiting.push_back(Slot());
+		waiting.back().name = name;
+		waiting.back().file.swap(file);
+		takeSpare(file);
+		workReady.notify_one();
+		return;
+	}
+
+	//Wait for a slot, submitting what is queued in the meantime.
+	while(busySlots == depth)
+		reap(true);
+	int slot = 0;
+	while(slots[slot].busy)
+		slot++;
+
+	Slot& details = slots[slot];
+	details.name = name;
+	details.file.swap(file);
+	takeSpare(file);
+	details.descriptor = -1;
+	details.written = 0;
+	details.stage = FILEWRITER_OPEN;
+	details.failed = false;
+	details.busy = true;
+	busySlots++;
+	queueOperation(slot);
+
+	//Submit in batches, so one system call covers the opens of several files.
+	if(ring->toSubmit >= max(1, depth / 4))
+		reap(false);
+}
+
+bool FileWriter::finish()
+{
+	if(backend == FILEWRITER_THREADS)
+	{
+		unique_lock<mutex> guard(lock);
+		while(!waiting.empty() || writing > 0)
+			workDone.wait(guard);
+	}
+	else if(backend == FILEWRITER_URING)
+	{
+		while(busySlots > 0)
+			reap(true);
+	}
+	return ok;
+}
+
+void FileWriter::queueOperation(int slot)
+{
+	Slot& details = slots[slot];
+	unsigned tail = *ring->submissionTail;
+	unsigned index = tail & ring->submissionMask;
+	struct io_uring_sqe* entry = &ring->entries[index];
+	memset(entry, 0, sizeof(*entry));
+	entry->user_data = slot;
+
+	if(details.stage == FILEWRITER_OPEN)
+	{
+		entry->opcode = IORING_OP_OPENAT;
+		entry->fd = AT_FDCWD;
+		entry->addr = (unsigned long long)details.name.c_str();
+		entry->len = 0666;
+		entry->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	}
+	else if(details.stage == FILEWRITER_WRITE)
+	{
+		entry->opcode = IORING_OP_WRITE;
+		entry->fd = details.descriptor;
+		entry->addr = (unsigned long long)&details.file[details.written];
+		entry->len = details.file.size() - details.written;
+		entry->off = details.written;
+	}
+	else
+	{
+		entry->opcode = IORING_OP_CLOSE;
+		entry->fd = details.descriptor;
+	}
+
+	ring->submissionArray[index] = index;
+	//The entry must be complete before the kernel can see the new tail.
+	__atomic_store_n(ring->submissionTail, tail + 1, __ATOMIC_RELEASE);
+	ring->toSubmit++;
+}
+
+void FileWriter::reap(bool wait)
+{
+	int result = syscall(__NR_io_uring_enter, ring->descriptor, ring->toSubmit, wait ? 1 : 0,
+		wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if(result >= 0)
+		ring->toSubmit -= result;
+	else if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	{
+		/* The ring can not be used any more, so give up on the files still in it, closing those that were opened.
+		   A file whose close has been queued is left alone, as the ring may already have closed it and its
+		   descriptor may belong to another file by now. */
+		std::cout << "ERROR: io_uring_enter failed: " << strerror(errno) << "." << std::endl;
+		for(int i = 0; i < slots.size(); i++)
+		{
+			if(slots[i].busy)
+			{
+				std::cout << "ERROR: Could not write " << slots[i].name << "." << std::endl;
+				if(slots[i].descriptor >= 0 && slots[i].stage != FILEWRITER_CLOSE)
+					close(slots[i].descriptor);
+			}
+			slots[i].descriptor = -1;
+			slots[i].busy = false;
+		}
+		busySlots = 0;
+		ok = false;
+		return;
+	}
+
+	unsigned head = *ring->completionHead;
+	unsigned tail = __atomic_load_n(ring->completionTail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head++)
+	{
+		const struct io_uring_cqe& completion = ring->completions[head & ring->completionMask];
+		int slot = (int)completion.user_data;
+		Slot& details = slots[slot];
+		int res = completion.res;
+
+		if(details.stage == FILEWRITER_OPEN)
+		{
+			if(res < 0)
+			{
+				std::cout << "ERROR: Could not write " << details.name << ": " << strerror(-res) << "." << std::endl;
+				ok = false;
+				details.busy = false;
+			}
+			else
+			{
+				details.descriptor = res;
+				details.stage = details.file.empty() ? FILEWRITER_CLOSE : FILEWRITER_WRITE;
+			}
+		}
+		else if(details.stage == FILEWRITER_WRITE)
+		{
+			if(res <= 0)
+			{
+				std::cout << "ERROR: Could not write " << details.name << ": " << strerror(res < 0 ? -res : EIO) << "." << std::endl;
+				details.failed = true;
+				details.stage = FILEWRITER_CLOSE;
+			}
+			else
+			{
+				//Carry on after a short write.
+				details.written += res;
+				if(details.written == details.file.size())
+					details.stage = FILEWRITER_CLOSE;
+			}
+		}
+		else
+		{
+			if(res < 0 && !details.failed)
+			{
+				std::cout << "ERROR: Could not write " << details.name << ": " << strerror(-res) << "." << std::endl;
+				details.failed = true;
+			}
+			if(details.failed)
+				ok = false;
+			else
+				statsCount(STATS_BYTES_WRITTEN, details.file.size());
+			details.busy = false;
+		}
+
+		if(details.busy)
+			queueOperation(slot);
+		else
+		{
+			busySlots--;
+			details.file.clear();
+			spareBuffers.push_back(vector<unsigned char>());
+			spareBuffers.back().swap(details.file);
+		}
+	}
+	__atomic_store_n(ring->completionHead, head, __ATOMIC_RELEASE);
+}
+
+void FileWriter::poolThread()
+{
+	Slot job;
+	unique_lock<mutex> guard(lock);
+	while(true)
+	{
+		while(waiting.empty() && !stopping)
+			workReady.wait(guard);
+		if(waiting.empty())
+			break;
+
+		job.name.swap(waiting.front().name);
+		job.file.swap(waiting.front().file);
+		waiting.pop_front();
+		writing++;
+
+		guard.unlock();
+		bool written = writeNow(job.name, job.file);
+		guard.lock();
+
+		if(!written)
+			ok = false;
+		writing--;
+		job.file.clear();
+		spareBuffers.push_back(vector<unsigned char>());
+		spareBuffers.back().swap(job.file);
+		workDone.notify_all();
+	}
+	guard.unlock();
+
+	//Add what this thread counted to the totals before it goes away.
+	statsFlush();
+}
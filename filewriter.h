@@ -0,0 +1,114 @@
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//The ways a FileWriter can write its files.
+enum FileWriterBackend
+{
+	FILEWRITER_SYNC, //Open, write and close each file before write() returns.
+	FILEWRITER_THREADS, //Hand each file to a pool of threads which open, write and close it.
+	FILEWRITER_URING //Submit the opens, writes and closes of many files at once through a Linux io_uring.
+};
+
+//The default number of files a writer has in flight.
+const int FILEWRITER_DEPTH = 64;
+//The most threads the thread pool backend starts, whatever the depth.
+const int FILEWRITER_MAX_THREADS = 16;
+
+//Get a backend from its name: "sync", "threads" or "uring". Returns false if the name is unknown.
+bool parseFileWriterBackend(const char* name, FileWriterBackend& backend);
+//Get the name of a backend.
+const char* getFileWriterBackendName(FileWriterBackend backend);
+
+/* Writes whole files, such as serialised MIDI files, with up to a set number of them in flight at once.
+   Writing many small files is mostly opening and closing them. The io_uring backend keeps up to depth files
+   moving through open, write and close, submitting and reaping each batch with one system call, and the
+   thread pool backend spreads the same work over several threads. If io_uring can not be set up (an old
+   kernel, or one where it is turned off), the thread pool is used instead.
+   A writer belongs to the thread that created it. Each thread that writes files should have its own. */
+class FileWriter
+{
+	struct Ring;
+
+	//One file being written.
+	struct Slot
+	{
+		std::string name;
+		std::vector<unsigned char> file;
+		int descriptor;
+		size_t written;
+		//The operation in flight for the file: 0 for the open, 1 for a write and 2 for the close.
+		int stage;
+		bool failed;
+		bool busy;
+	};
+
+	FileWriterBackend backend;
+	int depth;
+	bool ok;
+	//Buffers the files have been written from, given back to write()'s callers so they can be reused.
+	std::vector<std::vector<unsigned char> > spareBuffers;
+
+	//The io_uring backend: the ring, a slot for each file in flight, and the number of slots in use.
+	Ring* ring;
+	std::vector<Slot> slots;
+	int busySlots;
+
+	//The thread pool backend: the files waiting for a thread and the number being written.
+	std::vector<std::thread> threads;
+	std::deque<Slot> waiting;
+	int writing;
+	bool stopping;
+	std::mutex lock;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+
+	public:
+		/* Create a writer. A depth of 0 or less uses FILEWRITER_DEPTH. The thread pool backend starts no more than
+		   maxThreads threads, so writers that share the work of one batch can share its threads between them. */
+		FileWriter(FileWriterBackend backend = FILEWRITER_SYNC, int depth = 0, int maxThreads = FILEWRITER_MAX_THREADS);
+		~FileWriter(); //Class destructor. Waits for any files still in flight.
+
+		//Get the backend in use, which is the thread pool if io_uring was asked for but is not available.
+		FileWriterBackend getBackend() const
+		{
+			return backend;
+		}
+
+		/* Write a file, swapping its bytes out of the buffer and leaving an empty buffer in their place for the
+		   caller to reuse. Waits while depth files are in flight. A file that can not be written is reported,
+		   and makes finish() return false. */
+		void write(const char* name, std::vector<unsigned char>& file);
+		//Wait until every file is written. Returns false if any could not be.
+		bool finish();
+
+	private:
+		//Take a buffer to give back to write()'s caller.
+		void takeSpare(std::vector<unsigned char>& file);
+		//Open, write and close a file at once. Returns false, after reporting it, if it could not be written.
+		static bool writeNow(const std::string& name, const std::vector<unsigned char>& file);
+
+		//io_uring: set up a ring with room for the given number of operations. Returns NULL if io_uring, or the operations the writer needs, are not available.
+		static Ring* setupRing(unsigned noOfEntries);
+		static void closeRing(Ring* ring);
+		//io_uring: queue the next operation for a slot.
+		void queueOperation(int slot);
+		//io_uring: submit what is queued and handle completions, waiting for at least one if wait is set.
+		void reap(bool wait);
+
+		//Thread pool: write files until the writer stops. Run by each of the pool's threads.
+		void poolThread();
+
+		//A writer can not be copied, as it owns its ring and threads.
+		FileWriter(const FileWriter&);
+		FileWriter& operator=(const FileWriter&);
+};
+
+#endif //FILEWRITER_H
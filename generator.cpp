@@ -0,0 +1,438 @@
+#include <string.h>
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+using namespace std;
+#include "generator.h"
+#include "packfile.h"
+#include "style.h"
+#include "stats.h"
+
+//The most bars each thread fills in at a time when a streamed piece is split between threads.
+static const int GENERATOR_THREAD_BARS = 4096;
+
+//What the numbers of a counter-based stream are used for. Stored in the last word of the stream's counter.
+enum GeneratorStream
+{
+	GENERATOR_STREAM_BAR, //The rhythm and melody of one bar.
+	GENERATOR_STREAM_CHORDS //The chain of chords for the whole piece.
+};
+
+//Draws every number of a piece from one generator, in the order they are used.
+struct SequentialDraws
+{
+	MTRandSIMD& mtrand;
+
+	MTRandSIMD& bar(int)
+	{
+		return mtrand;
+	}
+	MTRandSIMD& chords()
+	{
+		return mtrand;
+	}
+};
+
+//Draws a piece's numbers from counter-based streams: one for the chord chain and one for each bar.
+struct StreamDraws
+{
+	PhiloxRand::uint32 piece;
+	PhiloxRand barRand;
+	PhiloxRand chordRand;
+
+	StreamDraws(PhiloxRand::uint32 seed, PhiloxRand::uint32 piece)
+		: piece(piece), barRand(seed), chordRand(seed, piece, 0, GENERATOR_STREAM_CHORDS)
+	{
+	}
+	PhiloxRand& bar(int barIndex)
+	{
+		barRand.setStream(piece, barIndex, GENERATOR_STREAM_BAR);
+		return barRand;
+	}
+	PhiloxRand& chords()
+	{
+		return chordRand;
+	}
+};
+
+/* Add one bar to the MIDI file: its chord, and a rhythm and melody chosen to go over it.
+   PARAMETERS:
+   midi - the MIDI file the bar is added to. It needs four tracks after the first, three for the chord and one for the melody.
+   chordNumber - the chord the bar is built on.
+   style - the compiled style, which is used to choose the melody and the note durations.
+   rand - the random number generator used for the rhythm and the melody. */
+template<class Random> static void addBar(MidiFile& midi, int chordNumber, const Style& style, Random& rand)
+{
+	//Even chord numbers are major chords and odd numbers are minor chords.
+	int chordRoot = chordNumber / 2;
+	bool chordMinor = chordNumber % 2 == 1;
+	
+	//Add the chosen chord to the midi file.
+	{
+		StatsTimer timer(STATS_PHASE_ADD_CHORD);
+		midi.addChord(0, STYLE_BAR_TICKS, 4, chordRoot, chordMinor);
+	}
+		
+	//Choose the rhythm that fills the bar, with a single draw.
+	const int* noteDurations;
+	int noOfNotes;
+	{
+		StatsTimer timer(STATS_PHASE_RHYTHM);
+		noOfNotes = style.chooseRhythm(rand.randInt(), noteDurations);
+		//Style::attach() and compile() only allow rhythms that fit, but never write past the buffer below.
+		noOfNotes = min(noOfNotes, STYLE_MAX_BAR_NOTES);
+	}
+	statsCount(STATS_RHYTHM_DRAWS);
+	
+	//The random numbers for the melody notes, drawn in one go.
+	typename Random::uint32 randoms[STYLE_MAX_BAR_NOTES];
+		
+	//Add the melody notes to the midi file based on the chord that has been chosen.
+	{
+		StatsTimer timer(STATS_PHASE_MELODY);
+		rand.fill(randoms, noOfNotes);
+		for(int i = 0; i < noOfNotes; i++)
+		{
+			midi.addNote(3, noteDurations[i], 6, style.chooseMelodyNote(chordNumber, randoms[i]));
+		}
+	}
+	statsCount(STATS_MELODY_NOTES, noOfNotes);
+	statsCount(STATS_BARS);
+}
+
+//Choose the chord for the bar after the chords so far, adding it to them.
+template<class Random> static ChordHistory chooseNextChord(ChordHistory chords, const Style& style, Random& chordRand)
+{
+	StatsTimer timer(STATS_PHASE_NEXT_CHORD);
+	statsCount(STATS_CHORD_DRAWS);
+	return addToChordHistory(chords, style.chooseNextChord(chords, chordRand.randInt()));
+}
+
+/* Add one bar to the MIDI file and choose the chord for the bar after it.
+   PARAMETERS:
+   midi, style, rand - as for addBar().
+   chords - the chords so far, the last of which is the chord of this bar.
+   chordRand - the random number generator used for the next chord. It can be the same one as rand.
+   RETURNS: the chords so far with the chord for the next bar added. */
+template<class Random> static ChordHistory generateBar(MidiFile& midi, ChordHistory chords, const Style& style, Random& rand, Random& chordRand)
+{
+	addBar(midi, getChordFromHistory(chords, 0), style, rand);
+	return chooseNextChord(chords, style, chordRand);
+}
+
+//Add the number of events in each of the MIDI file's tracks to the stats.
+static void countEvents(const MidiFile& midi)
+{
+	if(!statsEnabled)
+		return;
+	for(int i = 0; i < midi.getNoOfTracks(); i++)
+		statsCountEvents(i, midi.getNoOfEvents(i));
+}
+
+//Generate a piece, taking the random numbers for each bar from draws.
+template<class Draws> static void generatePieceFrom(MidiFile& midi, int noOfBars, const Style& style, Draws& draws)
+{
+	//Holds the last few chords. The style says which chord to start on, which is C for the built-in tables.
+	ChordHistory chords = startChordHistory(style.getTransitionTable().getStartState());
+	for(int i = 0; i < noOfBars; i++)
+		chords = generateBar(midi, chords, style, draws.bar(i), draws.chords());
+}
+
+void generatePiece(MidiFile& midi, int noOfBars, const Style& style, MTRandSIMD& mtrand)
+{
+	SequentialDraws draws = { mtrand };
+	generatePieceFrom(midi, noOfBars, style, draws);
+}
+
+void generatePiece(MidiFile& midi, int noOfBars, const Style& style, PhiloxRand::uint32 seed, PhiloxRand::uint32 piece)
+{
+	StreamDraws draws(seed, piece);
+	generatePieceFrom(midi, noOfBars, style, draws);
+}
+
+//Generate a piece and write it to a MIDI file, taking the random numbers for each bar from draws.
+template<class Draws> static void generateMidiFrom(MidiFile& withchordaccompaniment, const char* midiName, int noOfBars,
+	const Style& style, Draws& draws, bool streaming, bool compact)
+{
+	//Empty the file, keeping the memory left over from the last piece.
+	withchordaccompaniment.reset();
+	
+	//Add four tracks to the midi file. Three for chords and one for melody.
+	for(int i = 0; i < 4; i++)
+		withchordaccompaniment.addTrack();
+	
+	//Without streaming the whole piece is built in memory, then written in one go.
+	if(!streaming)
+	{
+		generatePieceFrom(withchordaccompaniment, noOfBars, style, draws);
+		countEvents(withchordaccompaniment);
+		statsCount(STATS_PIECES);
+		
+		StatsTimer timer(STATS_PHASE_WRITE);
+		withchordaccompaniment.setCompact(compact);
+		withchordaccompaniment.writeToFile(midiName);
+		return;
+	}
+	
+	//When streaming, every bar is written to the file as soon as it has been generated.
+	MidiStreamWriter stream;
+	if(!stream.open(midiName, 128, compact))
+		return;
+			
+	//Holds the last few chords. The style says which chord to start on, which is C for the built-in tables.
+	ChordHistory chords = startChordHistory(style.getTransitionTable().getStartState());
+	
+	for(int i = 0; i < noOfBars; i++)
+	{
+		chords = generateBar(withchordaccompaniment, chords, style, draws.bar(i), draws.chords());
+		countEvents(withchordaccompaniment);
+		
+		StatsTimer timer(STATS_PHASE_WRITE);
+		stream.writeBar(withchordaccompaniment);
+	}
+	statsCount(STATS_PIECES);
+	
+	//Finish off the streamed file.
+	StatsTimer timer(STATS_PHASE_WRITE);
+	stream.close();
+}
+
+void generateMidi(const char* midiName, int noOfBars, const Style& style, MTRandSIMD& mtrand, bool streaming, bool compact)
+{
+	//Create the midifile object. When streaming it only ever holds the bar being generated.
+	MidiFile withchordaccompaniment;
+	generateMidi(withchordaccompaniment, midiName, noOfBars, style, mtrand, streaming, compact);
+}
+
+void generateMidi(MidiFile& midi, const char* midiName, int noOfBars, const Style& style, MTRandSIMD& mtrand,
+	bool streaming, bool compact)
+{
+	SequentialDraws draws = { mtrand };
+	generateMidiFrom(midi, midiName, noOfBars, style, draws, streaming, compact);
+}
+
+//Add the given bars of a piece to the MIDI file, each from its own stream, on the chords already chosen for them.
+static void generateBars(MidiFile* midi, const Style* style, PhiloxRand::uint32 seed, PhiloxRand::uint32 piece,
+	const int* chords, int firstBar, int noOfBars)
+{
+	StreamDraws draws(seed, piece);
+	for(int i = firstBar; i < firstBar + noOfBars; i++)
+		addBar(*midi, chords[i], *style, draws.bar(i));
+	
+	//Add this thread's stats to the totals before the thread goes away.
+	statsFlush();
+}
+
+void generateMidi(MidiFile& midi, const char* midiName, int noOfBars, const Style& style,
+	PhiloxRand::uint32 seed, PhiloxRand::uint32 piece, bool streaming, bool compact, int noOfThreads)
+{
+	StreamDraws draws(seed, piece);
+	if(noOfThreads <= 1 || noOfBars < noOfThreads)
+	{
+		generateMidiFrom(midi, midiName, noOfBars, style, draws, streaming, compact);
+		return;
+	}
+	
+	//The first phase samples the chord chain, which has to be done in order but is cheap.
+	vector<int> chords(noOfBars);
+	ChordHistory history = startChordHistory(style.getTransitionTable().getStartState());
+	for(int i = 0; i < noOfBars; i++)
+	{
+		chords[i] = getChordFromHistory(history, 0);
+		history = chooseNextChord(history, style, draws.chords());
+	}
+	
+	midi.reset();
+	for(int i = 0; i < 4; i++)
+		midi.addTrack();
+	
+	//Each thread fills in its share of the bars in a MIDI file of its own.
+	vector<MidiFile> parts(noOfThreads);
+	for(int t = 0; t < noOfThreads; t++)
+		for(int i = 0; i < 4; i++)
+			parts[t].addTrack();
+	
+	MidiStreamWriter stream;
+	if(streaming && !stream.open(midiName, 128, compact))
+		return;
+	
+	//The second phase fills in the bars. When streaming they are done a window at a time, so memory use stays bounded.
+	int windowBars = streaming ? noOfThreads * GENERATOR_THREAD_BARS : noOfBars;
+	for(int firstBar = 0; firstBar < noOfBars; firstBar += windowBars)
+	{
+		int barsLeft = noOfBars - firstBar < windowBars ? noOfBars - firstBar : windowBars;
+		vector<thread> workers;
+		for(int t = 0; t < noOfThreads; t++)
+		{
+			int first = firstBar + (long long)barsLeft * t / noOfThreads;
+			int last = firstBar + (long long)barsLeft * (t + 1) / noOfThreads;
+			workers.push_back(thread(generateBars, &parts[t], &style, seed, piece, &chords[0], first, last - first));
+		}
+		for(int t = 0; t < workers.size(); t++)
+			workers[t].join();
+		
+		//Every bar ends where the next begins, so the parts join up in order.
+		for(int t = 0; t < noOfThreads; t++)
+		{
+			countEvents(parts[t]);
+			if(streaming)
+			{
+				StatsTimer timer(STATS_PHASE_WRITE);
+				stream.writeBar(parts[t]);
+			}
+			else
+			{
+				midi.appendEvents(parts[t]);
+				parts[t].clearEvents();
+			}
+		}
+	}
+	statsCount(STATS_PIECES);
+	
+	StatsTimer timer(STATS_PHASE_WRITE);
+	if(streaming)
+		stream.close();
+	else
+	{
+		midi.setCompact(compact);
+		midi.writeToFile(midiName);
+	}
+}
+
+static const char* GENERATOR_RNG_NAMES[] = { "mt19937", "sfmt", "philox" };
+
+bool parseGeneratorRng(const char* name, GeneratorRng& rng)
+{
+	for(int i = 0; i < sizeof(GENERATOR_RNG_NAMES) / sizeof(GENERATOR_RNG_NAMES[0]); i++)
+	{
+		if(strcmp(name, GENERATOR_RNG_NAMES[i]) == 0)
+		{
+			rng = (GeneratorRng)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* getGeneratorRngName(GeneratorRng rng)
+{
+	return GENERATOR_RNG_NAMES[rng];
+}
+
+void seedPiece(MTRandSIMD& mtrand, MTRandSIMD::uint32 baseSeed, MTRandSIMD::uint32 pieceIndex)
+{
+	//Seed with both numbers, so every (base seed, piece index) pair gets its own sequence.
+	MTRandSIMD::uint32 pieceSeed[2] = { baseSeed, pieceIndex };
+	mtrand.seed(pieceSeed, 2);
+}
+
+void generateBatchPiece(MidiFile& midi, vector<unsigned char>& buffer, int noOfBars, const Style& style,
+	MTRandSIMD& mtrand, MTRandSIMD::uint32 baseSeed, MTRandSIMD::uint32 piece, bool compact, GeneratorRng rng)
+{
+	midi.reset();
+	for(int i = 0; i < 4; i++)
+		midi.addTrack();
+	
+	if(rng == GENERATOR_RNG_PHILOX)
+		generatePiece(midi, noOfBars, style, baseSeed, piece);
+	else
+	{
+		mtrand.setMode(rng == GENERATOR_RNG_SFMT ? MTRANDSIMD_SFMT : MTRANDSIMD_MT19937);
+		seedPiece(mtrand, baseSeed, piece);
+		generatePiece(midi, noOfBars, style, mtrand);
+	}
+	countEvents(midi);
+	statsCount(STATS_PIECES);
+	
+	StatsTimer timer(STATS_PHASE_WRITE);
+	midi.setCompact(compact);
+	buffer.clear();
+	midi.writeToBuffer(buffer);
+}
+
+//Generate pieces until there are none left in the batch. Run by each of the worker threads.
+static void batchWorker(const char* midiPrefix, int noOfPieces, int noOfBars, const Style* style,
+	MTRandSIMD::uint32 baseSeed, bool streaming, bool compact, GeneratorRng rng, int barThreads, PieceCache* cache,
+	FileWriterBackend output, int outputDepth, int outputThreads, PackWriter* pack, atomic<int>* nextPiece)
+{
+	//Each worker owns its own random number generator, which is reseeded for every piece.
+	//Counter-based streams need no generator to be kept, as each piece picks its own streams.
+	MTRandSIMD mtrand(baseSeed, rng == GENERATOR_RNG_SFMT ? MTRANDSIMD_SFMT : MTRANDSIMD_MT19937);
+	//And its own MIDI file, which is reset for every piece so its memory is reused.
+	MidiFile midi;
+	//Buffer used to build the name of each MIDI file.
+	char midiName[1024];
+	//Buffer cached pieces are read into and generated pieces are serialised into.
+	vector<unsigned char> buffer;
+	unsigned long long styleHash = cache ? style->hash() : 0;
+	//Writes the pieces that are generated into memory first, which is all of them unless they are streamed or
+	//their bars are shared. With the default backend and no cache or pack, generateMidi() writes them instead, as before.
+	bool inMemory = !streaming && (pack || (barThreads == 1 && (cache || output != FILEWRITER_SYNC)));
+	//The writer only starts threads or a ring if it will have files to write.
+	FileWriter writer(inMemory && !pack ? output : FILEWRITER_SYNC, outputDepth, outputThreads);
+	
+	//Take the next piece that has not been claimed by another worker.
+	for(int piece = (*nextPiece)++; piece < noOfPieces; piece = (*nextPiece)++)
+	{
+		snprintf(midiName, sizeof(midiName), "%s%d.mid", midiPrefix, piece);
+		if(inMemory)
+		{
+			PieceKey key = { styleHash, baseSeed, (unsigned int)piece, noOfBars, compact, rng };
+			if(cache && cache->get(key, buffer))
+				statsCount(STATS_CACHE_HITS);
+			else
+			{
+				generateBatchPiece(midi, buffer, noOfBars, *style, mtrand, baseSeed, piece, compact, rng);
+				if(cache)
+					cache->put(key, buffer);
+			}
+			if(pack)
+				pack->append(piece, buffer, baseSeed, piece, 0, noOfBars);
+			else
+				writer.write(midiName, buffer);
+		}
+		else if(rng == GENERATOR_RNG_PHILOX)
+			generateMidi(midi, midiName, noOfBars, *style, baseSeed, piece, streaming, compact, barThreads);
+		else
+		{
+			seedPiece(mtrand, baseSeed, piece);
+			generateMidi(midi, midiName, noOfBars, *style, mtrand, streaming, compact);
+		}
+	}
+	
+	writer.finish();
+	
+	//Add this worker's stats to the totals before the thread goes away.
+	statsFlush();
+}
+
+void generateBatch(const char* midiPrefix, int noOfPieces, int noOfThreads, int noOfBars,
+	const Style& style, MTRandSIMD::uint32 baseSeed, bool streaming, bool compact, GeneratorRng rng, PieceCache* cache,
+	FileWriterBackend output, int outputDepth, PackWriter* pack)
+{
+	if(noOfThreads < 1)
+		noOfThreads = 1;
+	
+	//With fewer pieces than threads, counter-based streams let the threads left over share the bars of each piece.
+	int barThreads = 1;
+	if(noOfThreads > noOfPieces)
+	{
+		if(rng == GENERATOR_RNG_PHILOX && noOfPieces > 0 && !pack)
+			barThreads = noOfThreads / noOfPieces;
+		noOfThreads = noOfPieces;
+	}
+	
+	//The index of the next piece to be generated, shared by all of the workers.
+	atomic<int> nextPiece(0);
+	
+	//Each worker has its own writer, so split the files in flight and the writing threads between them.
+	int workerDepth = max(1, (outputDepth > 0 ? outputDepth : FILEWRITER_DEPTH) / max(1, noOfThreads));
+	int workerThreads = max(1, FILEWRITER_MAX_THREADS / max(1, noOfThreads));
+	
+	//Start the workers, then wait for all of them to run out of pieces.
+	vector<thread> workers;
+	for(int i = 0; i < noOfThreads; i++)
+		workers.push_back(thread(batchWorker, midiPrefix, noOfPieces, noOfBars, &style, baseSeed, streaming, compact, rng, barThreads, cache, output, workerDepth, workerThreads, pack, &nextPiece));
+	for(int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
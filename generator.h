@@ -0,0 +1,108 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include "mtrandsimd.h"
+#include "philoxrand.h"
+#include "midifile.h"
+#include "style.h"
+#include "piececache.h"
+#include "filewriter.h"
+
+class PackWriter;
+
+//Constants used to set the chord numbers used in the transition tables.
+const int CHORD_C  = chordNumber(MIDIFILE_NOTE_C, false);
+const int CHORD_Dm = chordNumber(MIDIFILE_NOTE_D, true);
+const int CHORD_F  = chordNumber(MIDIFILE_NOTE_F, false);
+const int CHORD_G  = chordNumber(MIDIFILE_NOTE_G, false);
+const int CHORD_Am = chordNumber(MIDIFILE_NOTE_A, true);
+
+//The random number generators a batch can draw from.
+enum GeneratorRng
+{
+	GENERATOR_RNG_MT19937, //An MTRandSIMD in the mode that gives the same numbers as MTRand, seeded by seedPiece().
+	GENERATOR_RNG_SFMT, //An MTRandSIMD in its SFMT mode, seeded by seedPiece().
+	GENERATOR_RNG_PHILOX //Counter-based streams, one for the chords of each piece and one for each of its bars.
+};
+
+//Get a random number generator from its name: "mt19937", "sfmt" or "philox". Returns false if the name is unknown.
+bool parseGeneratorRng(const char* name, GeneratorRng& rng);
+//Get the name of a random number generator.
+const char* getGeneratorRngName(GeneratorRng rng);
+
+/* The function used to generate the MIDI file.
+   PARAMETERS:
+   midiName - the name of the MIDI file that will be written.
+   noOfBars - the number of bars the MIDI file will have.
+   style - the compiled style used to generate the MIDI file.
+   mtrand - the random number generator used for every choice made in the piece. In its MT19937 mode it makes the
+   same choices as an MTRand seeded the same way.
+   streaming - write each bar to a single track file as soon as it is generated, so memory use does not grow with noOfBars.
+   compact - write the smaller single track form described by MidiFile::setCompact(). */
+void generateMidi(const char* midiName, int noOfBars, const Style& style, MTRandSIMD& mtrand,
+	bool streaming = false, bool compact = false);
+
+/* The same as above, but generates into the given MIDI file, which is reset first.
+   Passing the same MidiFile for piece after piece reuses the memory of its tracks and buffers. */
+void generateMidi(MidiFile& midi, const char* midiName, int noOfBars, const Style& style, MTRandSIMD& mtrand,
+	bool streaming = false, bool compact = false);
+
+/* The same again, but with the random numbers taken from counter-based streams picked by the seed and the piece
+   index. The chord chain has a stream of its own, and each bar has one for its rhythm and melody, so a bar's notes
+   depend only on the seed, the piece, the bar and its chord.
+   With more than one thread the piece is generated in two phases: the chord chain is sampled first, then the
+   threads fill in the bars, each taking a run of them. The file is the same whatever the number of threads. */
+void generateMidi(MidiFile& midi, const char* midiName, int noOfBars, const Style& style,
+	PhiloxRand::uint32 seed, PhiloxRand::uint32 piece, bool streaming = false, bool compact = false, int noOfThreads = 1);
+
+/* Generate a piece into a MIDI file in memory, without writing it anywhere.
+   PARAMETERS:
+   midi - the MIDI file the bars are added to. It needs four tracks after the first, three for the chords and one for the melody.
+   noOfBars - the number of bars to generate.
+   style - the compiled style used to generate the piece.
+   mtrand - the random number generator used for every choice made in the piece. */
+void generatePiece(MidiFile& midi, int noOfBars, const Style& style, MTRandSIMD& mtrand);
+//The same, but with the random numbers taken from the counter-based streams of a piece, as generateMidi() does.
+void generatePiece(MidiFile& midi, int noOfBars, const Style& style, PhiloxRand::uint32 seed, PhiloxRand::uint32 piece);
+
+/* Generate one piece of a batch into memory and serialise it, giving the bytes generateBatch() writes for it
+   without streaming.
+   PARAMETERS:
+   midi - the MIDI file the piece is generated in. It is reset first.
+   buffer - the buffer the file's bytes are written to. It is cleared first.
+   noOfBars, style, compact, rng - as for generateBatch().
+   mtrand - the generator the piece draws from, unless rng is GENERATOR_RNG_PHILOX. It is reseeded for the piece.
+   baseSeed, piece - the seed of the batch and the index of the piece in it. */
+void generateBatchPiece(MidiFile& midi, std::vector<unsigned char>& buffer, int noOfBars, const Style& style,
+	MTRandSIMD& mtrand, MTRandSIMD::uint32 baseSeed, MTRandSIMD::uint32 piece, bool compact, GeneratorRng rng);
+
+/* Generate a batch of MIDI files using several worker threads.
+   Each piece gets its own random numbers, picked by the base seed and the piece index,
+   so the output for a piece does not depend on the number of threads used. With counter-based streams and
+   fewer pieces than threads, the threads left over share the bars of each piece.
+   PARAMETERS:
+   midiPrefix - the files are named midiPrefix followed by the piece index and ".mid".
+   noOfPieces - the number of MIDI files to generate.
+   noOfThreads - the number of worker threads to generate them with.
+   noOfBars - the number of bars each MIDI file will have.
+   style - the compiled style used to generate every MIDI file.
+   baseSeed - the seed the per piece random number generators are derived from.
+   streaming - write each piece a bar at a time, as generateMidi() does.
+   compact - write each piece in the compact form, as generateMidi() does.
+   rng - the random number generator each piece draws from.
+   cache - if not NULL, pieces are looked up here first and added when they have to be generated. Streamed pieces,
+   which can be too long to hold in memory, are never cached.
+   output, outputDepth - how the files are written, and how many can be in flight (see FileWriter). The depth, and
+   the threads of the thread pool backend, are shared out between the worker threads.
+   Streamed pieces, and pieces whose bars are shared between threads, are always written as they are generated.
+   pack - if not NULL, each piece is appended to the pack as style 0, with its index as its id, instead of being
+   written to a file of its own. Pieces can not be streamed into a pack, and the bars of a piece are not shared. */
+void generateBatch(const char* midiPrefix, int noOfPieces, int noOfThreads, int noOfBars,
+	const Style& style, MTRandSIMD::uint32 baseSeed, bool streaming = false, bool compact = false,
+	GeneratorRng rng = GENERATOR_RNG_MT19937, PieceCache* cache = NULL, FileWriterBackend output = FILEWRITER_SYNC,
+	int outputDepth = 0, PackWriter* pack = NULL);
+
+//Seed a random number generator for the piece with the given index in a batch.
+void seedPiece(MTRandSIMD& mtrand, MTRandSIMD::uint32 baseSeed, MTRandSIMD::uint32 pieceIndex);
+
+#endif //GENERATOR_H
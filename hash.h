@@ -0,0 +1,27 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+
+/* 64 bit FNV-1a, used to key things by their contents.
+   Structures are hashed a field at a time, so padding between the fields never changes the result. */
+
+//The hash of nothing, which every hash starts from.
+const unsigned long long HASH_START = 14695981039346656037ULL;
+
+//Add bytes to a hash.
+inline unsigned long long hashBytes(unsigned long long hash, const void* data, size_t length)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < length; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+//Add a number to a hash.
+template<class T> inline unsigned long long hashValue(unsigned long long hash, T value)
+{
+	return hashBytes(hash, &value, sizeof(value));
+}
+
+#endif //HASH_H
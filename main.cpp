@@ -1,272 +1,528 @@
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <deque>
+#include <map>
 using namespace std;
 //#include <iostream>
-#include "include/MersenneTwister.h"
+#include "mtrandsimd.h"
 #include "midifile.h"
+#include "generator.h"
+#include "style.h"
+#include "tables.h"
+#include "midireader.h"
+#include "stats.h"
+#include "server.h"
+#include "stylelibrary.h"
+#include "runner.h"
+#include "packfile.h"
 
-//Random number generator object.
-MTRand mtrand;
+//Counts the events in a MIDI file, used by the --check option.
+struct EventCounter
+{
+	vector<unsigned long> events; //The number of events in each track.
+	vector<unsigned long> notes; //The number of note ons (with a velocity above 0) in each track.
+	vector<unsigned long> lengths; //The time of the last event in each track.
+	
+	void operator()(int track, const MidiReaderEvent& event)
+	{
+		if(track >= events.size())
+		{
+			events.resize(track + 1, 0);
+			notes.resize(track + 1, 0);
+			lengths.resize(track + 1, 0);
+		}
+		events[track]++;
+		if((event.status & 0xF0) == 0x90 && event.data2 > 0)
+			notes[track]++;
+		lengths[track] = event.time;
+	}
+};
 
-//Constants used to set the chord numbers used in the transition tables.
-const int CHORD_C  = MIDIFILE_NOTE_C*2;
-const int CHORD_Dm = MIDIFILE_NOTE_D*2+1;
-const int CHORD_F  = MIDIFILE_NOTE_F*2;
-const int CHORD_G  = MIDIFILE_NOTE_G*2;
-const int CHORD_Am = MIDIFILE_NOTE_A*2+1;
+//Read a MIDI file and print what is in each of its tracks. Returns false if the file is malformed.
+bool checkMidi(const char* midiName)
+{
+	MidiFileReader reader;
+	if(!reader.open(midiName))
+		return false;
+	
+	EventCounter counter;
+	counter.events.resize(reader.getNoOfTracks(), 0);
+	counter.notes.resize(reader.getNoOfTracks(), 0);
+	counter.lengths.resize(reader.getNoOfTracks(), 0);
+	bool ok = reader.visit(counter);
+	
+	std::cout << midiName << ": format " << reader.getFormat() << ", " << reader.getNoOfTracks() << " tracks, "
+		<< reader.getDivision() << " ticks per quarter note" << std::endl;
+	for(int i = 0; i < counter.events.size(); i++)
+	{
+		std::cout << "  track " << i << ": " << counter.events[i] << " events, " << counter.notes[i] << " notes, "
+			<< counter.lengths[i] << " ticks" << std::endl;
+	}
+	if(!ok)
+		std::cout << "ERROR: " << midiName << " has a malformed track." << std::endl;
+	return ok;
+}
 
-//Choose next chord using the chord transition table given.
-int chooseNextChord(float chordTransitionTable[24])
+/* Write each piece of a pack to a file of its own, named the prefix followed by the piece's id and ".mid".
+   Returns false if the pack can not be read or any piece could not be written. */
+bool extractPack(const char* packName, const char* midiPrefix, FileWriterBackend output, int outputDepth)
 {
-	//Get a random number between 0 and 1.
-	float randomProb = mtrand.rand();
-	//Float used to store the sum of the probabilities in the transition table.
-	float cumulativeProb = 0;
+	PackReader pack;
+	if(!pack.open(packName))
+		return false;
 	
-	//For each of the probabilities in the transition table.
-	for(int i = 0; i < 24; i++)
+	FileWriter writer(output, outputDepth);
+	vector<unsigned char> buffer;
+	char midiName[1024];
+	int extracted = 0;
+	bool ok = true;
+	for(int id = 0; id < pack.getNoOfPieces(); id++)
 	{
-		//Add the probability to the cumulativeProb variable.
-		cumulativeProb += chordTransitionTable[i];
-		
-		/* If the cumulative probability is more than the random number chosen
-		   Return the element number, which doubles as the chord number */
-		if(cumulativeProb > randomProb)
-			return i;
+		PackPiece piece;
+		if(!pack.getPiece(id, piece))
+		{
+			ok = false;
+			continue;
+		}
+		snprintf(midiName, sizeof(midiName), "%s%d.mid", midiPrefix, id);
+		buffer.assign(piece.data, piece.data + piece.length);
+		writer.write(midiName, buffer);
+		extracted++;
 	}
+	ok = writer.finish() && ok;
+	
+	std::cout << "Extracted " << extracted << " pieces made with --rng " << getGeneratorRngName(pack.getRng())
+		<< " --compact " << pack.isCompact() << " from " << packName << ", in the styles";
+	for(int i = 0; i < pack.getNoOfStyles(); i++)
+		std::cout << " " << pack.getStyleName(i);
+	std::cout << "." << std::endl;
+	return ok;
 }
 
-/* The function used to generate the MIDI file.
-   PARAMETERS:
-   midiName - the name of the MIDI file that will be written.
-   noOfBars - the number of bars the MIDI file will have.
-   transitionTable - the transition table used to generate the MIDI file. */
-void generateMidi(const char* midiName, int noOfBars, float transitionTable[24][24])
+//Print the command line options.
+void printUsage(const char* programName)
 {
-	//Melody notes for each chord used.
-	//TODO: Try and put these outside the function again.
-	int cMelodyNotes[3]	 = { MIDIFILE_NOTE_C, MIDIFILE_NOTE_E, MIDIFILE_NOTE_G };
-	int dMinorMelodyNotes[3] = { MIDIFILE_NOTE_D, MIDIFILE_NOTE_F, MIDIFILE_NOTE_A };
-	int fMelodyNotes[3]	 = { MIDIFILE_NOTE_F, MIDIFILE_NOTE_A, MIDIFILE_NOTE_C };
-	int gMelodyNotes[3]	 = { MIDIFILE_NOTE_G, MIDIFILE_NOTE_B, MIDIFILE_NOTE_D };
-	int aMinorMelodyNotes[3] = { MIDIFILE_NOTE_A, MIDIFILE_NOTE_C, MIDIFILE_NOTE_E };
-	 
-	//The note durations that can be chosen.
-	int noteDurations[] = {64, 128, 256};
+	std::cout << "Usage: " << programName << " [options]" << std::endl
+		<< "With no options, one MIDI file is generated from each of the transition tables." << std::endl
+		<< "  --batch <n>      generate n MIDI files from one transition table" << std::endl
+		<< "  --threads <n>    number of worker threads used by --batch (default 1)" << std::endl
+		<< "  --bars <n>       number of bars in each MIDI file (default 8)" << std::endl
+		<< "  --seed <n>       base seed for --batch (default 0)" << std::endl
+		<< "  --rng <name>     random numbers: mt19937, which MTRand also gives, sfmt, or philox, which gives every bar" << std::endl
+		<< "                   of every piece its own stream and needs --batch (default mt19937)" << std::endl
+		<< "  --table <1-3>    built-in transition table used by --batch (default 1)" << std::endl
+		<< "  --style <file>   style file (such as one written by train) used instead of a transition table" << std::endl
+		<< "  --library <file> style library to use, whose styles --serve also serves after the built-in ones" << std::endl
+		<< "  --name <style>   style from the --library used instead of a transition table" << std::endl
+		<< "  --write-library <file> write a style library of the --library styles, the built-in transition tables" << std::endl
+		<< "                   as table1 to table3 and the --style, named after its file, then exit" << std::endl
+		<< "  --prefix <name>  file name prefix used by --batch and --style (default \"piece\")" << std::endl
+		<< "  --stream <0|1>   write each bar as soon as it is generated, to a single track file (default 0)" << std::endl
+		<< "  --compact <0|1>  write smaller single track files using running status (default 0)" << std::endl
+		<< "  --stats <file>   write counters and phase timings as JSON to the file (\"-\" for the console) at exit" << std::endl
+		<< "  --serve <socket> serve pieces to clients on a Unix domain socket, using --threads workers" << std::endl
+		<< "  --request <socket> ask a server for a piece of --bars bars from --table (4 for a served --style)," << std::endl
+		<< "                   with --seed, --compact and --rng, and write it to <prefix>.mid" << std::endl
+		<< "  --cache <dir>    look up --batch and --serve pieces in a cache directory first, and add new ones to it" << std::endl
+		<< "  --cache-size <MB> the most disk space the cache directory grows to (default 1024)" << std::endl
+		<< "  --manifest <file> run the jobs listed in the file, one \"<style> <bars> <seed> <output file>\" per line," << std::endl
+		<< "                   with --threads generators while the finished pieces are written out. A style" << std::endl
+		<< "                   is table1 to table3, the --style file's name or a --library style" << std::endl
+		<< "  --queue-size <MB> the most generated pieces --manifest holds waiting to be written (default 64)" << std::endl
+		<< "  --output <sync|threads|uring> how --batch and --manifest write their files: one at a time, on a pool" << std::endl
+		<< "                   of threads, or through io_uring, which falls back to threads if it is not available" << std::endl
+		<< "                   (default sync)" << std::endl
+		<< "  --output-depth <n> the most files --output threads or uring has in flight (default 64)" << std::endl
+		<< "  --pack <file>    append the pieces of --batch or --manifest to one pack file, with an index of their" << std::endl
+		<< "                   seeds and styles, instead of writing a file for each" << std::endl
+		<< "  --extract <pack> write each piece in a pack to <prefix><id>.mid, using --output" << std::endl
+		<< "  --check <file>   read a MIDI file and print what is in each of its tracks" << std::endl;
+}
+
+//Write the stats report to the named file, or to the console if the name is "-".
+bool writeStats(const char* statsFile, int noOfThreads)
+{
+	if(strcmp(statsFile, "-") == 0)
+	{
+		statsReport(stdout, noOfThreads);
+		return true;
+	}
 	
-	//Create the midifile object.
-	MidiFile withchordaccompaniment;
+	FILE* file = fopen(statsFile, "w");
+	if(!file)
+	{
+		std::cout << "ERROR: Could not open " << statsFile << " for writing." << std::endl;
+		return false;
+	}
+	statsReport(file, noOfThreads);
+	fclose(file);
+	return true;
+}
+
+//Get the name a style file is known by: its file name without the directory or the extension.
+string styleFileName(const char* styleFile)
+{
+	string name = styleFile;
+	name = name.substr(name.find_last_of('/') + 1);
+	return name.substr(0, name.find_last_of('.'));
+}
+
+/* Run a manifest of jobs. A job's style is one of the built-in transition tables, named table1 to table3, the
+   --style file, named after the file, or a style from the library. Library styles are only taken from the
+   library if a job uses them. Returns false if the manifest is invalid or any file could not be written. */
+bool runManifestFile(const char* manifestName, const StyleLibrary& library, const Style builtInStyles[BUILTIN_STYLES],
+	const char* styleFile, const Style& loadedStyle, int noOfThreads, bool compact, GeneratorRng rng,
+	PieceCache* cache, size_t queueBytes, FileWriterBackend output, int outputDepth, PackWriter* pack)
+{
+	vector<ManifestJob> jobs;
+	if(!readManifest(manifestName, jobs))
+		return false;
 	
-	//Add four tracks to the midi file. Three for chords and one for melody.
-	for(int i = 0; i < 4; i++)
-		withchordaccompaniment.addTrack();
-			
-	//Holds the number for the chord. First chord should be C.
-	int chordNumber = CHORD_C;
+	map<string, int> styleNumbers;
+	vector<const Style*> styles;
+	vector<string> styleNames;
+	for(int i = 0; i < BUILTIN_STYLES; i++)
+	{
+		styleNumbers["table" + to_string(i + 1)] = styles.size();
+		styles.push_back(&builtInStyles[i]);
+		styleNames.push_back("table" + to_string(i + 1));
+	}
+	if(styleFile)
+	{
+		styleNumbers[styleFileName(styleFile)] = styles.size();
+		styles.push_back(&loadedStyle);
+		styleNames.push_back(styleFileName(styleFile));
+	}
 	
-	for(int i = 0; i < noOfBars; i++)
+	//A deque, so the styles already handed out stay where they are as more are added.
+	deque<Style> libraryStyles;
+	for(int i = 0; i < jobs.size(); i++)
 	{
-		//Length of a bar.
-		int lengthLeft = 512;
-			
-		//Array used to store the melody notes for the chord chosen.
-		int melodyNotes[3];
-		//Array used to store the transition table for the chord chosen.
-		float chordTransitionTable[24];
-			
-		//Add the chosen chord and set the melody notes.
-		switch(chordNumber)
+		map<string, int>::iterator found = styleNumbers.find(jobs[i].styleName);
+		if(found == styleNumbers.end())
 		{
-			//If the chord chosen was C...
-			case CHORD_C:
-				//Add the C chord to the midi file.
-				withchordaccompaniment.addChord(0, lengthLeft, 4, MIDIFILE_NOTE_C);
-				//Copy the C chords melody notes to the melodyNotes array.
-				memcpy(melodyNotes, cMelodyNotes, sizeof(melodyNotes));
-				//Copy the C chord transition table to the transitionTable array.
-				memcpy(chordTransitionTable, transitionTable[MIDIFILE_NOTE_C*2], sizeof(transitionTable[MIDIFILE_NOTE_C*2]));
-				break;
-				
-				case CHORD_Dm:
-				//Add the Dm chord to the midi file.
-				withchordaccompaniment.addChord(0, lengthLeft, 4, MIDIFILE_NOTE_D, true);
-				//Copy the Dm chords melody notes to the melodyNotes array.
-				memcpy(melodyNotes, dMinorMelodyNotes, sizeof(melodyNotes));
-				//Copy the Dm chord transition table to the transitionTable array.
-				memcpy(chordTransitionTable, transitionTable[MIDIFILE_NOTE_D*2+1], sizeof(transitionTable[MIDIFILE_NOTE_C*2+1]));
-				break;
-				
-			case CHORD_F:
-				//Add the F chord to the midi file.
-				withchordaccompaniment.addChord(0, lengthLeft, 4, MIDIFILE_NOTE_F);
-				//Copy the F chords melody notes to the melodyNotes array.
-				memcpy(melodyNotes, fMelodyNotes, sizeof(melodyNotes));
-				//Copy the F chord transition table to the transitionTable array.
-				memcpy(chordTransitionTable, transitionTable[MIDIFILE_NOTE_F*2], sizeof(transitionTable[MIDIFILE_NOTE_F*2]));
-				break;
-				
-			case CHORD_G:
-				//Add the G chord to the midi file.
-				withchordaccompaniment.addChord(0, lengthLeft, 4, MIDIFILE_NOTE_G);
-				//Copy the G chords melody notes to the melodyNotes array.
-				memcpy(melodyNotes, gMelodyNotes, sizeof(melodyNotes));
-				//Copy the G chord transition table to the transitionTable array.
-				memcpy(chordTransitionTable, transitionTable[MIDIFILE_NOTE_G*2], sizeof(transitionTable[MIDIFILE_NOTE_G*2]));
-				break;
-				
-			case CHORD_Am:
-				//Add the Am chord to the midi file.
-				withchordaccompaniment.addChord(0, lengthLeft, 4, MIDIFILE_NOTE_A, true);
-				//Copy the Am chords melody notes to the melodyNotes array.
-				memcpy(melodyNotes, aMinorMelodyNotes, sizeof(melodyNotes));
-				//Copy the Am chord transition table to the transitionTable array.
-				memcpy(chordTransitionTable, transitionTable[MIDIFILE_NOTE_A*2+1], sizeof(transitionTable[MIDIFILE_NOTE_A*2+1]));
-				break;
+			int number = library.find(jobs[i].styleName.c_str());
+			if(number < 0)
+			{
+				std::cout << "ERROR: Job " << i + 1 << " uses the unknown style " << jobs[i].styleName << "." << std::endl;
+				return false;
 			}
-			
-		//Vector for the note durations to be stored in.
-			std::vector<int> noteDurationsChosen;
-			
-		//Add notes until the bar is full.
-	   	while(lengthLeft > 0)
+			libraryStyles.push_back(Style());
+			if(!library.getStyle(number, libraryStyles.back()))
+				return false;
+			found = styleNumbers.insert(make_pair(jobs[i].styleName, (int)styles.size())).first;
+			styles.push_back(&libraryStyles.back());
+			styleNames.push_back(jobs[i].styleName);
+		}
+		jobs[i].style = found->second;
+	}
+	
+	if(pack)
+		pack->setStyleNames(styleNames);
+	return runManifest(jobs, styles, noOfThreads, compact, rng, cache, queueBytes, output, outputDepth, pack);
+}
+
+/* Write a style library holding every style of an existing library, the built-in transition tables, named table1
+   to table3, and a style file, named after the file. Later styles replace earlier ones with the same name.
+   Returns false if the library could not be written. */
+bool writeLibrary(const char* libraryName, const StyleLibrary& library, const Style builtInStyles[BUILTIN_STYLES],
+	const char* styleFile, const Style& loadedStyle)
+{
+	vector<Style> libraryStyles(library.getNoOfStyles());
+	vector<string> names;
+	vector<const Style*> styles;
+	for(int i = 0; i < library.getNoOfStyles(); i++)
+	{
+		if(!library.getStyle(i, libraryStyles[i]))
+			return false;
+		names.push_back(library.getName(i));
+		styles.push_back(&libraryStyles[i]);
+	}
+	
+	vector<string> newNames;
+	vector<const Style*> newStyles;
+	for(int i = 0; i < BUILTIN_STYLES; i++)
+	{
+		newNames.push_back("table" + to_string(i + 1));
+		newStyles.push_back(&builtInStyles[i]);
+	}
+	if(styleFile)
+	{
+		newNames.push_back(styleFileName(styleFile));
+		newStyles.push_back(&loadedStyle);
+	}
+	
+	for(int i = 0; i < newNames.size(); i++)
+	{
+		int existing = find(names.begin(), names.end(), newNames[i]) - names.begin();
+		if(existing == names.size())
 		{
-			//Store the length of the current note.
-	  		int currentNoteLength;
-			
-			//Repeat...
-			do
-			{
-  				//Get a random note length from the array.
-				currentNoteLength = noteDurations[mtrand.randInt(2)];
-	  		}
-			//...while the note length chosen is longer than length left in the bar.
-			while(currentNoteLength > lengthLeft);
-		
-			//Push the note duration chosen onto the noteDurationsChosen vector.
-			noteDurationsChosen.push_back(currentNoteLength);
-		
-			//Subtract the length of the current note from the current time left in the bar.
-			lengthLeft -= currentNoteLength;
+			names.push_back(newNames[i]);
+			styles.push_back(newStyles[i]);
 		}
-			
-		//Add the melody notes to the midi file based on the chord that has been chosen.
-		for(int i = 0; i < noteDurationsChosen.size(); i++)
+		else
+			styles[existing] = newStyles[i];
+	}
+	if(!StyleLibrary::write(libraryName, names, styles))
+		return false;
+	std::cout << "Wrote " << names.size() << " styles to " << libraryName << "." << std::endl;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	//Options which can be set from the command line.
+	int noOfPieces = 0;
+	int noOfThreads = 1;
+	int noOfBars = 8;
+	unsigned long baseSeed = 0;
+	GeneratorRng rng = GENERATOR_RNG_MT19937;
+	int tableNumber = 1;
+	const char* midiPrefix = "piece";
+	const char* styleFile = NULL;
+	const char* libraryFile = NULL;
+	const char* libraryStyleName = NULL;
+	const char* newLibraryFile = NULL;
+	bool streaming = false;
+	bool compact = false;
+	const char* statsFile = NULL;
+	const char* serveSocket = NULL;
+	const char* requestSocket = NULL;
+	const char* cacheDirectory = NULL;
+	unsigned long cacheMegabytes = 0;
+	const char* manifestFile = NULL;
+	unsigned long queueMegabytes = 0;
+	FileWriterBackend output = FILEWRITER_SYNC;
+	int outputDepth = 0;
+	const char* packFile = NULL;
+	const char* extractFile = NULL;
+	
+	for(int i = 1; i < argc; i++)
+	{
+		//Every option takes a value.
+		if(i + 1 >= argc)
 		{
-			withchordaccompaniment.addNote(3, noteDurationsChosen[i], 6, melodyNotes[mtrand.randInt(3)]);
+			printUsage(argv[0]);
+			return 1;
 		}
 		
-		//Choose the next chord.
-		chordNumber = chooseNextChord(chordTransitionTable);
+		if(strcmp(argv[i], "--batch") == 0)
+			noOfPieces = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--threads") == 0)
+			noOfThreads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--bars") == 0)
+			noOfBars = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--seed") == 0)
+			baseSeed = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--rng") == 0)
+		{
+			if(!parseGeneratorRng(argv[++i], rng))
+			{
+				std::cout << "ERROR: Unknown random number sequence " << argv[i] << "." << std::endl;
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "--table") == 0)
+			tableNumber = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--style") == 0)
+			styleFile = argv[++i];
+		else if(strcmp(argv[i], "--library") == 0)
+			libraryFile = argv[++i];
+		else if(strcmp(argv[i], "--name") == 0)
+			libraryStyleName = argv[++i];
+		else if(strcmp(argv[i], "--write-library") == 0)
+			newLibraryFile = argv[++i];
+		else if(strcmp(argv[i], "--prefix") == 0)
+			midiPrefix = argv[++i];
+		else if(strcmp(argv[i], "--stream") == 0)
+			streaming = atoi(argv[++i]) != 0;
+		else if(strcmp(argv[i], "--compact") == 0)
+			compact = atoi(argv[++i]) != 0;
+		else if(strcmp(argv[i], "--stats") == 0)
+			statsFile = argv[++i];
+		else if(strcmp(argv[i], "--serve") == 0)
+			serveSocket = argv[++i];
+		else if(strcmp(argv[i], "--request") == 0)
+			requestSocket = argv[++i];
+		else if(strcmp(argv[i], "--cache") == 0)
+			cacheDirectory = argv[++i];
+		else if(strcmp(argv[i], "--cache-size") == 0)
+			cacheMegabytes = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--manifest") == 0)
+			manifestFile = argv[++i];
+		else if(strcmp(argv[i], "--queue-size") == 0)
+			queueMegabytes = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--output") == 0)
+		{
+			if(!parseFileWriterBackend(argv[++i], output))
+			{
+				std::cout << "ERROR: Unknown output backend " << argv[i] << "." << std::endl;
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "--output-depth") == 0)
+			outputDepth = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--pack") == 0)
+			packFile = argv[++i];
+		else if(strcmp(argv[i], "--extract") == 0)
+			extractFile = argv[++i];
+		else if(strcmp(argv[i], "--check") == 0)
+			return checkMidi(argv[++i]) ? 0 : 1;
+		else
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
 	}
 	
-	//Write the midi object to file.
-	withchordaccompaniment.writeToFile(midiName);
-}
+	//Ask a server for the piece instead of generating it here.
+	if(requestSocket)
+	{
+		string midiName = string(midiPrefix) + ".mid";
+		return requestPiece(requestSocket, midiName.c_str(), tableNumber, noOfBars, baseSeed, compact, rng) ? 0 : 1;
+	}
+	
+	//Write the pieces of a pack out as files.
+	if(extractFile)
+		return extractPack(extractFile, midiPrefix, output, outputDepth) ? 0 : 1;
+	
+	if(packFile && (streaming || (noOfPieces == 0 && !manifestFile)))
+	{
+		std::cout << "ERROR: --pack is only used by --batch, without --stream, and --manifest." << std::endl;
+		return 1;
+	}
+	
+	if(rng == GENERATOR_RNG_PHILOX && noOfPieces == 0 && !serveSocket && !manifestFile)
+	{
+		std::cout << "ERROR: --rng philox is only used by --batch." << std::endl;
+		return 1;
+	}
+	
+	if(tableNumber < 1 || tableNumber > BUILTIN_STYLES)
+	{
+		std::cout << "ERROR: Invalid transition table number." << std::endl;
+		return 1;
+	}
 
-int main()
-{
-	/* First chord transition table array.
-	   Table is implemented with even numbers as major chords and odd numbers as minor chords.
-	   E.g. MIDIFILE_NOTE_F (which is 5) * 2 = 10, so it is F major.
-	        MIDIFILE_NOTE_A (9) * 2 + 1 = 19, so it is A minor.
-       This transition table has all notes at the same probability. 
-       There is the same chance of any allowed note occuring.*/
-	float transitionTable1[24][24];
+	//Build the styles for the built-in transition tables.
+	Style styles[BUILTIN_STYLES];
+	if(!buildBuiltInStyles(styles))
+		return 1;
 	
-	/* Second chord transition table array
-	   This transition table favours the transition "Dm -> G -> Am -> F"
-	   If any of these notes are chosen, it will always follow the path.
-	   The only notes that do not have one chord they will always move onto are F and C.*/
-	float transitionTable2[24][24];
+	//A style file replaces the chosen transition table.
+	Style loadedStyle;
+	const Style* chosenStyle = &styles[tableNumber - 1];
+	if(styleFile)
+	{
+		if(!loadedStyle.load(styleFile) || !loadedStyle.compile())
+			return 1;
+		chosenStyle = &loadedStyle;
+	}
 	
-	/* Third chord transition table array
-	   This transiton table favours the two minor chords, Dm and Am.
-	   Whenever a chord can move on to a minor chord, there is about twice the chance of it happening. */
-	float transitionTable3[24][24];
+	//A style library is mapped rather than read, so it costs the same to open however many styles it holds.
+	StyleLibrary library;
+	Style libraryStyle;
+	if(libraryFile && !library.open(libraryFile))
+		return 1;
+	if(newLibraryFile)
+		return writeLibrary(newLibraryFile, library, styles, styleFile, loadedStyle) ? 0 : 1;
+	if(libraryStyleName)
+	{
+		int number = library.find(libraryStyleName);
+		if(number < 0)
+		{
+			std::cout << "ERROR: There is no style named " << libraryStyleName << (libraryFile ? " in the library." : " without --library.") << std::endl;
+			return 1;
+		}
+		if(!library.getStyle(number, libraryStyle))
+			return 1;
+		chosenStyle = &libraryStyle;
+	}
+	
+	//A cache of generated pieces, shared with any other process using the same directory.
+	PieceCache* cache = NULL;
+	if(cacheDirectory)
+	{
+		cache = new PieceCache(cacheDirectory, 0, cacheMegabytes << 20);
+		if(!cache->isUsable())
+			return 1;
+	}
 	
-	//Initialise all elements of the transition tables to 0.
-	for(int i = 0; i < 24; i++)
+	//Serve requests for pieces, with the loaded style, if there is one, then the library's, after the built-in ones.
+	if(serveSocket)
 	{
-		for(int j = 0;j < 24; j++)
+		vector<Style> servedStyles(styles, styles + BUILTIN_STYLES);
+		if(styleFile)
+			servedStyles.push_back(loadedStyle);
+		for(int i = 0; i < library.getNoOfStyles(); i++)
 		{
-			transitionTable1[i][j] = 0;
-			transitionTable2[i][j] = 0;
-			transitionTable3[i][j] = 0;
+			servedStyles.push_back(Style());
+			if(!library.getStyle(i, servedStyles.back()))
+				return 1;
+			std::cout << "Table " << servedStyles.size() << " is " << library.getName(i) << "." << std::endl;
 		}
+		return runServer(serveSocket, &servedStyles[0], servedStyles.size(), noOfThreads, cache) ? 0 : 1;
 	}
 	
-	//Transition table 1 definition.
+	//A pack the pieces are appended to instead of being written to files of their own.
+	PackWriter pack;
+	if(packFile)
+	{
+		if(!pack.create(packFile, rng, compact))
+			return 1;
+		if(!manifestFile)
+			pack.setStyleNames(vector<string>(1, libraryStyleName ? string(libraryStyleName)
+				: styleFile ? styleFileName(styleFile) : "table" + to_string(tableNumber)));
+	}
 	
-	//Transition table values for C major.
-	transitionTable1[CHORD_C] [CHORD_Dm] = 0.25;
-	transitionTable1[CHORD_C] [CHORD_F]  = 0.25;
-	transitionTable1[CHORD_C] [CHORD_G]  = 0.25;
-	transitionTable1[CHORD_C] [CHORD_Am] = 0.25;
-	//Values for D minor.
-	transitionTable1[CHORD_Dm][CHORD_G]  = 0.5;
-	transitionTable1[CHORD_Dm][CHORD_Am] = 0.5;
-	//Values for F major.
-	transitionTable1[CHORD_F] [CHORD_F]  = 1.0/3;
-	transitionTable1[CHORD_F] [CHORD_Dm] = 1.0/3;
-	transitionTable1[CHORD_F] [CHORD_C]  = 1.0/3;
-	//Values for G major.
-	transitionTable1[CHORD_G] [CHORD_C]  = 0.5;
-	transitionTable1[CHORD_G] [CHORD_Am] = 0.5;
-	//Values for A minor.
-	transitionTable1[CHORD_Am][CHORD_Dm] = 0.5;
-	transitionTable1[CHORD_Am][CHORD_F]  = 0.5;
+	//Start counting once the setup is done, so only generation is measured.
+	if(statsFile)
+		statsEnable();
 	
-	//Run the generateMidi function with the first transition table.
-	generateMidi("transitiontable1.mid", 8, transitionTable1);
+	//Run the jobs of a manifest.
+	if(manifestFile)
+	{
+		bool ok = runManifestFile(manifestFile, library, styles, styleFile, loadedStyle, noOfThreads, compact, rng,
+			cache, queueMegabytes << 20, output, outputDepth, packFile ? &pack : NULL);
+		ok = pack.finish() && ok;
+		return ok && (!statsFile || writeStats(statsFile, noOfThreads + 1)) ? 0 : 1;
+	}
 	
-	//Transition table 2 definition.
+	//Generate a batch of MIDI files from the chosen style.
+	if(noOfPieces > 0)
+	{
+		generateBatch(midiPrefix, noOfPieces, noOfThreads, noOfBars, *chosenStyle, baseSeed, streaming, compact, rng, cache,
+			output, outputDepth, packFile ? &pack : NULL);
+		if(!pack.finish())
+			return 1;
+		return statsFile && !writeStats(statsFile, noOfThreads) ? 1 : 0;
+	}
 	
-	//Transition table values for C major.
-	transitionTable2[CHORD_C] [CHORD_Dm] = 0.25;
-	transitionTable2[CHORD_C] [CHORD_F]  = 0.25;
-	transitionTable2[CHORD_C] [CHORD_G]  = 0.25;
-	transitionTable2[CHORD_C] [CHORD_Am] = 0.25;
-	//Values for D minor.
-	transitionTable2[CHORD_Dm][CHORD_G]  = 1.0;
-	transitionTable2[CHORD_Dm][CHORD_Am] = 0.0;
-	//Values for F major.
-	transitionTable2[CHORD_F] [CHORD_F]  = 0.1;
-	transitionTable2[CHORD_F] [CHORD_Dm] = 0.4;
-	transitionTable2[CHORD_F] [CHORD_C]  = 0.5;
-	//Values for G major.
-	transitionTable2[CHORD_G] [CHORD_C]  = 0.0;
-	transitionTable2[CHORD_G] [CHORD_Am] = 1.0;
-	//Values for A minor.
-	transitionTable2[CHORD_Am][CHORD_Dm] = 0.0;
-	transitionTable2[CHORD_Am][CHORD_F]  = 1.0;
+	//Random number generator object, seeded from /dev/urandom.
+	MTRandSIMD mtrand(rng == GENERATOR_RNG_SFMT ? MTRANDSIMD_SFMT : MTRANDSIMD_MT19937);
 	
-	//Generate a MIDI file based on transitionTable2.
-	generateMidi("transitiontable2.mid", 8, transitionTable2);
+	//Generate a single MIDI file from a style file or a library style.
+	if(styleFile || libraryStyleName)
+	{
+		string midiName = string(midiPrefix) + ".mid";
+		generateMidi(midiName.c_str(), noOfBars, *chosenStyle, mtrand, streaming, compact);
+		return statsFile && !writeStats(statsFile, 1) ? 1 : 0;
+	}
 	
-	//Transition table 3 definition.
+	//Run the generateMidi function with the first transition table.
+	generateMidi("transitiontable1.mid", noOfBars, styles[0], mtrand, streaming, compact);
 	
-	//Transition table values for C major.
-	transitionTable3[CHORD_C] [CHORD_Dm] = 0.4;
-	transitionTable3[CHORD_C] [CHORD_F]  = 0.1;
-	transitionTable3[CHORD_C] [CHORD_G]  = 0.1;
-	transitionTable3[CHORD_C] [CHORD_Am] = 0.4;
-	//Values for D minor.
-	transitionTable3[CHORD_Dm][CHORD_G]  = 0.3;
-	transitionTable3[CHORD_Dm][CHORD_Am] = 0.7;
-	//Values for F major.
-	transitionTable3[CHORD_F] [CHORD_F]  = 0.1;
-	transitionTable3[CHORD_F] [CHORD_Dm] = 0.6;
-	transitionTable3[CHORD_F] [CHORD_C]  = 0.3;
-	//Values for G major.
-	transitionTable3[CHORD_G] [CHORD_C]  = 0.3;
-	transitionTable3[CHORD_G] [CHORD_Am] = 0.7;
-	//Values for A minor.
-	transitionTable3[CHORD_Am][CHORD_Dm] = 0.7;
-	transitionTable3[CHORD_Am][CHORD_F]  = 0.3;
+	//Generate a MIDI file based on transitionTable2.
+	generateMidi("transitiontable2.mid", noOfBars, styles[1], mtrand, streaming, compact);
 	
 	//Generate a MIDI file based on transitionTable3.
-	generateMidi("transitiontable3.mid", 8, transitionTable3);
+	generateMidi("transitiontable3.mid", noOfBars, styles[2], mtrand, streaming, compact);
 	
+	return statsFile && !writeStats(statsFile, 1) ? 1 : 0;
 }
 
 
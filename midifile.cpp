@@ -1,79 +1,47 @@
 #include "midifile.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 using namespace std;
 
-//File writing functions
-//This function is used to write an unsigned short to a file.
-void writeShortToFile(ostream& os, unsigned short value)
+//Buffer writing functions
+//This function is used to write an unsigned short to a buffer, most significant byte first.
+static inline unsigned char* writeShort(unsigned char* buffer, unsigned short value)
 {
-	const char* ptr = (const char*)(&value); //Make a cast to a const char* from the unsigned short input.
-	//Write ptr to the file.
-	os.write(ptr+1, 1);
-	os.write(ptr, 1);
+	buffer[0] = value >> 8;
+	buffer[1] = value;
+	return buffer + 2;
 }
 
-//Writes an unsigned long to a file.
-void writeLongToFile(ostream& os, unsigned long value)
+//Writes an unsigned long to a buffer as 4 bytes, most significant byte first.
+static inline unsigned char* writeLong(unsigned char* buffer, unsigned long value)
 {
-	const char* ptr = (const char*)(&value); //Make a cast to a const char*.
-	//Write the ptr to the file.
-	os.write(ptr+3, 1);
-	os.write(ptr+2, 1);
-	os.write(ptr+1, 1);
-	os.write(ptr, 1); //ptr+0
+	buffer[0] = value >> 24;
+	buffer[1] = value >> 16;
+	buffer[2] = value >> 8;
+	buffer[3] = value;
+	return buffer + 4;
 }
 
 //Write value which is encoded using a variable number of bytes.
-void writeVarLen(ostream& os, long value)
+//Each byte holds 7 bits of the value, most significant first, with the top bit set on every byte but the last.
+unsigned char* writeVarLen(unsigned char* buffer, unsigned long value)
 {
-	if (value < 0)
-		return; // not supported. Value can not be negative.
-	long buffer;
-	buffer = value & 0x7F; //Perform bitwise AND on the value inputted and the hexadecimal value 7F (1111111).
-	while ((value >>= 7) > 0)
-	{
-		buffer <<= 8;
-		buffer |= 0x80; //Perform bitwise OR on the buffer and the hexadecimal value 80 (10000000).
-				//Converts the buffer to its negative value and adds it to the buffer.
-		buffer += (value & 0x7F);
-	}
-	while (true)
-	{
-		char c = buffer & 0xFF;
-		os.put(c);
-		if (buffer & 0x80)
-			buffer >>= 8;
-		else
-			break;
-	}
+	if (value >= 0x200000)
+		*buffer++ = 0x80 | (value >> 21);
+	if (value >= 0x4000)
+		*buffer++ = 0x80 | ((value >> 14) & 0x7F);
+	if (value >= 0x80)
+		*buffer++ = 0x80 | ((value >> 7) & 0x7F);
+	*buffer++ = value & 0x7F;
+	return buffer;
 }
 
 //Returns the length of a variable length value.
-long varLenLen(long value)
-{
-	if (value < 0)
-		return 0; // not supported
-	long buffer;
-	long ret = 0;
-	buffer = value & 0x7F;
-	while ((value >>= 7) > 0)
-	{
-		buffer <<= 8;
-		buffer |= 0x80;
-		buffer += (value & 0x7F);
-	}
-	while (true)
-	{
-		char c = buffer & 0xFF;
-		ret++;
-		if (buffer & 0x80)
-			buffer >>= 8;
-		else
-			break;
-	}
-	return ret;
+int varLenLen(unsigned long value)
+{
+	return 1 + (value >= 0x80) + (value >= 0x4000) + (value >= 0x200000);
 }
 
 //Midi file header class functions
@@ -85,46 +53,222 @@ MidiFile::MidiFileHeader::MidiFileHeader(unsigned short fileformat, unsigned sho
 	midiFileDeltaTimeTicks = deltatimeticks;
 }
 
-void MidiFile::MidiFileHeader::writeToFile(ostream& os, unsigned short trackcount)
+unsigned char* MidiFile::MidiFileHeader::writeToBuffer(unsigned char* buffer, unsigned short trackcount)
 {
 	if (trackcount > 1 && midiFileFormat == MIDIFILE_SINGLETRACK)
 	{
 		midiFileFormat = MIDIFILE_MULTIPLETRACKS_SYNCH;
 	}
 
-	writeLongToFile(os, midiFileSignature);
-	writeLongToFile(os, midiFileHeaderLength);
-	writeShortToFile(os, midiFileFormat);
-	writeShortToFile(os, trackcount);
-	writeShortToFile(os, midiFileDeltaTimeTicks);
+	buffer = writeLong(buffer, midiFileSignature);
+	buffer = writeLong(buffer, midiFileHeaderLength);
+	buffer = writeShort(buffer, midiFileFormat);
+	buffer = writeShort(buffer, trackcount);
+	return writeShort(buffer, midiFileDeltaTimeTicks);
+}
+
+//Midi event arena functions
+MidiEventArena::~MidiEventArena()
+{
+	for(int i = 0; i < chunks.size(); i++)
+		delete[] chunks[i];
 }
 
 //Midi file functions
 MidiFile::MidiFile(unsigned short deltatimeticks, unsigned short fileformat)
-	: header(fileformat, deltatimeticks)
+	: header(fileformat, deltatimeticks), compact(false)
 {
-	tracks.push_back(new MidiTrack);
+	tracks.push_back(new MidiTrack(&arena));
+}
+
+MidiFile::~MidiFile()
+{
+	for(int i = 0; i < tracks.size(); i++)
+		delete tracks[i];
+	for(int i = 0; i < spareTracks.size(); i++)
+		delete spareTracks[i];
 }
 
 void MidiFile::writeToFile(const char* filename)
 {
-	ofstream os(filename);
+	ofstream os(filename, ios::out | ios::binary);
+	if(!os)
+	{
+		std::cout << "ERROR: Could not open " << filename << " for writing." << std::endl;
+		return;
+	}
 	writeToFile(os);
 }
 
 void MidiFile::writeToFile(ostream& os)
 {
-	header.writeToFile(os, tracks.size());
+	//Serialise the whole file first, so it can be written with a single call.
+	fileBuffer.clear();
+	writeToBuffer(fileBuffer);
+	os.write((const char*)&fileBuffer[0], fileBuffer.size());
+	statsCount(STATS_BYTES_WRITTEN, fileBuffer.size());
+}
+
+void MidiFile::writeToBuffer(vector<unsigned char>& buffer)
+{
+	size_t start = buffer.size();
+	
+	if(compact)
+	{
+		//Merge every track into one, then go back and fill in the track length.
+		buffer.resize(start + 22 + maxMergedLength());
+		MidiFileHeader singleTrackHeader(MIDIFILE_SINGLETRACK, header.getDeltaTimeTicks());
+		unsigned char* trackHeader = singleTrackHeader.writeToBuffer(&buffer[start], 1);
+		
+		MergeState state(true);
+		unsigned char* end = writeMergedEvents(trackHeader + 8, state);
+		writeLong(writeLong(trackHeader, 0x4D54726B), end - trackHeader - 8);
+		buffer.resize(end - &buffer[0]);
+		return;
+	}
+	
+	buffer.resize(start + 14);
+	header.writeToBuffer(&buffer[start], tracks.size());
 	
 	for (int i=0; i < tracks.size(); i++)
 	{
-		tracks[i]->writeToFile(os);
+		tracks[i]->writeToBuffer(buffer);
 	}
 }
 
 void MidiFile::addTrack()
 {
-	tracks.push_back(new MidiTrack);
+	//Reuse a track removed by reset() if there is one.
+	if(!spareTracks.empty())
+	{
+		tracks.push_back(spareTracks.back());
+		spareTracks.pop_back();
+	}
+	else
+		tracks.push_back(new MidiTrack(&arena));
+}
+
+size_t MidiFile::getNoOfEvents(int track) const
+{
+	return tracks[track]->noOfEvents;
+}
+
+void MidiFile::clearEvents()
+{
+	for(int i = 0; i < tracks.size(); i++)
+		tracks[i]->clear();
+	arena.reset();
+}
+
+void MidiFile::appendEvents(const MidiFile& source)
+{
+	for(int t = 0; t < tracks.size() && t < source.tracks.size(); t++)
+	{
+		const MidiTrack& from = *source.tracks[t];
+		for(size_t i = 0; i < from.noOfEvents; i++)
+			tracks[t]->pushEvent(from.getEvent(i));
+	}
+}
+
+void MidiFile::reset()
+{
+	clearEvents();
+	while(tracks.size() > 1)
+	{
+		spareTracks.push_back(tracks.back());
+		tracks.pop_back();
+	}
+	compact = false;
+}
+
+size_t MidiFile::maxMergedLength() const
+{
+	size_t noOfEvents = 0;
+	for(int i = 0; i < tracks.size(); i++)
+		noOfEvents += tracks[i]->noOfEvents;
+	return noOfEvents * (MIDIFILE_MAX_VARLEN_LENGTH + 3);
+}
+
+unsigned char* MidiFile::writeMergedEvents(unsigned char* buffer, MergeState& state) const
+{
+	int noOfTracks = tracks.size();
+	
+	//Tracks added since the last merge start at time 0.
+	state.trackTimes.resize(noOfTracks, 0);
+	state.nextTimes.resize(noOfTracks);
+	state.nextEvents.resize(noOfTracks);
+	
+	for(int t = 0; t < noOfTracks; t++)
+	{
+		state.nextEvents[t] = 0;
+		if(tracks[t]->noOfEvents > 0)
+			state.nextTimes[t] = state.trackTimes[t] + tracks[t]->getEvent(0).deltaTime;
+	}
+	
+	while(true)
+	{
+		/* Find the track with the earliest event left. At the same time note offs go before anything else, so a
+		   note ending on one track can not cut off the same note starting on another. Otherwise the lowest track goes first. */
+		int track = -1;
+		bool trackNoteOff = false;
+		for(int t = 0; t < noOfTracks; t++)
+		{
+			if(state.nextEvents[t] >= tracks[t]->noOfEvents)
+				continue;
+			const MidiEvent& next = tracks[t]->getEvent(state.nextEvents[t]);
+			bool noteOff = (next.status & 0xF0) == 0x80 || ((next.status & 0xF0) == 0x90 && next.data2 == 0);
+			if(track < 0 || state.nextTimes[t] < state.nextTimes[track]
+				|| (state.nextTimes[t] == state.nextTimes[track] && noteOff && !trackNoteOff))
+			{
+				track = t;
+				trackNoteOff = noteOff;
+			}
+		}
+		if(track < 0)
+			break;
+		
+		const MidiTrack& merged = *tracks[track];
+		const MidiEvent& event = merged.getEvent(state.nextEvents[track]);
+		unsigned long time = state.nextTimes[track];
+		
+		//An event earlier than one already written (tracks that did not cover the same time) is written straight after it.
+		buffer = writeVarLen(buffer, time > state.lastTime ? time - state.lastTime : 0);
+		if(state.compact)
+		{
+			//A note on with a velocity of 0 is a note off with a velocity of 64, and shares its status with the note ons.
+			unsigned char status = event.status;
+			unsigned char data2 = event.data2;
+			if((status & 0xF0) == 0x80 && data2 == 64)
+			{
+				status = 0x90 | (status & 0x0F);
+				data2 = 0;
+			}
+			
+			//The status byte is left out when it is the same as the last event's.
+			if(status != state.runningStatus)
+				*buffer++ = status;
+			state.runningStatus = status;
+			buffer[0] = event.data1;
+			buffer[1] = data2;
+			buffer += 2;
+		}
+		else
+		{
+			buffer[0] = event.status;
+			buffer[1] = event.data1;
+			buffer[2] = event.data2;
+			buffer += 3;
+		}
+		if(time > state.lastTime)
+			state.lastTime = time;
+		
+		//Move on to the track's next event.
+		state.trackTimes[track] = time;
+		if(++state.nextEvents[track] < merged.noOfEvents)
+			state.nextTimes[track] = time + merged.getEvent(state.nextEvents[track]).deltaTime;
+	}
+	
+	return buffer;
 }
 
 void MidiFile::addNote(int track, long deltaTime, unsigned char octave, unsigned char noteNumber, unsigned char velocity, 
@@ -155,201 +299,63 @@ void MidiFile::addNoteOff(int track, long deltaTime, unsigned char octave, unsig
 void MidiFile::addChord(int firsttrack, long deltatime, unsigned char octave, const int chordNote, bool minor, unsigned char velocity, 
      unsigned char vel_off, unsigned char channel)
 {
-     if(firsttrack + 2 >= tracks.size())
-     {
-                   std::cout << "ERROR: not enough tracks available to add chord." << std::endl;
-                   return;
-     }
-     
-     switch (chordNote)
-     {
-            case MIDIFILE_NOTE_C:
-                 if(minor)
-                 {
-                     addNote(firsttrack, deltatime, octave, MIDIFILE_NOTE_C, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_D_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_G, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_C, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_E, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_G, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_C_:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_C_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_E, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_G_, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_C, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_F, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_G_, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_D:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_D, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_F, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_A, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_D, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_F_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_A, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_D_:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_D_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_F_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_A_, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_D_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_G, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_A_, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_E:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_E, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_G, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_B, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave, MIDIFILE_NOTE_E,  velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave, MIDIFILE_NOTE_G_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave, MIDIFILE_NOTE_B,  velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_F:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_F,  velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave    , MIDIFILE_NOTE_G_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_C,  velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_F, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave    , MIDIFILE_NOTE_A, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_C, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_F_:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_F_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave    , MIDIFILE_NOTE_A,  velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_C_, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_F_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave    , MIDIFILE_NOTE_A_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_C_, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_G:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_G, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave    , MIDIFILE_NOTE_A_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_D, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_G, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave    , MIDIFILE_NOTE_B, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_D, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_G_:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_G_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_B, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_D_, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_G_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_C, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_D_, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_A:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_A, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_C, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_E, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_A, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_C_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_E, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_A_:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_A_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_C_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_F, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_A_, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_D, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_F, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            case MIDIFILE_NOTE_B:
-                 if(minor)
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_B, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_D, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_F_, velocity, vel_off, channel);
-                 }
-                 else
-                 {
-                     addNote(firsttrack    , deltatime, octave    , MIDIFILE_NOTE_B, velocity, vel_off, channel);
-                     addNote(firsttrack + 1, deltatime, octave + 1, MIDIFILE_NOTE_D_, velocity, vel_off, channel);
-                     addNote(firsttrack + 2, deltatime, octave + 1, MIDIFILE_NOTE_F_, velocity, vel_off, channel);
-                 }
-                 break;
-                 
-            default:
-                    std::cout << "ERROR: Invalid chord name." << std::endl;
-     }
+	addChord(firsttrack, 3, deltatime, octave, chordNote, MIDIFILE_CHORD_SHAPES[minor ? MIDIFILE_CHORD_MINOR : MIDIFILE_CHORD_MAJOR], 0,
+		velocity, vel_off, channel);
+}
+
+void MidiFile::addChord(int firsttrack, int noOfTracks, long deltatime, unsigned char octave, int root, const MidiChordShape& shape,
+	int inversion, unsigned char velocity, unsigned char vel_off, unsigned char channel)
+{
+	if(root < MIDIFILE_NOTE_C || root > MIDIFILE_NOTE_B)
+	{
+		std::cout << "ERROR: Invalid chord name." << std::endl;
+		return;
+	}
+	if(shape.noOfNotes < 1 || shape.noOfNotes > MIDIFILE_MAX_CHORD_NOTES)
+	{
+		std::cout << "ERROR: Invalid chord shape." << std::endl;
+		return;
+	}
+	if(inversion < 0 || inversion >= shape.noOfNotes)
+	{
+		std::cout << "ERROR: Invalid chord inversion." << std::endl;
+		return;
+	}
+	if(firsttrack < 0 || noOfTracks < 1 || firsttrack + noOfTracks > tracks.size())
+	{
+		std::cout << "ERROR: not enough tracks available to add chord." << std::endl;
+		return;
+	}
+	
+	//Build the notes from the bass up. An inverted chord starts part way through the shape and the notes it skipped go an octave up.
+	unsigned char notes[MIDIFILE_MAX_CHORD_NOTES];
+	int highest = 0;
+	for(int i = 0; i < shape.noOfNotes; i++)
+	{
+		int index = i + inversion;
+		notes[i] = root + (index < shape.noOfNotes ? shape.intervals[index] : shape.intervals[index - shape.noOfNotes] + 12);
+		if(notes[i] > highest)
+			highest = notes[i];
+	}
+	if(12 * octave + highest > 127)
+	{
+		std::cout << "ERROR: Chord is too high." << std::endl;
+		return;
+	}
+	
+	//Deal the notes out over the tracks, then add each track's notes in one go.
+	for(int track = 0; track < noOfTracks && track < shape.noOfNotes; track++)
+	{
+		unsigned char trackNotes[MIDIFILE_MAX_CHORD_NOTES];
+		int noOfTrackNotes = 0;
+		for(int i = track; i < shape.noOfNotes; i += noOfTracks)
+			trackNotes[noOfTrackNotes++] = notes[i];
+		tracks[firsttrack + track]->notes(channel, deltatime, octave, trackNotes, noOfTrackNotes, velocity, vel_off);
+	}
 }
 
 //Midi track functions
-MidiFile::MidiTrack::MidiTrack()
+MidiFile::MidiTrack::MidiTrack(MidiEventArena* arena) : arena(arena), noOfEvents(0)
 {
 }
 
@@ -360,87 +366,139 @@ MidiFile::MidiTrack::MidiTrackHeader::MidiTrackHeader(unsigned long tracklength/
 	midiTrackLength = tracklength;
 }
 
-void MidiFile::MidiTrack::MidiTrackHeader::writeToFile(ostream& os, int length)
+unsigned char* MidiFile::MidiTrack::MidiTrackHeader::writeToBuffer(unsigned char* buffer, unsigned long length)
 {
 	midiTrackLength = length;
 
-	writeLongToFile(os, midiTrackSignature);
-	writeLongToFile(os, midiTrackLength);
+	buffer = writeLong(buffer, midiTrackSignature);
+	return writeLong(buffer, midiTrackLength);
 }
 
-void MidiFile::MidiTrack::writeToFile(ostream& os)
+void MidiFile::MidiTrack::writeToBuffer(vector<unsigned char>& buffer)
 {
-	int midiTrackLength = 0;
-	for(int i = 0; i < commands.size(); i++)
-	{
-		midiTrackLength += commands[i]->getLength();
-		midiTrackLength += varLenLen(commands[i]->deltaTime);
-	}
-	header.writeToFile(os, midiTrackLength);
+	//Work out how long the events are once encoded, then write them a block at a time.
+	size_t length = 0;
+	for(int i = 0; i < blocks.size(); i++)
+		length += varLenEventsLength(blocks[i], blockLength(i));
+	size_t start = buffer.size();
+	buffer.resize(start + 8 + length + VLQ_WRITE_PADDING);
+	unsigned char* trackStart = &buffer[start];
+	
+	unsigned char* out = trackStart + 8;
+	for(int i = 0; i < blocks.size(); i++)
+		out = writeVarLenEvents(out, blocks[i], blockLength(i));
 	
-	for (int i = 0; i < commands.size(); i++)
+	header.writeToBuffer(trackStart, length);
+	buffer.resize(start + 8 + length);
+}
+
+void MidiFile::MidiTrack::addEvent(long deltatime, unsigned char status, unsigned char data1, unsigned char data2)
+{
+	//Variable length values in a MIDI file can hold at most 28 bits.
+	if(deltatime < 0 || deltatime > 0x0FFFFFFF)
 	{
-		commands[i]->writeToFile(os);
+		std::cout << "ERROR: Delta time out of range." << std::endl;
+		return;
 	}
+	
+	MidiEvent event = { (unsigned int)deltatime, status, data1, data2 };
+	pushEvent(event);
 }
 
 void MidiFile::MidiTrack::noteOn(unsigned char channel, long deltatime, unsigned char octave, unsigned char notenumber, unsigned char velocity)
 {
-	commands.push_back(new MidiCommandNoteOn (channel, deltatime, octave, notenumber, velocity));
+	addEvent(deltatime, 0x90 | channel, 12*octave+notenumber, velocity);
 }
 
 void MidiFile::MidiTrack::noteOff(unsigned char channel, long deltatime, unsigned char octave, unsigned char notenumber, unsigned char velocity)
 {
-	commands.push_back(new MidiCommandNoteOff(channel, deltatime, octave, notenumber, velocity));
+	addEvent(deltatime, 0x80 | channel, 12*octave+notenumber, velocity);
 }
 
 void MidiFile::MidiTrack::note(unsigned char channel, long deltatime, unsigned char octave, unsigned char notenumber, unsigned char velocity, unsigned char vel_off)
 {
-	commands.push_back(new MidiCommandNoteOn(channel, 0, octave, notenumber, velocity));
-	commands.push_back(new MidiCommandNoteOff(channel, deltatime, octave, notenumber, vel_off));
+	addEvent(0, 0x90 | channel, 12*octave+notenumber, velocity);
+	addEvent(deltatime, 0x80 | channel, 12*octave+notenumber, vel_off);
 }
 
-//MidiCommand functions
-MidiFile::MidiTrack::MidiCommand::MidiCommand(unsigned char channel, long deltatime) : channel(channel), deltaTime(deltatime)
+void MidiFile::MidiTrack::notes(unsigned char channel, long deltatime, unsigned char octave, const unsigned char* notenumbers,
+	int noofnotes, unsigned char velocity, unsigned char vel_off)
 {
+	if(deltatime < 0 || deltatime > 0x0FFFFFFF)
+	{
+		std::cout << "ERROR: Delta time out of range." << std::endl;
+		return;
+	}
+	
+	//Every note starts straight away. The first note off comes after the delta time and the rest follow it at once.
+	for(int i = 0; i < noofnotes; i++)
+	{
+		MidiEvent on = { 0, (unsigned char)(0x90 | channel), (unsigned char)(12*octave+notenumbers[i]), velocity };
+		pushEvent(on);
+	}
+	for(int i = 0; i < noofnotes; i++)
+	{
+		MidiEvent off = { i == 0 ? (unsigned int)deltatime : 0, (unsigned char)(0x80 | channel), (unsigned char)(12*octave+notenumbers[i]), vel_off };
+		pushEvent(off);
+	}
 }
 
-void MidiFile::MidiTrack::MidiCommand::writeToFile(ostream& os)
+//Midi stream writer functions
+MidiStreamWriter::MidiStreamWriter() : trackLength(0)
 {
-	if (deltaTime >= 0)
-		writeVarLen(os, deltaTime);
 }
 
-MidiFile::MidiTrack::MidiCommandNoteOn::MidiCommandNoteOn(unsigned char channel, long deltatime, unsigned char octave, unsigned char notenumber, unsigned char velocity) 
-	: MidiCommand(channel, deltatime), octave(octave), noteNumber(notenumber), velocity(velocity)
+MidiStreamWriter::~MidiStreamWriter()
 {
+	if(os.is_open())
+		close();
 }
 
-void MidiFile::MidiTrack::MidiCommandNoteOn::writeToFile(ostream& os)
+bool MidiStreamWriter::open(const char* filename, unsigned short deltatimeticks, bool compact)
 {
-	MidiFile::MidiTrack::MidiCommand::writeToFile(os);
-	unsigned char w = 0x90;
-	w |= channel;
-	os.put(w);
-	w = 12*octave+noteNumber;
-	os.put(w);
-	w = velocity;
-	os.put(w);
+	os.open(filename, ios::out | ios::binary);
+	if(!os)
+	{
+		std::cout << "ERROR: Could not open " << filename << " for writing." << std::endl;
+		return false;
+	}
+	
+	state = MidiFile::MergeState(compact);
+	trackLength = 0;
+	
+	//Write the file header for a single track file, followed by a track header with a length of 0 for now.
+	unsigned char headers[22];
+	MidiFile::MidiFileHeader fileHeader(MIDIFILE_SINGLETRACK, deltatimeticks);
+	unsigned char* trackHeader = fileHeader.writeToBuffer(headers, 1);
+	trackHeader = writeLong(trackHeader, 0x4D54726B);
+	writeLong(trackHeader, 0);
+	os.write((const char*)headers, sizeof(headers));
+	statsCount(STATS_BYTES_WRITTEN, sizeof(headers));
+	return true;
 }
 
-MidiFile::MidiTrack::MidiCommandNoteOff::MidiCommandNoteOff(unsigned char channel, long deltatime, unsigned char octave, unsigned char notenumber, unsigned char velocity) 
-	: MidiCommand(channel, deltatime), octave(octave), noteNumber(notenumber), velocity(velocity)
+void MidiStreamWriter::writeBar(MidiFile& bar)
 {
+	buffer.resize(bar.maxMergedLength());
+	if(!buffer.empty())
+	{
+		unsigned char* end = bar.writeMergedEvents(&buffer[0], state);
+		os.write((const char*)&buffer[0], end - &buffer[0]);
+		trackLength += end - &buffer[0];
+		statsCount(STATS_BYTES_WRITTEN, end - &buffer[0]);
+	}
+	bar.clearEvents();
 }
 
-void MidiFile::MidiTrack::MidiCommandNoteOff::writeToFile(ostream& os)
+bool MidiStreamWriter::close()
 {
-	MidiFile::MidiTrack::MidiCommand::writeToFile(os);
-	unsigned char w = 0x80;
-	w |= channel;
-	os.put(w);
-	w = 12*octave+noteNumber;
-	os.put(w);
-	w = velocity;
-	os.put(w);
+	//Go back to the track header and fill in the length.
+	unsigned char length[4];
+	writeLong(length, trackLength);
+	os.seekp(18);
+	os.write((const char*)length, sizeof(length));
+	
+	bool ok = os.good();
+	os.close();
+	return ok;
 }
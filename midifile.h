@@ -20,13 +20,121 @@ const int MIDIFILE_NOTE_A  =  9;
 const int MIDIFILE_NOTE_A_ = 10;
 const int MIDIFILE_NOTE_B  = 11;
 
+//Chord qualities, used to look up the intervals of a chord in MIDIFILE_CHORD_SHAPES.
+enum MidiChordQuality
+{
+	MIDIFILE_CHORD_MAJOR,
+	MIDIFILE_CHORD_MINOR,
+	MIDIFILE_CHORD_DIMINISHED,
+	MIDIFILE_CHORD_AUGMENTED,
+	MIDIFILE_CHORD_SUS2,
+	MIDIFILE_CHORD_SUS4,
+	MIDIFILE_CHORD_DOMINANT7,
+	MIDIFILE_CHORD_MAJOR7,
+	MIDIFILE_CHORD_MINOR7,
+	MIDIFILE_CHORD_MINOR_MAJOR7,
+	MIDIFILE_CHORD_HALF_DIMINISHED7,
+	MIDIFILE_CHORD_DIMINISHED7,
+	MIDIFILE_CHORD_ADD9,
+	MIDIFILE_CHORD_DOMINANT9,
+	MIDIFILE_CHORD_MAJOR9,
+	MIDIFILE_CHORD_MINOR9,
+	MIDIFILE_CHORD_QUALITIES
+};
+
+//The most notes in a chord shape.
+const int MIDIFILE_MAX_CHORD_NOTES = 5;
+
+//The notes of a chord in root position, as semitones above the root.
+struct MidiChordShape
+{
+	int noOfNotes;
+	unsigned char intervals[MIDIFILE_MAX_CHORD_NOTES];
+};
+
+//The shape of each chord quality, in the order of MidiChordQuality.
+const MidiChordShape MIDIFILE_CHORD_SHAPES[MIDIFILE_CHORD_QUALITIES] = {
+	{ 3, { 0, 4, 7 } },         //Major.
+	{ 3, { 0, 3, 7 } },         //Minor.
+	{ 3, { 0, 3, 6 } },         //Diminished.
+	{ 3, { 0, 4, 8 } },         //Augmented.
+	{ 3, { 0, 2, 7 } },         //Suspended 2nd.
+	{ 3, { 0, 5, 7 } },         //Suspended 4th.
+	{ 4, { 0, 4, 7, 10 } },     //Dominant 7th.
+	{ 4, { 0, 4, 7, 11 } },     //Major 7th.
+	{ 4, { 0, 3, 7, 10 } },     //Minor 7th.
+	{ 4, { 0, 3, 7, 11 } },     //Minor major 7th.
+	{ 4, { 0, 3, 6, 10 } },     //Half diminished 7th.
+	{ 4, { 0, 3, 6, 9 } },      //Diminished 7th.
+	{ 4, { 0, 4, 7, 14 } },     //Added 9th.
+	{ 5, { 0, 4, 7, 10, 14 } }, //Dominant 9th.
+	{ 5, { 0, 4, 7, 11, 14 } }, //Major 9th.
+	{ 5, { 0, 3, 7, 10, 14 } }  //Minor 9th.
+};
+
+//The most bytes a variable length value can take up. MIDI files limit them to 28 bits.
+const int MIDIFILE_MAX_VARLEN_LENGTH = 4;
+
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include "vlq.h"
 using namespace std;
 
-//MIDI file class. This object will have MIDI tracks added to it.
+//Write a variable length value to the buffer. Returns the end of what was written.
+unsigned char* writeVarLen(unsigned char* buffer, unsigned long value);
+//Returns the length of a variable length value.
+int varLenLen(unsigned long value);
+
+//The number of events in each block handed out by a MidiEventArena.
+const int MIDIFILE_BLOCK_EVENTS = 256;
+//The number of blocks the arena allocates at a time.
+const int MIDIFILE_CHUNK_BLOCKS = 32;
+
+/* Hands out fixed size blocks of events for the tracks of a MidiFile.
+   Blocks are carved from large chunks, which are only freed when the arena is destroyed. reset() takes every
+   block back in one step, so the same memory is handed out again for the next piece. */
+class MidiEventArena
+{
+	//The chunks allocated so far.
+	std::vector<MidiEvent*> chunks;
+	//The number of blocks handed out since the last reset.
+	size_t blocksUsed;
+
+	//The arena owns its chunks, so it can not be copied.
+	MidiEventArena(const MidiEventArena&);
+	MidiEventArena& operator=(const MidiEventArena&);
+
+	public:
+		MidiEventArena() : blocksUsed(0)
+		{
+		}
+		~MidiEventArena(); //Class destructor. Frees every chunk.
+		//Get a block of MIDIFILE_BLOCK_EVENTS events, allocating a new chunk only if every chunk is in use.
+		MidiEvent* allocateBlock()
+		{
+			if(blocksUsed == chunks.size() * MIDIFILE_CHUNK_BLOCKS)
+				chunks.push_back(new MidiEvent[MIDIFILE_CHUNK_BLOCKS * MIDIFILE_BLOCK_EVENTS]);
+			MidiEvent* block = chunks[blocksUsed / MIDIFILE_CHUNK_BLOCKS] + (blocksUsed % MIDIFILE_CHUNK_BLOCKS) * MIDIFILE_BLOCK_EVENTS;
+			blocksUsed++;
+			return block;
+		}
+		//Take back every block, keeping the chunks.
+		void reset()
+		{
+			blocksUsed = 0;
+		}
+		//Get the number of bytes the chunks take up.
+		size_t getCapacity() const
+		{
+			return chunks.size() * MIDIFILE_CHUNK_BLOCKS * MIDIFILE_BLOCK_EVENTS * sizeof(MidiEvent);
+		}
+};
+
+/* MIDI file class. This object will have MIDI tracks added to it.
+   The events of every track come from one arena owned by the file, and everything is freed when the file is
+   destroyed. reset() empties the file but keeps its memory, so one MidiFile can be used for piece after piece. */
 class MidiFile
 {
 	//MidiFileHeader class definition.
@@ -44,8 +152,13 @@ class MidiFile
 		public:
 			//Constructor method.
 			MidiFileHeader(unsigned short fileformat = MIDIFILE_MULTIPLETRACKS_SYNCH, unsigned short deltaTimeticks = 128);
-			//Write the header to the file.
-			virtual void writeToFile(std::ostream& os, unsigned short trackcount);
+			//Write the header to the buffer. The buffer must have room for the 14 header bytes. Returns the end of what was written.
+			virtual unsigned char* writeToBuffer(unsigned char* buffer, unsigned short trackcount);
+			//Get the number of delta ticks per quarter note.
+			unsigned short getDeltaTimeTicks() const
+			{
+				return midiFileDeltaTimeTicks;
+			}
 	};
 	
 	//Declare the MidiTrack object, which will be defined later.
@@ -55,15 +168,78 @@ class MidiFile
 	MidiFileHeader header;
 	//The vector storing the tracks within the MIDI file.
 	std::vector<MidiTrack*> tracks;
+	//Tracks removed by reset(), kept to be handed out again by addTrack().
+	std::vector<MidiTrack*> spareTracks;
+	//Where the tracks' events are stored.
+	MidiEventArena arena;
+	//The buffer the file is serialised into by writeToFile(). Kept so its memory is reused.
+	std::vector<unsigned char> fileBuffer;
+	//Whether the file is written in the compact form. See setCompact().
+	bool compact;
+	
+	//Where a merge of the tracks into one has got to. Kept between calls so the tracks can be merged a piece at a time.
+	struct MergeState
+	{
+		std::vector<unsigned long> trackTimes; //The time of the last event merged from each track.
+		std::vector<unsigned long> nextTimes; //The time of the next event to be merged from each track.
+		std::vector<int> nextEvents; //The index of the next event to be merged from each track.
+		unsigned long lastTime; //The time of the last event written.
+		bool compact; //Whether to use running status and note ons with a velocity of 0 for note offs.
+		unsigned char runningStatus; //The status of the last event written in the compact form, 0 if there is none.
+		
+		MergeState(bool compact = false) : lastTime(0), compact(compact), runningStatus(0)
+		{
+		}
+	};
+	
+	//Write the events of every track to the buffer, merged into one track in time order. Returns the end of what was written.
+	unsigned char* writeMergedEvents(unsigned char* buffer, MergeState& state) const;
+	//The largest number of bytes writeMergedEvents() could write.
+	size_t maxMergedLength() const;
+	
+	friend class MidiStreamWriter;
+	
+	//The file owns its tracks, so it can not be copied.
+	MidiFile(const MidiFile&);
+	MidiFile& operator=(const MidiFile&);
 	
 	public:
 		MidiFile(unsigned short deltaTimeticks = 128, unsigned short fileformat = MIDIFILE_SINGLETRACK); //Class contructor.
+		~MidiFile(); //Class destructor. Frees the tracks and all of their events.
 		//Write the MIDI to file. Takes a string argument.
 		virtual void writeToFile(const char* filename);
 		//Write the MIDI to file. Takes an ostream argument.
 		virtual void writeToFile(std::ostream& os);
+		//Write the MIDI file's bytes to the end of the buffer, for callers that never touch the disk.
+		virtual void writeToBuffer(std::vector<unsigned char>& buffer);
+		/* Choose whether the file is written in the compact form: every track merged into the single track of a
+		   format 0 file, with running status, and note offs with the default release velocity of 64 written as
+		   note ons with a velocity of 0. The notes and their timing are unchanged. */
+		void setCompact(bool compact)
+		{
+			this->compact = compact;
+		}
 		//Add a track to the MIDI file object.
 		void addTrack();
+		//Remove every event from the tracks, keeping the tracks and the memory they use.
+		void clearEvents();
+		/* Add the events of each of the source's tracks to the end of the same track of this file, for joining up
+		   pieces of a piece generated separately. Tracks the source does not have are left alone. */
+		void appendEvents(const MidiFile& source);
+		//Remove every event and every track but the first, as the file was when it was made. All of the memory is kept for reuse.
+		void reset();
+		//Get the number of bytes of event storage the file holds.
+		size_t getEventCapacity() const
+		{
+			return arena.getCapacity();
+		}
+		//Get the number of tracks, including the first one.
+		int getNoOfTracks() const
+		{
+			return tracks.size();
+		}
+		//Get the number of events in a track.
+		size_t getNoOfEvents(int track) const;
 		// Add a note to the MIDI file object. Will add both a note on and note off to the MIDI object.
 		void addNote(int track, long deltaTime, unsigned char octave, unsigned char noteNumber,
 			unsigned char velocity = 96, unsigned char vel_off = 64, unsigned char channel = 0);
@@ -73,9 +249,15 @@ class MidiFile
 		//Add a note off.
 		void addNoteOff(int track, long deltaTime, unsigned char octave, unsigned char noteNumber,
 			unsigned char velocity = 64, unsigned char channel = 0);
-		//Add a chord to the MIDI object.
+		//Add a major or minor triad to the MIDI object, one note on each of three tracks starting at firsttrack.
 		void addChord(int firsttrack, long deltatime, unsigned char octave, const int chordNote, bool minor = false,
 			unsigned char velocity = 96, unsigned char vel_off = 64, unsigned char channel = 0);
+		/* Add a chord of any shape to the MIDI object, such as one of MIDIFILE_CHORD_SHAPES.
+		   The notes are built from the shape, starting at the root in the given octave.
+		   An inversion of n moves the lowest n notes up an octave. The notes are dealt out in order over noOfTracks
+		   tracks starting at firsttrack, and the notes for each track are added together. */
+		void addChord(int firsttrack, int noOfTracks, long deltatime, unsigned char octave, int root, const MidiChordShape& shape,
+			int inversion = 0, unsigned char velocity = 96, unsigned char vel_off = 64, unsigned char channel = 0);
 };
 
 class MidiFile::MidiTrack
@@ -88,23 +270,54 @@ class MidiFile::MidiTrack
 
 			public:
 				MidiTrackHeader(unsigned long tracklength = 0); //Constructor method.
-				virtual void writeToFile(std::ostream& os, int length); //Write the track header to the file.
+				//Write the track header to the buffer, which must have room for the 8 header bytes. Returns the end of what was written.
+				virtual unsigned char* writeToBuffer(unsigned char* buffer, unsigned long length);
 		};
 	
 		//The MIDI track header.
 		MidiTrackHeader header;
 		
-		//Midi command declarations.
-		class MidiCommand;
-		class MidiCommandNoteOn;
-		class MidiCommandNoteOff;
+		//Where the track's events are stored.
+		MidiEventArena* arena;
+		//The blocks holding the track's events, each with MIDIFILE_BLOCK_EVENTS events apart from the last.
+		std::vector<MidiEvent*> blocks;
+		//The number of events in the track.
+		size_t noOfEvents;
 		
-		//The vector storing the added MIDI commands.
-		std::vector<MidiCommand*> commands;
+		//Add an event to the end of the track.
+		void addEvent(long deltaTime, unsigned char status, unsigned char data1, unsigned char data2);
+		//Add an event whose delta time has already been checked.
+		void pushEvent(const MidiEvent& event)
+		{
+			if(noOfEvents % MIDIFILE_BLOCK_EVENTS == 0)
+				blocks.push_back(arena->allocateBlock());
+			blocks[noOfEvents / MIDIFILE_BLOCK_EVENTS][noOfEvents % MIDIFILE_BLOCK_EVENTS] = event;
+			noOfEvents++;
+		}
+		//Get an event.
+		const MidiEvent& getEvent(size_t index) const
+		{
+			return blocks[index / MIDIFILE_BLOCK_EVENTS][index % MIDIFILE_BLOCK_EVENTS];
+		}
+		//Get the number of events in a block.
+		size_t blockLength(size_t block) const
+		{
+			return block + 1 < blocks.size() ? MIDIFILE_BLOCK_EVENTS : noOfEvents - block * MIDIFILE_BLOCK_EVENTS;
+		}
+		//Remove every event. The blocks go back to the arena when the arena is reset.
+		void clear()
+		{
+			blocks.clear();
+			noOfEvents = 0;
+		}
+		
+		//The MIDI file reads the events directly when merging tracks.
+		friend class MidiFile;
 
 		public:
-			MidiTrack(); //Class constructor.
-			virtual void writeToFile(std::ostream& os); //Write the MIDI track to the file.
+			MidiTrack(MidiEventArena* arena); //Class constructor. The events are stored in the arena.
+			virtual ~MidiTrack() {} //Class destructor. The events belong to the arena, so there is nothing to free.
+			virtual void writeToBuffer(std::vector<unsigned char>& buffer); //Write the MIDI track to the end of the buffer.
 	
 			//Functions that will add the certain command to the MIDI track.
 			virtual void noteOn(unsigned char channel, long deltaTime, unsigned char octave, unsigned char noteNumber,
@@ -113,59 +326,35 @@ class MidiFile::MidiTrack
 				unsigned char velocity = 64);
 			virtual void note(unsigned char channel, long deltaTime, unsigned char octave, unsigned char noteNumber,
 				unsigned char velocity = 96, unsigned char vel_off = 64);
+			//Add notes that start together and end together. noteNumbers can go past 11 into the octaves above.
+			virtual void notes(unsigned char channel, long deltaTime, unsigned char octave, const unsigned char* noteNumbers,
+				int noOfNotes, unsigned char velocity = 96, unsigned char vel_off = 64);
 };
 
-class MidiFile::MidiTrack::MidiCommand
+/* Writes a MIDI file a piece at a time, so a piece of any length can be written in constant memory.
+   Each call to writeBar() merges the tracks of a MidiFile holding the latest bar into the single track of a
+   format 0 file and writes it out straight away. The track length is filled in when the file is closed.
+   Every bar passed in should cover the same length of time on each of its tracks. */
+class MidiStreamWriter
 {
-	public:
-		MidiCommand(unsigned char channel = 0, long deltaTime = 0); //Class constructor.
-		virtual void writeToFile(std::ostream& os); //Write the MIDI command to file.
-		virtual unsigned long getLength() //Get the length of the MIDI event. Each MIDI event will have a different length, overiding this function.
-		{
-			return 0;
-		}
-		unsigned char channel; //The channel to use for the MIDI command.
-		long deltaTime; //The deltatime before the MIDI command is executed.
-};
-
-//The note on MIDI command.
-class MidiFile::MidiTrack::MidiCommandNoteOn : public MidiFile::MidiTrack::MidiCommand
-{
-	//Variables which will store the information of the note on command.
-	unsigned char octave;
-	unsigned char noteNumber;
-	unsigned char velocity;
-
-	public:
-		//The class constructor.
-		MidiCommandNoteOn(unsigned char channel, long deltaTime, unsigned char octave, unsigned char noteNumber, unsigned char velocity);
-		//Write the command to file.
-		virtual void writeToFile(std::ostream& os);
-		//Get the length of the midi command, which needs to be written to the file.
-		virtual unsigned long getLength()
-		{
-			return 3;
-		}
-};
-
-//The note off MIDI command.
-class MidiFile::MidiTrack::MidiCommandNoteOff : public MidiFile::MidiTrack::MidiCommand
-{
-	//Variables which store the information of the note off.
-	unsigned char octave;
-	unsigned char noteNumber;
-	unsigned char velocity;
+	//The file being written.
+	std::ofstream os;
+	//Where the merge of the bars' tracks has got to.
+	MidiFile::MergeState state;
+	//Buffer each bar is serialised into before being written. Reused for every bar.
+	std::vector<unsigned char> buffer;
+	//The number of bytes written to the track so far.
+	unsigned long trackLength;
 
 	public:
-		//The class constructor.
-		MidiCommandNoteOff(unsigned char channel, long deltaTime, unsigned char octave, unsigned char noteNumber, unsigned char velocity);
-		//Write the command to file.
-		virtual void writeToFile(std::ostream& os);
-		//Get the length of the command, which needs to be written to the file.
-		virtual unsigned long getLength()
-		{
-			return 3;
-		}
+		MidiStreamWriter(); //Class constructor.
+		~MidiStreamWriter(); //Class destructor. Closes the file if it is still open.
+		//Open the file and write the headers. Returns false if the file could not be opened. compact is as for MidiFile::setCompact().
+		bool open(const char* filename, unsigned short deltaTimeticks = 128, bool compact = false);
+		//Write the events of the bar to the file, then clear them from the bar so the MidiFile can be reused.
+		void writeBar(MidiFile& bar);
+		//Fill in the track length and close the file. Returns false if anything failed to write.
+		bool close();
 };
 
 #endif //MIDIFILE_H
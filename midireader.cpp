@@ -0,0 +1,244 @@
+#include "midireader.h"
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+//Read a big endian number of the given number of bytes.
+static inline unsigned long readNumber(const unsigned char* bytes, int length)
+{
+	unsigned long value = 0;
+	for(int i = 0; i < length; i++)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+
+//Read a variable length value, moving position past it. Returns false if it runs past the end or is over 4 bytes.
+static inline bool readVarLen(const unsigned char*& position, const unsigned char* end, unsigned long& value)
+{
+	value = 0;
+	for(int i = 0; i < 4 && position < end; i++)
+	{
+		unsigned char c = *position++;
+		value = (value << 7) | (c & 0x7F);
+		if(!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+//Midi file reader functions
+MidiFileReader::MidiFileReader() : bytes(0), size(0), mapped(false), format(0), division(0)
+{
+}
+
+MidiFileReader::~MidiFileReader()
+{
+	close();
+}
+
+bool MidiFileReader::open(const char* filename)
+{
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if(fd < 0)
+	{
+		std::cout << "ERROR: Could not open " << filename << "." << std::endl;
+		return false;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		std::cout << "ERROR: " << filename << " is empty or could not be read." << std::endl;
+		::close(fd);
+		return false;
+	}
+
+	//The mapping stays valid after the descriptor is closed.
+	void* mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		std::cout << "ERROR: Could not map " << filename << "." << std::endl;
+		return false;
+	}
+	madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+	bytes = (const unsigned char*)mapping;
+	size = info.st_size;
+	mapped = true;
+
+	if(!readChunks())
+	{
+		std::cout << "ERROR: " << filename << " is not a MIDI file." << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MidiFileReader::open(const unsigned char* data, size_t length)
+{
+	close();
+
+	bytes = data;
+	size = length;
+
+	if(!readChunks())
+	{
+		std::cout << "ERROR: The buffer does not hold a MIDI file." << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MidiFileReader::close()
+{
+	if(mapped)
+		munmap((void*)bytes, size);
+
+	bytes = 0;
+	size = 0;
+	mapped = false;
+	format = 0;
+	division = 0;
+	trackStarts.clear();
+	trackEnds.clear();
+}
+
+void MidiFileReader::prefetch() const
+{
+	if(mapped)
+		madvise((void*)bytes, size, MADV_WILLNEED);
+}
+
+bool MidiFileReader::readChunks()
+{
+	//The file has to start with a header chunk of at least 6 bytes.
+	if(size < 14 || readNumber(bytes, 4) != 0x4D546864)
+		return false;
+	unsigned long headerLength = readNumber(bytes + 4, 4);
+	if(headerLength < 6 || headerLength > size - 8)
+		return false;
+
+	format = readNumber(bytes + 8, 2);
+	unsigned short noOfTracks = readNumber(bytes + 10, 2);
+	division = readNumber(bytes + 12, 2);
+
+	trackStarts.reserve(noOfTracks);
+	trackEnds.reserve(noOfTracks);
+
+	//Walk the chunks after the header, keeping the track chunks and skipping any others.
+	const unsigned char* position = bytes + 8 + headerLength;
+	const unsigned char* end = bytes + size;
+	while(end - position >= 8)
+	{
+		unsigned long type = readNumber(position, 4);
+		unsigned long length = readNumber(position + 4, 4);
+		position += 8;
+
+		//A chunk which claims to run past the end of the file is cut short.
+		if(length > (unsigned long)(end - position))
+			length = end - position;
+
+		if(type == 0x4D54726B)
+		{
+			trackStarts.push_back(position);
+			trackEnds.push_back(position + length);
+		}
+		position += length;
+	}
+
+	return true;
+}
+
+//Track iterator functions
+MidiFileReader::TrackIterator::TrackIterator(const unsigned char* start, const unsigned char* end)
+	: position(start), end(end), runningStatus(0), time(0), error(false)
+{
+}
+
+bool MidiFileReader::TrackIterator::next(MidiReaderEvent& event)
+{
+	if(position >= end)
+		return false;
+
+	if(!readVarLen(position, end, event.deltaTime) || position >= end)
+	{
+		error = true;
+		return false;
+	}
+	time += event.deltaTime;
+	event.time = time;
+
+	//A data byte where the status should be means the previous status is used again.
+	unsigned char status = *position;
+	if(status & 0x80)
+		position++;
+	else if(runningStatus)
+		status = runningStatus;
+	else
+	{
+		error = true;
+		return false;
+	}
+	event.status = status;
+
+	if(status < 0xF0)
+	{
+		//Channel events have two data bytes, apart from program change and channel pressure which have one.
+		int dataLength = (status & 0xE0) == 0xC0 ? 1 : 2;
+		if(end - position < dataLength)
+		{
+			error = true;
+			return false;
+		}
+		event.data1 = position[0];
+		event.data2 = dataLength == 2 ? position[1] : 0;
+		event.data = position;
+		event.length = dataLength;
+		position += dataLength;
+		runningStatus = status;
+		return true;
+	}
+
+	//Meta and system exclusive events cancel running status.
+	runningStatus = 0;
+	event.data1 = 0;
+	event.data2 = 0;
+
+	if(status == MIDIREADER_STATUS_META)
+	{
+		if(position >= end)
+		{
+			error = true;
+			return false;
+		}
+		event.data1 = *position++;
+	}
+	else if(status != MIDIREADER_STATUS_SYSEX && status != MIDIREADER_STATUS_SYSEX_ESCAPE)
+	{
+		//System common and real time messages do not belong in a MIDI file.
+		error = true;
+		return false;
+	}
+
+	if(!readVarLen(position, end, event.length) || event.length > (unsigned long)(end - position))
+	{
+		error = true;
+		return false;
+	}
+	event.data = position;
+	position += event.length;
+
+	//Nothing after the end of track event belongs to the track.
+	if(status == MIDIREADER_STATUS_META && event.data1 == MIDIREADER_META_END_OF_TRACK)
+		end = position;
+
+	return true;
+}
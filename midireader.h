@@ -0,0 +1,121 @@
+#ifndef MIDIREADER_H
+#define MIDIREADER_H
+
+#include <stddef.h>
+#include <vector>
+using namespace std;
+
+//Status bytes of the events that are not channel events.
+const unsigned char MIDIREADER_STATUS_SYSEX        = 0xF0;
+const unsigned char MIDIREADER_STATUS_SYSEX_ESCAPE = 0xF7;
+const unsigned char MIDIREADER_STATUS_META         = 0xFF;
+
+//Meta event types the reader itself acts on.
+const unsigned char MIDIREADER_META_END_OF_TRACK = 0x2F;
+
+//An event read from a MIDI file. Meta and system exclusive data points straight into the file's bytes.
+struct MidiReaderEvent
+{
+	unsigned long deltaTime; //The deltatime before the event.
+	unsigned long time; //The time of the event from the start of the track.
+	unsigned char status; //The status byte, with running status already applied.
+	unsigned char data1; //The first data byte of a channel event, or the type of a meta event.
+	unsigned char data2; //The second data byte of a channel event, 0 if it only has one.
+	const unsigned char* data; //The data of a meta or system exclusive event.
+	unsigned long length; //The length of the data.
+};
+
+/* Reads a Standard MIDI File in place, without copying it.
+   A file is memory mapped (or a buffer supplied by the caller is used) and the chunks are found when it is
+   opened. Events are then decoded straight from the bytes, either one at a time through a TrackIterator or
+   for the whole file through visit(). */
+class MidiFileReader
+{
+	//The bytes of the file.
+	const unsigned char* bytes;
+	size_t size;
+	//Whether the bytes are a mapping made by open(), which has to be unmapped.
+	bool mapped;
+
+	//Values from the MThd chunk.
+	unsigned short format;
+	unsigned short division;
+
+	//Where each MTrk chunk's events start and end.
+	vector<const unsigned char*> trackStarts;
+	vector<const unsigned char*> trackEnds;
+
+	//Find the header and track chunks. Returns false if the bytes are not a MIDI file.
+	bool readChunks();
+
+	public:
+		//Walks through the events of one track.
+		class TrackIterator
+		{
+			const unsigned char* position;
+			const unsigned char* end;
+			unsigned char runningStatus;
+			unsigned long time;
+			bool error;
+
+			public:
+				TrackIterator(const unsigned char* start = 0, const unsigned char* end = 0);
+				//Decode the next event. Returns false at the end of the track or if the track is malformed.
+				bool next(MidiReaderEvent& event);
+				//Whether the iterator stopped because the track is malformed.
+				bool hasError() const
+				{
+					return error;
+				}
+		};
+
+		MidiFileReader(); //Class constructor.
+		~MidiFileReader(); //Class destructor. Unmaps the file.
+		//Map a MIDI file and find its chunks. Returns false if it can not be read or is not a MIDI file.
+		bool open(const char* filename);
+		//Read a MIDI file already in memory. The bytes must stay valid until the reader is closed.
+		bool open(const unsigned char* data, size_t length);
+		//Release the file.
+		void close();
+		//Ask the kernel to start reading the whole mapped file in the background.
+		void prefetch() const;
+
+		//Values from the file header.
+		unsigned short getFormat() const
+		{
+			return format;
+		}
+		unsigned short getDivision() const
+		{
+			return division;
+		}
+		//The number of track chunks found, which may differ from the count in the header of a damaged file.
+		int getNoOfTracks() const
+		{
+			return trackStarts.size();
+		}
+
+		//Get an iterator over the events of a track.
+		TrackIterator track(int index) const
+		{
+			return TrackIterator(trackStarts[index], trackEnds[index]);
+		}
+
+		/* Call visitor(trackIndex, event) for every event in the file, track by track.
+		   Returns false if a track is malformed. */
+		template<class Visitor> bool visit(Visitor& visitor) const
+		{
+			MidiReaderEvent event;
+			for(int i = 0; i < trackStarts.size(); i++)
+			{
+				TrackIterator events = track(i);
+				while(events.next(event))
+					visitor(i, event);
+				if(events.hasError())
+					return false;
+			}
+			return true;
+		}
+};
+
+#endif //MIDIREADER_H
@@ -0,0 +1,352 @@
+#include "mtrandsimd.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//MT19937 period parameters.
+static const int MT_M = 397;
+static const MTRandSIMD::uint32 MT_MATRIX = 0x9908b0dfU;
+
+//SFMT19937 parameters. The state is 156 words of 128 bits, each word stored as four 32 bit lanes.
+static const int SFMT_N = MTRandSIMD::N / 4;
+static const int SFMT_POS1 = 122;
+static const int SFMT_SL1 = 18;
+static const int SFMT_SL2 = 1;
+static const int SFMT_SR1 = 11;
+static const int SFMT_SR2 = 1;
+static const MTRandSIMD::uint32 SFMT_MASK[4] = { 0xdfffffefU, 0xddfecb7fU, 0xbffaffffU, 0xbffffff6U };
+static const MTRandSIMD::uint32 SFMT_PARITY[4] = { 0x00000001U, 0x00000000U, 0x00000000U, 0x13c9e684U };
+
+//The MT19937 recurrence for one value.
+static inline MTRandSIMD::uint32 twist(MTRandSIMD::uint32 m, MTRandSIMD::uint32 s0, MTRandSIMD::uint32 s1)
+{
+	return m ^ (((s0 & 0x80000000U) | (s1 & 0x7fffffffU)) >> 1) ^ (-(s1 & 1U) & MT_MATRIX);
+}
+
+//The MT19937 tempering of one value.
+static inline MTRandSIMD::uint32 temper(MTRandSIMD::uint32 s)
+{
+	s ^= s >> 11;
+	s ^= (s << 7) & 0x9d2c5680U;
+	s ^= (s << 15) & 0xefc60000U;
+	return s ^ (s >> 18);
+}
+
+#ifdef __SSE2__
+//The MT19937 recurrence for four values at a time.
+static inline __m128i twist4(__m128i m, __m128i s0, __m128i s1)
+{
+	__m128i mixed = _mm_or_si128(_mm_and_si128(s0, _mm_set1_epi32(0x80000000U)), _mm_and_si128(s1, _mm_set1_epi32(0x7fffffff)));
+	//Turn the low bit of s1 into a mask of all ones or all zeros.
+	__m128i odd = _mm_srai_epi32(_mm_slli_epi32(s1, 31), 31);
+	return _mm_xor_si128(_mm_xor_si128(m, _mm_srli_epi32(mixed, 1)), _mm_and_si128(odd, _mm_set1_epi32(MT_MATRIX)));
+}
+
+//Regenerate an MT19937 state, four values at a time where none of the four depend on each other.
+static void reloadMT(MTRandSIMD::uint32* s)
+{
+	const int N = MTRandSIMD::N;
+	int i = 0;
+	//The first N - M values only read old values.
+	for(; i + 4 <= N - MT_M; i += 4)
+	{
+		__m128i v = twist4(_mm_loadu_si128((const __m128i*)(s + i + MT_M)), _mm_loadu_si128((const __m128i*)(s + i)),
+			_mm_loadu_si128((const __m128i*)(s + i + 1)));
+		_mm_storeu_si128((__m128i*)(s + i), v);
+	}
+	for(; i < N - MT_M; i++)
+		s[i] = twist(s[i + MT_M], s[i], s[i + 1]);
+	//The rest read values made N - M places earlier, which is far enough back for four at a time.
+	for(; i + 4 <= N - 1; i += 4)
+	{
+		__m128i v = twist4(_mm_loadu_si128((const __m128i*)(s + i + MT_M - N)), _mm_loadu_si128((const __m128i*)(s + i)),
+			_mm_loadu_si128((const __m128i*)(s + i + 1)));
+		_mm_storeu_si128((__m128i*)(s + i), v);
+	}
+	for(; i < N - 1; i++)
+		s[i] = twist(s[i + MT_M - N], s[i], s[i + 1]);
+	s[N - 1] = twist(s[MT_M - 1], s[N - 1], s[0]);
+}
+
+//Temper a whole state into the output values.
+static void temperAll(const MTRandSIMD::uint32* s, MTRandSIMD::uint32* output)
+{
+	const __m128i b = _mm_set1_epi32(0x9d2c5680U);
+	const __m128i c = _mm_set1_epi32(0xefc60000U);
+	for(int i = 0; i < MTRandSIMD::N; i += 4)
+	{
+		__m128i v = _mm_load_si128((const __m128i*)(s + i));
+		v = _mm_xor_si128(v, _mm_srli_epi32(v, 11));
+		v = _mm_xor_si128(v, _mm_and_si128(_mm_slli_epi32(v, 7), b));
+		v = _mm_xor_si128(v, _mm_and_si128(_mm_slli_epi32(v, 15), c));
+		v = _mm_xor_si128(v, _mm_srli_epi32(v, 18));
+		_mm_store_si128((__m128i*)(output + i), v);
+	}
+}
+
+//The SFMT recurrence for one 128 bit word.
+static inline __m128i recursion(__m128i a, __m128i b, __m128i c, __m128i d, __m128i mask)
+{
+	__m128i x = _mm_xor_si128(a, _mm_slli_si128(a, SFMT_SL2));
+	x = _mm_xor_si128(x, _mm_and_si128(_mm_srli_epi32(b, SFMT_SR1), mask));
+	x = _mm_xor_si128(x, _mm_srli_si128(c, SFMT_SR2));
+	return _mm_xor_si128(x, _mm_slli_epi32(d, SFMT_SL1));
+}
+
+//Regenerate an SFMT state.
+static void reloadSFMT(MTRandSIMD::uint32* s)
+{
+	__m128i* w = (__m128i*)s;
+	const __m128i mask = _mm_loadu_si128((const __m128i*)SFMT_MASK);
+	__m128i r1 = _mm_load_si128(w + SFMT_N - 2);
+	__m128i r2 = _mm_load_si128(w + SFMT_N - 1);
+	int i = 0;
+	for(; i < SFMT_N - SFMT_POS1; i++)
+	{
+		__m128i r = recursion(_mm_load_si128(w + i), _mm_load_si128(w + i + SFMT_POS1), r1, r2, mask);
+		_mm_store_si128(w + i, r);
+		r1 = r2;
+		r2 = r;
+	}
+	for(; i < SFMT_N; i++)
+	{
+		__m128i r = recursion(_mm_load_si128(w + i), _mm_load_si128(w + i + SFMT_POS1 - SFMT_N), r1, r2, mask);
+		_mm_store_si128(w + i, r);
+		r1 = r2;
+		r2 = r;
+	}
+}
+#else
+//Regenerate an MT19937 state one value at a time.
+static void reloadMT(MTRandSIMD::uint32* s)
+{
+	const int N = MTRandSIMD::N;
+	int i = 0;
+	for(; i < N - MT_M; i++)
+		s[i] = twist(s[i + MT_M], s[i], s[i + 1]);
+	for(; i < N - 1; i++)
+		s[i] = twist(s[i + MT_M - N], s[i], s[i + 1]);
+	s[N - 1] = twist(s[MT_M - 1], s[N - 1], s[0]);
+}
+
+static void temperAll(const MTRandSIMD::uint32* s, MTRandSIMD::uint32* output)
+{
+	for(int i = 0; i < MTRandSIMD::N; i++)
+		output[i] = temper(s[i]);
+}
+
+/* The SFMT recurrence for one 128 bit word, held as four 32 bit lanes with the lowest first.
+   The whole word is shifted left by SFMT_SL2 bytes for a and right by SFMT_SR2 bytes for c. */
+static void recursion(MTRandSIMD::uint32* r, const MTRandSIMD::uint32* a, const MTRandSIMD::uint32* b,
+	const MTRandSIMD::uint32* c, const MTRandSIMD::uint32* d)
+{
+	unsigned long long ah = ((unsigned long long)a[3] << 32) | a[2], al = ((unsigned long long)a[1] << 32) | a[0];
+	unsigned long long ch = ((unsigned long long)c[3] << 32) | c[2], cl = ((unsigned long long)c[1] << 32) | c[0];
+	unsigned long long xh = (ah << (SFMT_SL2 * 8)) | (al >> (64 - SFMT_SL2 * 8)), xl = al << (SFMT_SL2 * 8);
+	unsigned long long yh = ch >> (SFMT_SR2 * 8), yl = (cl >> (SFMT_SR2 * 8)) | (ch << (64 - SFMT_SR2 * 8));
+	MTRandSIMD::uint32 x[4] = { (MTRandSIMD::uint32)xl, (MTRandSIMD::uint32)(xl >> 32), (MTRandSIMD::uint32)xh, (MTRandSIMD::uint32)(xh >> 32) };
+	MTRandSIMD::uint32 y[4] = { (MTRandSIMD::uint32)yl, (MTRandSIMD::uint32)(yl >> 32), (MTRandSIMD::uint32)yh, (MTRandSIMD::uint32)(yh >> 32) };
+	for(int j = 0; j < 4; j++)
+		r[j] = a[j] ^ x[j] ^ ((b[j] >> SFMT_SR1) & SFMT_MASK[j]) ^ y[j] ^ (d[j] << SFMT_SL1);
+}
+
+static void reloadSFMT(MTRandSIMD::uint32* s)
+{
+	const MTRandSIMD::uint32* r1 = s + 4 * (SFMT_N - 2);
+	const MTRandSIMD::uint32* r2 = s + 4 * (SFMT_N - 1);
+	for(int i = 0; i < SFMT_N; i++)
+	{
+		int pos = i < SFMT_N - SFMT_POS1 ? i + SFMT_POS1 : i + SFMT_POS1 - SFMT_N;
+		recursion(s + 4 * i, s + 4 * i, s + 4 * pos, r1, r2);
+		r1 = r2;
+		r2 = s + 4 * i;
+	}
+}
+#endif
+
+MTRandSIMD::MTRandSIMD(uint32 oneSeed, MTRandSIMDMode mode) : mode(mode)
+{
+	seed(oneSeed);
+}
+
+MTRandSIMD::MTRandSIMD(const uint32* bigSeed, int seedLength, MTRandSIMDMode mode) : mode(mode)
+{
+	seed(bigSeed, seedLength);
+}
+
+MTRandSIMD::MTRandSIMD(MTRandSIMDMode mode) : mode(mode)
+{
+	seed();
+}
+
+void MTRandSIMD::initialize(uint32 oneSeed)
+{
+	//See Knuth TAOCP Vol 2, 3rd Ed, p.106 for the multiplier.
+	state[0] = oneSeed;
+	for(int i = 1; i < N; i++)
+		state[i] = 1812433253U * (state[i - 1] ^ (state[i - 1] >> 30)) + i;
+}
+
+void MTRandSIMD::certifyPeriod()
+{
+	//The state is in the full period when the parity of its first word masked by SFMT_PARITY is odd.
+	uint32 inner = 0;
+	for(int i = 0; i < 4; i++)
+		inner ^= state[i] & SFMT_PARITY[i];
+	for(int i = 16; i > 0; i >>= 1)
+		inner ^= inner >> i;
+	if(inner & 1)
+		return;
+
+	//Otherwise flip the lowest parity bit, which moves it into the full period.
+	for(int i = 0; i < 4; i++)
+	{
+		if(SFMT_PARITY[i])
+		{
+			state[i] ^= SFMT_PARITY[i] & -SFMT_PARITY[i];
+			return;
+		}
+	}
+}
+
+void MTRandSIMD::seed(uint32 oneSeed)
+{
+	initialize(oneSeed);
+	if(mode == MTRANDSIMD_SFMT)
+		certifyPeriod();
+	//The state is regenerated before the first value is handed out, as MTRand does when it is seeded.
+	left = 0;
+}
+
+void MTRandSIMD::seed(const uint32* bigSeed, int seedLength)
+{
+	//The same mixing of the seed array into the state as MTRand uses.
+	initialize(19650218U);
+	int i = 1;
+	int j = 0;
+	for(int k = N > seedLength ? N : seedLength; k; k--)
+	{
+		state[i] = (state[i] ^ ((state[i - 1] ^ (state[i - 1] >> 30)) * 1664525U)) + bigSeed[j] + j;
+		i++;
+		j++;
+		if(i >= N)
+		{
+			state[0] = state[N - 1];
+			i = 1;
+		}
+		if(j >= seedLength)
+			j = 0;
+	}
+	for(int k = N - 1; k; k--)
+	{
+		state[i] = (state[i] ^ ((state[i - 1] ^ (state[i - 1] >> 30)) * 1566083941U)) - i;
+		i++;
+		if(i >= N)
+		{
+			state[0] = state[N - 1];
+			i = 1;
+		}
+	}
+	//The top bit is set so the state can not be all zeros.
+	state[0] = 0x80000000U;
+	if(mode == MTRANDSIMD_SFMT)
+		certifyPeriod();
+	left = 0;
+}
+
+void MTRandSIMD::seed()
+{
+	uint32 bigSeed[N];
+	FILE* urandom = fopen("/dev/urandom", "rb");
+	if(urandom)
+	{
+		bool success = fread(bigSeed, sizeof(bigSeed), 1, urandom) == 1;
+		fclose(urandom);
+		if(success)
+		{
+			seed(bigSeed, N);
+			return;
+		}
+	}
+
+	//Fall back on the time, changed on every call so two generators seeded together still differ.
+	static uint32 differ = 0;
+	seed((uint32)time(NULL) ^ ((uint32)clock() << 16) ^ differ++);
+}
+
+void MTRandSIMD::reload()
+{
+	if(mode == MTRANDSIMD_SFMT)
+	{
+		reloadSFMT(state);
+		next = state;
+	}
+	else
+	{
+		reloadMT(state);
+		temperAll(state, output);
+		next = output;
+	}
+	left = N;
+}
+
+MTRandSIMD::uint32 MTRandSIMD::randInt(uint32 n)
+{
+	//Draw numbers masked to the bits n uses until one is in range.
+	uint32 used = n;
+	used |= used >> 1;
+	used |= used >> 2;
+	used |= used >> 4;
+	used |= used >> 8;
+	used |= used >> 16;
+
+	uint32 i;
+	do
+		i = randInt() & used;
+	while(i > n);
+	return i;
+}
+
+void MTRandSIMD::fill(uint32* values, size_t count)
+{
+	while(count > 0)
+	{
+		if(left == 0)
+			reload();
+		size_t copied = count < (size_t)left ? count : left;
+		memcpy(values, next, copied * sizeof(uint32));
+		values += copied;
+		next += copied;
+		left -= copied;
+		count -= copied;
+	}
+}
+
+void MTRandSIMD::fill(float* values, size_t count)
+{
+	while(count > 0)
+	{
+		if(left == 0)
+			reload();
+		size_t copied = count < (size_t)left ? count : left;
+		size_t i = 0;
+#ifdef __SSE2__
+		//The top 24 bits convert to a float exactly, so the result can never round up to 1.
+		const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+		for(; i + 4 <= copied; i += 4)
+		{
+			__m128i bits = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(next + i)), 8);
+			_mm_storeu_ps(values + i, _mm_mul_ps(_mm_cvtepi32_ps(bits), scale));
+		}
+#endif
+		for(; i < copied; i++)
+			values[i] = (next[i] >> 8) * (1.0f / 16777216.0f);
+		values += copied;
+		next += copied;
+		left -= copied;
+		count -= copied;
+	}
+}
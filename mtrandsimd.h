@@ -0,0 +1,85 @@
+#ifndef MTRANDSIMD_H
+#define MTRANDSIMD_H
+
+#include <stddef.h>
+
+/* The sequences an MTRandSIMD can generate.
+   MTRANDSIMD_MT19937 - the Mersenne Twister. Gives exactly the numbers MTRand gives for the same seed.
+   MTRANDSIMD_SFMT - the SIMD-oriented Fast Mersenne Twister (SFMT19937), which has the same period but a
+   recurrence over 128 bit words, so it needs no tempering. Its numbers are not the ones MTRand gives. */
+enum MTRandSIMDMode
+{
+	MTRANDSIMD_MT19937,
+	MTRANDSIMD_SFMT
+};
+
+/* A Mersenne Twister that regenerates its state with SSE2 and hands out numbers from a block of 624 at a time.
+   Besides single draws, whole arrays of numbers can be filled with one call, so a caller that knows how many
+   numbers it needs can take them all at once. Filling an array gives the same numbers as drawing them one at
+   a time, in the same order. Seeding works as it does for MTRand in both modes. */
+class MTRandSIMD
+{
+	public:
+		typedef unsigned int uint32;
+
+		//The length of the state, and the number of values generated each time it is regenerated.
+		enum { N = 624 };
+
+	private:
+		//The state, and the tempered values handed out in the MT19937 mode. SFMT values are the state itself.
+		alignas(16) uint32 state[N];
+		alignas(16) uint32 output[N];
+		//The next value to hand out and the number left before the state has to be regenerated.
+		const uint32* next;
+		int left;
+		MTRandSIMDMode mode;
+
+		//Fill the state from a single seed.
+		void initialize(uint32 oneSeed);
+		//Make sure an SFMT state is not one of the states outside the full period.
+		void certifyPeriod();
+		//Regenerate the state and point next at the new values.
+		void reload();
+
+	public:
+		MTRandSIMD(uint32 oneSeed, MTRandSIMDMode mode = MTRANDSIMD_MT19937);
+		MTRandSIMD(const uint32* bigSeed, int seedLength, MTRandSIMDMode mode = MTRANDSIMD_MT19937);
+		MTRandSIMD(MTRandSIMDMode mode = MTRANDSIMD_MT19937); //Seeded from /dev/urandom, or the time if it can not be read.
+
+		//Reseed the generator, in the same way as MTRand. The mode stays the same.
+		void seed(uint32 oneSeed);
+		void seed(const uint32* bigSeed, int seedLength);
+		void seed();
+		//Change the mode. The generator has to be seeded again before it is used.
+		void setMode(MTRandSIMDMode newMode)
+		{
+			mode = newMode;
+		}
+		MTRandSIMDMode getMode() const
+		{
+			return mode;
+		}
+
+		//Get an integer in [0, 2^32 - 1].
+		uint32 randInt()
+		{
+			if(left == 0)
+				reload();
+			left--;
+			return *next++;
+		}
+		//Get an integer in [0, n], drawing in the same way as MTRand.
+		uint32 randInt(uint32 n);
+		//Get a real number in [0, 1).
+		double randExc()
+		{
+			return randInt() * (1.0 / 4294967296.0);
+		}
+
+		//Fill an array with integers in [0, 2^32 - 1].
+		void fill(uint32* values, size_t count);
+		//Fill an array with real numbers in [0, 1), one draw each, keeping the top 24 bits of the draw.
+		void fill(float* values, size_t count);
+};
+
+#endif //MTRANDSIMD_H
@@ -0,0 +1,328 @@
+#include "packfile.h"
+#include "hash.h"
+#include "stats.h"
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+using namespace std;
+
+//The first bytes of a pack.
+static const char PACKFILE_SIGNATURE[8] = { 'A', 'C', 'P', 'A', 'C', 'K', '0', '1' };
+static const unsigned int PACKFILE_VERSION = 1;
+//Read back as a different number on a machine with another byte order.
+static const unsigned int PACKFILE_BYTE_ORDER = 0x01020304;
+
+struct PackReader::Header
+{
+	char signature[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	unsigned int noOfPieces;
+	unsigned int noOfStyles;
+	unsigned int rng;
+	unsigned int compact;
+	//Where the index starts. The style names follow it.
+	unsigned long long indexOffset;
+	//The hash of the style names.
+	unsigned long long namesChecksum;
+	//The hash of the fields above.
+	unsigned long long checksum;
+};
+
+struct PackReader::Entry
+{
+	//Where the piece starts in the file and its length, both in bytes. A length of 0 means there is no piece with the id.
+	unsigned long long offset;
+	unsigned long long length;
+	unsigned long long seed;
+	unsigned int piece;
+	unsigned int style;
+	unsigned int noOfBars;
+	unsigned int reserved;
+	//The hash of the fields above.
+	unsigned long long checksum;
+};
+
+//Each checksum is the hash of everything before it in its structure, which has no padding.
+template<class T> static unsigned long long checksum(const T& value)
+{
+	return hashBytes(HASH_START, &value, offsetof(T, checksum));
+}
+
+PackReader::PackReader() : data(NULL), length(0), header(NULL), index(NULL)
+{
+}
+
+PackReader::~PackReader()
+{
+	close();
+}
+
+void PackReader::close()
+{
+	if(data)
+		munmap((void*)data, length);
+	data = NULL;
+	length = 0;
+	header = NULL;
+	index = NULL;
+}
+
+bool PackReader::open(const char* filename)
+{
+	close();
+
+	int descriptor = ::open(filename, O_RDONLY);
+	struct stat info;
+	if(descriptor < 0 || fstat(descriptor, &info) != 0)
+	{
+		std::cout << "ERROR: Could not open " << filename << "." << std::endl;
+		if(descriptor >= 0)
+			::close(descriptor);
+		return false;
+	}
+	if((size_t)info.st_size < sizeof(Header))
+	{
+		std::cout << "ERROR: " << filename << " is not a pack." << std::endl;
+		::close(descriptor);
+		return false;
+	}
+
+	//The mapping stays valid after the descriptor is closed.
+	void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	::close(descriptor);
+	if(mapped == MAP_FAILED)
+	{
+		std::cout << "ERROR: Could not map " << filename << " into memory." << std::endl;
+		return false;
+	}
+	data = (const unsigned char*)mapped;
+	length = info.st_size;
+
+	const Header* found = (const Header*)data;
+	if(memcmp(found->signature, PACKFILE_SIGNATURE, sizeof(PACKFILE_SIGNATURE)) != 0
+		|| found->byteOrder != PACKFILE_BYTE_ORDER || found->version != PACKFILE_VERSION)
+	{
+		std::cout << "ERROR: " << filename << " is not a finished version " << PACKFILE_VERSION
+			<< " pack written on a machine with this byte order." << std::endl;
+		close();
+		return false;
+	}
+
+	//The index and names must fit between the pieces and the end of the file, and the names must be whole.
+	size_t namesLength = (size_t)found->noOfStyles * (PACKFILE_MAX_STYLE_NAME + 1);
+	if(found->checksum != checksum(*found) || found->indexOffset < sizeof(Header) || found->indexOffset > length
+		|| found->noOfPieces > (length - found->indexOffset) / sizeof(Entry)
+		|| namesLength > length - found->indexOffset - found->noOfPieces * sizeof(Entry)
+		|| hashBytes(HASH_START, data + found->indexOffset + found->noOfPieces * sizeof(Entry), namesLength)
+			!= found->namesChecksum)
+	{
+		std::cout << "ERROR: The header of " << filename << " is damaged." << std::endl;
+		close();
+		return false;
+	}
+
+	header = found;
+	index = (const Entry*)(data + header->indexOffset);
+	return true;
+}
+
+int PackReader::getNoOfPieces() const
+{
+	return header ? header->noOfPieces : 0;
+}
+
+GeneratorRng PackReader::getRng() const
+{
+	return header ? (GeneratorRng)header->rng : GENERATOR_RNG_MT19937;
+}
+
+bool PackReader::isCompact() const
+{
+	return header && header->compact;
+}
+
+int PackReader::getNoOfStyles() const
+{
+	return header ? header->noOfStyles : 0;
+}
+
+const char* PackReader::getStyleName(int style) const
+{
+	if(style < 0 || style >= getNoOfStyles())
+		return "(unknown)";
+	return (const char*)(data + header->indexOffset + header->noOfPieces * sizeof(Entry)) + style * (PACKFILE_MAX_STYLE_NAME + 1);
+}
+
+bool PackReader::getPiece(int id, PackPiece& piece) const
+{
+	if(id < 0 || id >= getNoOfPieces())
+	{
+		std::cout << "ERROR: The pack has no piece " << id << "." << std::endl;
+		return false;
+	}
+
+	const Entry& entry = index[id];
+	if(checksum(entry) != entry.checksum)
+	{
+		std::cout << "ERROR: Entry " << id << " of the pack's index is damaged." << std::endl;
+		return false;
+	}
+	if(entry.length == 0)
+	{
+		std::cout << "ERROR: The pack has no piece " << id << "." << std::endl;
+		return false;
+	}
+	if(entry.offset < sizeof(Header) || entry.offset > header->indexOffset || entry.length > header->indexOffset - entry.offset)
+	{
+		std::cout << "ERROR: Entry " << id << " of the pack's index is damaged." << std::endl;
+		return false;
+	}
+
+	piece.data = data + entry.offset;
+	piece.length = entry.length;
+	piece.seed = entry.seed;
+	piece.piece = entry.piece;
+	piece.style = entry.style;
+	piece.noOfBars = entry.noOfBars;
+	return true;
+}
+
+PackWriter::PackWriter() : descriptor(-1), rng(GENERATOR_RNG_MT19937), compact(false), end(0), ok(true)
+{
+}
+
+PackWriter::~PackWriter()
+{
+	finish();
+}
+
+bool PackWriter::create(const char* filename, GeneratorRng rng, bool compact)
+{
+	finish();
+
+	descriptor = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(descriptor < 0)
+	{
+		std::cout << "ERROR: Could not create " << filename << ": " << strerror(errno) << "." << std::endl;
+		return false;
+	}
+	this->filename = filename;
+	this->rng = rng;
+	this->compact = compact;
+	//The pieces start after the header, which is left as zeros until the pack is finished.
+	end = sizeof(PackReader::Header);
+	ok = true;
+	styleNames.clear();
+	entries.clear();
+	return true;
+}
+
+void PackWriter::setStyleNames(const vector<string>& names)
+{
+	styleNames = names;
+}
+
+bool PackWriter::writeAt(const void* data, size_t length, unsigned long long offset)
+{
+	const char* bytes = (const char*)data;
+	while(length > 0)
+	{
+		ssize_t written = pwrite(descriptor, bytes, length, offset);
+		if(written < 0 && errno == EINTR)
+			continue;
+		if(written <= 0)
+			return false;
+		bytes += written;
+		length -= written;
+		offset += written;
+	}
+	return true;
+}
+
+bool PackWriter::append(int id, const vector<unsigned char>& file, unsigned long seed, int piece, int style, int noOfBars)
+{
+	StatsTimer timer(STATS_PHASE_WRITE);
+	if(descriptor < 0 || id < 0 || file.empty())
+		return false;
+
+	//Claim the next stretch of the file, then write into it while other threads write into theirs.
+	unsigned long long offset = end.fetch_add(file.size());
+	if(!writeAt(&file[0], file.size(), offset))
+	{
+		std::cout << "ERROR: Could not write piece " << id << " to " << filename << ": " << strerror(errno) << "." << std::endl;
+		ok = false;
+		return false;
+	}
+	statsCount(STATS_BYTES_WRITTEN, file.size());
+
+	PackReader::Entry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = offset;
+	entry.length = file.size();
+	entry.seed = seed;
+	entry.piece = piece;
+	entry.style = style;
+	entry.noOfBars = noOfBars;
+	entry.checksum = checksum(entry);
+
+	lock_guard<mutex> guard(lock);
+	if(id >= entries.size())
+	{
+		//Ids that have no piece yet get empty entries, which still need their checksums.
+		PackReader::Entry empty;
+		memset(&empty, 0, sizeof(empty));
+		empty.checksum = checksum(empty);
+		entries.resize(id + 1, empty);
+	}
+	entries[id] = entry;
+	return true;
+}
+
+bool PackWriter::finish()
+{
+	if(descriptor < 0)
+		return true;
+
+	//The style names follow the index, each in a fixed size field so a name can be found from its number.
+	vector<char> names(styleNames.size() * (PACKFILE_MAX_STYLE_NAME + 1), 0);
+	for(int i = 0; i < styleNames.size(); i++)
+		strncpy(&names[i * (PACKFILE_MAX_STYLE_NAME + 1)], styleNames[i].c_str(), PACKFILE_MAX_STYLE_NAME);
+
+	PackReader::Header header;
+	memcpy(header.signature, PACKFILE_SIGNATURE, sizeof(PACKFILE_SIGNATURE));
+	header.version = PACKFILE_VERSION;
+	header.byteOrder = PACKFILE_BYTE_ORDER;
+	header.noOfPieces = entries.size();
+	header.noOfStyles = styleNames.size();
+	header.rng = rng;
+	header.compact = compact;
+	//The index starts on an 8 byte boundary after the pieces.
+	header.indexOffset = (end + 7) / 8 * 8;
+	header.namesChecksum = hashBytes(HASH_START, names.empty() ? NULL : &names[0], names.size());
+	header.checksum = checksum(header);
+
+	//The header goes last, so the pack is only marked as finished once everything it points to is there.
+	static_assert(sizeof(PackReader::Header) % 8 == 0 && sizeof(PackReader::Entry) % 8 == 0, "The index must stay on an 8 byte boundary");
+	size_t indexLength = entries.size() * sizeof(PackReader::Entry);
+	bool written = ok
+		&& writeAt(entries.empty() ? NULL : &entries[0], indexLength, header.indexOffset)
+		&& writeAt(names.empty() ? NULL : &names[0], names.size(), header.indexOffset + indexLength)
+		&& writeAt(&header, sizeof(header), 0);
+	if(::close(descriptor) != 0)
+		written = false;
+	descriptor = -1;
+	entries.clear();
+
+	if(!written)
+	{
+		std::cout << "ERROR: Could not finish " << filename << "." << std::endl;
+		return false;
+	}
+	return true;
+}
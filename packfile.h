@@ -0,0 +1,116 @@
+#ifndef PACKFILE_H
+#define PACKFILE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "generator.h"
+
+//The longest style name a pack keeps. Longer names are cut short.
+const int PACKFILE_MAX_STYLE_NAME = 47;
+
+/* A pack holds many serialised MIDI files in one file, so a large batch costs one file rather than one each.
+   The file starts with a header, followed by the pieces one after another, then an index with an entry for
+   each piece id giving where its bytes are and how it was made, then the names of the styles the entries refer
+   to. The header is written last, so a pack that was never finished is not mistaken for a whole one.
+   Like a style library, a pack is written in the machine's own byte order and read on machines with the same one. */
+
+//A piece in a pack, as a PackReader gives it out.
+struct PackPiece
+{
+	const unsigned char* data; //The piece's bytes, in the mapped pack.
+	size_t length;
+	unsigned long seed; //The seed and piece number the piece was generated from, as given to generateBatch().
+	int piece;
+	int style; //The number of the piece's style in the pack's names.
+	int noOfBars;
+};
+
+/* Reads a pack, which is mapped into memory. Getting a piece is a lookup in the index by id, and the bytes
+   given out are the mapped file's, so nothing is copied. Each index entry has its own checksum, which is
+   checked when the entry is read, so opening a pack costs the same however many pieces it holds. */
+class PackReader
+{
+	friend class PackWriter;
+	struct Header;
+	struct Entry;
+
+	//The mapped file and its length.
+	const unsigned char* data;
+	size_t length;
+	const Header* header;
+	const Entry* index;
+
+	public:
+		PackReader(); //Class constructor. The pack is empty until it is opened.
+		~PackReader(); //Class destructor. Unmaps the file, so any pieces taken from the pack can no longer be used.
+
+		//Map a pack and check its header and style names. Returns false, after printing why, if it can not be used.
+		bool open(const char* filename);
+		//Unmap the file.
+		void close();
+
+		//Get the number of piece ids in the pack, which is one more than the highest. Ids with no piece are skipped.
+		int getNoOfPieces() const;
+		//Get the options the pieces were made with.
+		GeneratorRng getRng() const;
+		bool isCompact() const;
+		//Get the number of style names and one of them.
+		int getNoOfStyles() const;
+		const char* getStyleName(int style) const;
+
+		/* Get a piece by id. Its bytes stay valid while the pack is open. Returns false, after printing why, if there
+		   is no piece with the id or its entry is damaged. */
+		bool getPiece(int id, PackPiece& piece) const;
+
+	private:
+		//A reader can not be copied, as it owns the mapping.
+		PackReader(const PackReader&);
+		PackReader& operator=(const PackReader&);
+};
+
+/* Writes a pack. Pieces can be appended from several threads at once: each takes the next stretch of the file
+   for its bytes and writes them there without waiting for the others, and only the index entry is added under
+   a lock. */
+class PackWriter
+{
+	int descriptor;
+	std::string filename;
+	GeneratorRng rng;
+	bool compact;
+	//Where the next piece goes.
+	std::atomic<unsigned long long> end;
+	//Cleared by any thread whose piece could not be written.
+	std::atomic<bool> ok;
+	std::vector<std::string> styleNames;
+	std::vector<PackReader::Entry> entries;
+	std::mutex lock;
+
+	public:
+		PackWriter(); //Class constructor. Nothing is written until a pack is created.
+		~PackWriter(); //Class destructor. Finishes the pack if it was not finished.
+
+		/* Create a pack file for pieces made with the given options, replacing any file with the name.
+		   Returns false, after printing why, if it could not be created. */
+		bool create(const char* filename, GeneratorRng rng, bool compact);
+		//Set the names of the styles the pieces' style numbers refer to.
+		void setStyleNames(const std::vector<std::string>& names);
+		/* Add a piece, given its id in the pack and how it was made. Each id should be used once. Safe to call from
+		   several threads. Returns false, after printing why, if the piece could not be written. */
+		bool append(int id, const std::vector<unsigned char>& file, unsigned long seed, int piece, int style, int noOfBars);
+		/* Write the index and header and close the file. Returns false, after printing why, if anything could not be
+		   written, in which case the pack is left unfinished. */
+		bool finish();
+
+	private:
+		//Write bytes at an offset in the file. Returns false if they could not all be written.
+		bool writeAt(const void* data, size_t length, unsigned long long offset);
+
+		//A writer can not be copied, as it owns the file.
+		PackWriter(const PackWriter&);
+		PackWriter& operator=(const PackWriter&);
+};
+
+#endif //PACKFILE_H
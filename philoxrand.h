@@ -0,0 +1,122 @@
+#ifndef PHILOXRAND_H
+#define PHILOXRAND_H
+
+#include <stddef.h>
+
+/* A counter-based random number generator (Philox4x32-10, from Salmon et al., "Parallel Random Numbers: As Easy as
+   1, 2, 3"). Each block of four numbers is a keyed hash of a 128 bit counter, so any position of any stream can be
+   reached in constant time, with nothing carried over from the numbers before it.
+   The key is the seed. The counter is made of the position in the stream and three numbers that pick the stream,
+   such as a piece, a bar and what the numbers are used for. Streams with different numbers never overlap, and
+   each one is 2^34 numbers long. */
+class PhiloxRand
+{
+	public:
+		typedef unsigned int uint32;
+
+	private:
+		uint32 key[2];
+		//The counter of the next block: the block's index in the stream, then the three numbers that pick the stream.
+		uint32 counter[4];
+		//The block being handed out and the number of its values left.
+		uint32 block[4];
+		int left;
+
+		//Multiply two 32 bit numbers, giving the high and low words of the result.
+		static void multiply(uint32 a, uint32 b, uint32& high, uint32& low)
+		{
+			unsigned long long product = (unsigned long long)a * b;
+			high = (uint32)(product >> 32);
+			low = (uint32)product;
+		}
+
+		//Hash the counter into the next block, then move the counter on.
+		void nextBlock()
+		{
+			uint32 c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+			uint32 k0 = key[0], k1 = key[1];
+			for(int round = 0; round < 10; round++)
+			{
+				uint32 high0, low0, high1, low1;
+				multiply(0xD2511F53U, c0, high0, low0);
+				multiply(0xCD9E8D57U, c2, high1, low1);
+				c0 = high1 ^ c1 ^ k0;
+				c1 = low1;
+				c2 = high0 ^ c3 ^ k1;
+				c3 = low0;
+				k0 += 0x9E3779B9U;
+				k1 += 0xBB67AE85U;
+			}
+			block[0] = c0;
+			block[1] = c1;
+			block[2] = c2;
+			block[3] = c3;
+			counter[0]++;
+			left = 4;
+		}
+
+	public:
+		//Create a generator for the stream picked by a, b and c.
+		PhiloxRand(uint32 seed, uint32 a = 0, uint32 b = 0, uint32 c = 0)
+		{
+			key[0] = seed;
+			key[1] = 0;
+			setStream(a, b, c);
+		}
+
+		//Move to the start of the stream picked by a, b and c.
+		void setStream(uint32 a, uint32 b, uint32 c = 0)
+		{
+			counter[0] = 0;
+			counter[1] = a;
+			counter[2] = b;
+			counter[3] = c;
+			left = 0;
+		}
+
+		//Get an integer in [0, 2^32 - 1].
+		uint32 randInt()
+		{
+			if(left == 0)
+				nextBlock();
+			return block[4 - left--];
+		}
+		//Get an integer in [0, n], drawing in the same way as MTRand.
+		uint32 randInt(uint32 n)
+		{
+			uint32 used = n;
+			used |= used >> 1;
+			used |= used >> 2;
+			used |= used >> 4;
+			used |= used >> 8;
+			used |= used >> 16;
+
+			uint32 i;
+			do
+				i = randInt() & used;
+			while(i > n);
+			return i;
+		}
+
+		//Fill an array with integers in [0, 2^32 - 1], the same numbers randInt() would give.
+		void fill(uint32* values, size_t count)
+		{
+			size_t i = 0;
+			//Use up what is left of the current block, then hash whole blocks straight into the array.
+			for(; i < count && left > 0; i++)
+				values[i] = block[4 - left--];
+			for(; i + 4 <= count; i += 4)
+			{
+				nextBlock();
+				values[i] = block[0];
+				values[i + 1] = block[1];
+				values[i + 2] = block[2];
+				values[i + 3] = block[3];
+				left = 0;
+			}
+			for(; i < count; i++)
+				values[i] = randInt();
+		}
+};
+
+#endif //PHILOXRAND_H
@@ -0,0 +1,252 @@
+#include "piececache.h"
+#include "hash.h"
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+using namespace std;
+
+/* Change this whenever a change to the generator changes the pieces it makes, so files cached by an older
+   version are never used. */
+static const unsigned int PIECECACHE_VERSION = 1;
+
+//The bytes stored in front of each cached file: a signature, the version, the key and the length of the file.
+static const char PIECECACHE_SIGNATURE[4] = { 'A', 'C', 'P', 'C' };
+static const int PIECECACHE_HEADER_LENGTH = 40;
+
+//Temporary files older than this were left by a process that died while writing, and are removed.
+static const int PIECECACHE_TEMPORARY_SECONDS = 3600;
+
+unsigned long long hashPieceKey(const PieceKey& key)
+{
+	unsigned long long hash = hashValue(HASH_START, PIECECACHE_VERSION);
+	hash = hashValue(hash, key.styleHash);
+	hash = hashValue(hash, key.seed);
+	hash = hashValue(hash, key.piece);
+	hash = hashValue(hash, key.noOfBars);
+	hash = hashValue(hash, (unsigned char)key.compact);
+	return hashValue(hash, key.rng);
+}
+
+static bool sameKey(const PieceKey& a, const PieceKey& b)
+{
+	return a.styleHash == b.styleHash && a.seed == b.seed && a.piece == b.piece && a.noOfBars == b.noOfBars
+		&& a.compact == b.compact && a.rng == b.rng;
+}
+
+//Write the header for a cached file.
+static void writeHeader(unsigned char* header, const PieceKey& key, unsigned int length)
+{
+	memcpy(header, PIECECACHE_SIGNATURE, 4);
+	memcpy(header + 4, &PIECECACHE_VERSION, 4);
+	memcpy(header + 8, &key.styleHash, 8);
+	memcpy(header + 16, &key.seed, 4);
+	memcpy(header + 20, &key.piece, 4);
+	memcpy(header + 24, &key.noOfBars, 4);
+	memcpy(header + 28, &key.rng, 4);
+	header[32] = key.compact;
+	header[33] = header[34] = header[35] = 0;
+	memcpy(header + 36, &length, 4);
+}
+
+PieceCache::PieceCache(const char* directory, size_t memoryLimit, size_t diskLimit)
+	: directory(directory), memoryLimit(memoryLimit ? memoryLimit : PIECECACHE_MEMORY_BYTES),
+	diskLimit(diskLimit ? diskLimit : PIECECACHE_DISK_BYTES), memoryBytes(0), diskBytes(0)
+{
+	mkdir(directory, 0777);
+	trimDisk();
+}
+
+bool PieceCache::isUsable() const
+{
+	struct stat info;
+	if(stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || access(directory.c_str(), R_OK | W_OK | X_OK) != 0)
+	{
+		std::cout << "ERROR: Could not use " << directory << " as a cache directory." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+string PieceCache::fileName(unsigned long long hash) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.piece", hash);
+	return directory + name;
+}
+
+void PieceCache::remember(unsigned long long hash, const PieceKey& key, const vector<unsigned char>& file)
+{
+	//Files bigger than the whole cache are not kept in memory.
+	if(file.size() > memoryLimit)
+		return;
+
+	unordered_map<unsigned long long, list<MemoryEntry>::iterator>::iterator found = memoryIndex.find(hash);
+	if(found != memoryIndex.end())
+	{
+		memoryBytes -= found->second->file.size();
+		recent.erase(found->second);
+		memoryIndex.erase(found);
+	}
+
+	MemoryEntry entry = { hash, key, file };
+	recent.push_front(entry);
+	memoryIndex[hash] = recent.begin();
+	memoryBytes += file.size();
+
+	while(memoryBytes > memoryLimit)
+	{
+		memoryBytes -= recent.back().file.size();
+		memoryIndex.erase(recent.back().hash);
+		recent.pop_back();
+	}
+}
+
+bool PieceCache::get(const PieceKey& key, vector<unsigned char>& file)
+{
+	unsigned long long hash = hashPieceKey(key);
+	{
+		lock_guard<mutex> guard(lock);
+		unordered_map<unsigned long long, list<MemoryEntry>::iterator>::iterator found = memoryIndex.find(hash);
+		if(found != memoryIndex.end() && sameKey(found->second->key, key))
+		{
+			//Move it to the front, as the most recently used.
+			recent.splice(recent.begin(), recent, found->second);
+			file = found->second->file;
+			return true;
+		}
+	}
+
+	//Otherwise look on disk, where another process may have put it.
+	string name = fileName(hash);
+	int descriptor = open(name.c_str(), O_RDONLY);
+	if(descriptor < 0)
+		return false;
+
+	unsigned char header[PIECECACHE_HEADER_LENGTH];
+	unsigned char expected[PIECECACHE_HEADER_LENGTH];
+	struct stat info;
+	bool ok = fstat(descriptor, &info) == 0 && info.st_size >= PIECECACHE_HEADER_LENGTH
+		&& read(descriptor, header, PIECECACHE_HEADER_LENGTH) == PIECECACHE_HEADER_LENGTH;
+	unsigned int length = info.st_size - PIECECACHE_HEADER_LENGTH;
+	writeHeader(expected, key, length);
+	ok = ok && memcmp(header, expected, PIECECACHE_HEADER_LENGTH) == 0;
+	if(ok)
+	{
+		file.resize(length);
+		size_t done = 0;
+		while(done < length)
+		{
+			ssize_t got = read(descriptor, &file[done], length - done);
+			if(got <= 0)
+				break;
+			done += got;
+		}
+		ok = done == length;
+	}
+	close(descriptor);
+	if(!ok)
+		return false;
+
+	//Mark the file as used, so it is kept over files that have not been.
+	utimensat(AT_FDCWD, name.c_str(), NULL, 0);
+
+	lock_guard<mutex> guard(lock);
+	remember(hash, key, file);
+	return true;
+}
+
+void PieceCache::put(const PieceKey& key, const vector<unsigned char>& file)
+{
+	unsigned long long hash = hashPieceKey(key);
+
+	//Write to a name no other thread or process is using, then rename it into place in one step.
+	static atomic<unsigned int> counter(0);
+	char temporary[64];
+	snprintf(temporary, sizeof(temporary), "/tmp.%d.%u", (int)getpid(), counter++);
+	string temporaryName = directory + temporary;
+
+	unsigned char header[PIECECACHE_HEADER_LENGTH];
+	writeHeader(header, key, file.size());
+	FILE* output = fopen(temporaryName.c_str(), "wb");
+	bool ok = output && fwrite(header, 1, sizeof(header), output) == sizeof(header)
+		&& (file.empty() || fwrite(&file[0], 1, file.size(), output) == file.size());
+	if(output && fclose(output) != 0)
+		ok = false;
+	if(!ok || rename(temporaryName.c_str(), fileName(hash).c_str()) != 0)
+	{
+		unlink(temporaryName.c_str());
+		ok = false;
+	}
+
+	lock_guard<mutex> guard(lock);
+	remember(hash, key, file);
+	if(ok)
+	{
+		diskBytes += sizeof(header) + file.size();
+		if(diskBytes > diskLimit)
+			trimDisk();
+	}
+}
+
+//A file in the cache directory, for trimming.
+struct CacheFile
+{
+	time_t used;
+	size_t size;
+	string name;
+
+	bool operator<(const CacheFile& other) const
+	{
+		return used < other.used;
+	}
+};
+
+void PieceCache::trimDisk()
+{
+	DIR* dir = opendir(directory.c_str());
+	if(!dir)
+		return;
+
+	vector<CacheFile> files;
+	size_t total = 0;
+	time_t now = time(NULL);
+	while(struct dirent* entry = readdir(dir))
+	{
+		string name = directory + "/" + entry->d_name;
+		bool piece = strstr(entry->d_name, ".piece") != NULL;
+		bool temporary = strncmp(entry->d_name, "tmp.", 4) == 0;
+		struct stat info;
+		if((!piece && !temporary) || stat(name.c_str(), &info) != 0)
+			continue;
+
+		if(temporary)
+		{
+			if(now - info.st_mtime > PIECECACHE_TEMPORARY_SECONDS)
+				unlink(name.c_str());
+			continue;
+		}
+		CacheFile file = { info.st_mtime, (size_t)info.st_size, name };
+		files.push_back(file);
+		total += info.st_size;
+	}
+	closedir(dir);
+
+	//Remove the files used longest ago until there is room to grow again.
+	if(total > diskLimit)
+	{
+		sort(files.begin(), files.end());
+		for(int i = 0; i < files.size() && total > diskLimit / 4 * 3; i++)
+		{
+			if(unlink(files[i].name.c_str()) == 0)
+				total -= files[i].size;
+		}
+	}
+	diskBytes = total;
+}
@@ -0,0 +1,75 @@
+#ifndef PIECECACHE_H
+#define PIECECACHE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+//Everything that decides the bytes of a generated piece.
+struct PieceKey
+{
+	unsigned long long styleHash; //Style::hash() of the style the piece is generated from.
+	unsigned int seed; //The base seed of the batch.
+	unsigned int piece; //The piece's index in the batch.
+	int noOfBars;
+	bool compact;
+	int rng; //The GeneratorRng the piece draws from.
+};
+
+//The default bounds on the memory and disk space a cache uses.
+const size_t PIECECACHE_MEMORY_BYTES = 64 << 20;
+const size_t PIECECACHE_DISK_BYTES = 1024 << 20;
+
+/* A cache of generated MIDI files, kept in a directory that any number of processes can share.
+   Each file is stored under a hash of its key, with the key itself stored in front of the bytes so a collision
+   is seen as a miss. The files used most recently are also kept in memory.
+   A file is written to a temporary name and renamed into place, so no reader ever sees part of one. When the
+   directory grows past its bound, the files used longest ago are removed; hits update a file's time for this.
+   A cache can be shared between threads. */
+class PieceCache
+{
+	struct MemoryEntry
+	{
+		unsigned long long hash;
+		PieceKey key;
+		std::vector<unsigned char> file;
+	};
+
+	std::string directory;
+	size_t memoryLimit;
+	size_t diskLimit;
+
+	//The files in memory, most recently used first, and where each hash is in the list.
+	std::list<MemoryEntry> recent;
+	std::unordered_map<unsigned long long, std::list<MemoryEntry>::iterator> memoryIndex;
+	size_t memoryBytes;
+	//The bytes in the directory, as of the last scan plus what has been written since.
+	size_t diskBytes;
+	std::mutex lock;
+
+	//Get the name of the file a hash is stored in.
+	std::string fileName(unsigned long long hash) const;
+	//Add a file to the front of the memory cache, dropping the least recently used files until it fits.
+	void remember(unsigned long long hash, const PieceKey& key, const std::vector<unsigned char>& file);
+	//Add up the files in the directory, removing the oldest if they are over the bound.
+	void trimDisk();
+
+	public:
+		//Use the directory, which is created if it does not exist. Bounds of 0 use the defaults.
+		PieceCache(const char* directory, size_t memoryLimit = 0, size_t diskLimit = 0);
+
+		//Check the directory can be used. Returns false, after printing why, if it can not.
+		bool isUsable() const;
+		//Look up a piece. Returns true and fills in the file if it is cached.
+		bool get(const PieceKey& key, std::vector<unsigned char>& file);
+		//Add a piece.
+		void put(const PieceKey& key, const std::vector<unsigned char>& file);
+};
+
+//Get the hash a key is stored under.
+unsigned long long hashPieceKey(const PieceKey& key);
+
+#endif //PIECECACHE_H
@@ -0,0 +1,339 @@
+#include "rhythmtable.h"
+#include "hash.h"
+#include <iostream>
+#include <math.h>
+#include <string.h>
+using namespace std;
+
+RhythmTable::RhythmTable() : barTicks(0), builtRhythmStart(1, 0)
+{
+	useBuiltArrays();
+}
+
+RhythmTable::RhythmTable(const RhythmTable& other)
+{
+	*this = other;
+}
+
+RhythmTable& RhythmTable::operator=(const RhythmTable& other)
+{
+	barTicks = other.barTicks;
+	builtRhythmStart = other.builtRhythmStart;
+	builtNoteDurations = other.builtNoteDurations;
+	builtEntries = other.builtEntries;
+	if(other.rhythmStart == &other.builtRhythmStart[0])
+		useBuiltArrays();
+	else
+	{
+		rhythmStart = other.rhythmStart;
+		noteDurations = other.noteDurations;
+		entries = other.entries;
+		noOfRhythms = other.noOfRhythms;
+	}
+	return *this;
+}
+
+void RhythmTable::useBuiltArrays()
+{
+	rhythmStart = &builtRhythmStart[0];
+	noteDurations = builtNoteDurations.empty() ? NULL : &builtNoteDurations[0];
+	entries = builtEntries.empty() ? NULL : &builtEntries[0];
+	noOfRhythms = builtEntries.size();
+}
+
+bool RhythmTable::listRhythms(int barTicks, const int* durationTicks, int noOfDurations)
+{
+	if(barTicks <= 0 || noOfDurations <= 0)
+	{
+		std::cout << "ERROR: Invalid bar length or number of note durations." << std::endl;
+		return false;
+	}
+	for(int i = 0; i < noOfDurations; i++)
+	{
+		if(durationTicks[i] <= 0)
+		{
+			std::cout << "ERROR: Note duration " << i << " is not a positive number of ticks." << std::endl;
+			return false;
+		}
+		for(int j = 0; j < i; j++)
+		{
+			if(durationTicks[j] == durationTicks[i])
+			{
+				std::cout << "ERROR: Note durations " << j << " and " << i << " are the same." << std::endl;
+				return false;
+			}
+		}
+	}
+
+	builtRhythmStart.assign(1, 0);
+	builtNoteDurations.clear();
+
+	/* Walk the rhythms depth first. chosen holds the index of the duration used for each note so far,
+	   and the next duration to try for the last note is chosen.back() + 1 when the walk backs up. */
+	vector<int> chosen;
+	int lengthLeft = barTicks;
+	int next = 0;
+	while(true)
+	{
+		if(lengthLeft == 0)
+		{
+			//The bar is full, so the notes so far are a rhythm.
+			if(builtRhythmStart.size() > RHYTHMTABLE_MAX_RHYTHMS)
+			{
+				std::cout << "ERROR: There are more than " << RHYTHMTABLE_MAX_RHYTHMS << " ways to fill the bar." << std::endl;
+				return false;
+			}
+			for(int i = 0; i < chosen.size(); i++)
+				builtNoteDurations.push_back(durationTicks[chosen[i]]);
+			builtRhythmStart.push_back(builtNoteDurations.size());
+		}
+		else
+		{
+			//Find the next duration that fits in what is left of the bar.
+			while(next < noOfDurations && durationTicks[next] > lengthLeft)
+				next++;
+			if(next < noOfDurations)
+			{
+				chosen.push_back(next);
+				lengthLeft -= durationTicks[next];
+				next = 0;
+				continue;
+			}
+		}
+
+		//Nothing more can follow these notes, so back up to the last note and try its next duration.
+		if(chosen.empty())
+			break;
+		next = chosen.back() + 1;
+		lengthLeft += durationTicks[chosen.back()];
+		chosen.pop_back();
+	}
+
+	if(builtRhythmStart.size() == 1)
+	{
+		std::cout << "ERROR: The note durations can not fill a bar of " << barTicks << " ticks." << std::endl;
+		return false;
+	}
+
+	this->barTicks = barTicks;
+	return true;
+}
+
+bool RhythmTable::buildAliases(vector<double>& weights)
+{
+	int count = weights.size();
+	double sum = 0;
+	for(int i = 0; i < count; i++)
+		sum += weights[i];
+	if(!(sum > 0))
+	{
+		std::cout << "ERROR: No rhythm has any weight." << std::endl;
+		return false;
+	}
+
+	//Scale the weights so the average rhythm has a weight of 1, and split them into small and large ones.
+	vector<Entry> newEntries(count);
+	vector<int> small, large;
+	for(int i = 0; i < count; i++)
+	{
+		weights[i] = weights[i] / sum * count;
+		if(weights[i] < 1)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+
+	//Vose's alias method, as used by TransitionTable.
+	while(!small.empty() && !large.empty())
+	{
+		int less = small.back();
+		int more = large.back();
+		small.pop_back();
+
+		newEntries[less].threshold = (unsigned int)(weights[less] * 4294967296.0);
+		newEntries[less].alias = more;
+
+		weights[more] -= 1 - weights[less];
+		if(weights[more] < 1)
+		{
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	//Whatever is left over is full (up to rounding), so it always keeps its own rhythm.
+	for(int i = 0; i < large.size(); i++)
+	{
+		newEntries[large[i]].threshold = 0xffffffffUL;
+		newEntries[large[i]].alias = large[i];
+	}
+	for(int i = 0; i < small.size(); i++)
+	{
+		newEntries[small[i]].threshold = 0xffffffffUL;
+		newEntries[small[i]].alias = small[i];
+	}
+
+	builtEntries.swap(newEntries);
+	useBuiltArrays();
+	return true;
+}
+
+bool RhythmTable::build(int barTicks, const int* durationTicks, const float* durationWeights, int noOfDurations)
+{
+	for(int i = 0; i < noOfDurations; i++)
+	{
+		if(!(durationWeights[i] >= 0) || isinf(durationWeights[i]))
+		{
+			std::cout << "ERROR: Note duration " << i << " has an invalid weight." << std::endl;
+			return false;
+		}
+	}
+
+	//Build into a new table, so this one is left as it was if anything fails.
+	RhythmTable table;
+	if(!table.listRhythms(barTicks, durationTicks, noOfDurations))
+		return false;
+
+	//Weight each rhythm by the chance of drawing each of its notes from the durations that fit in the rest of the bar.
+	int noOfRhythms = table.builtRhythmStart.size() - 1;
+	vector<double> weights(noOfRhythms);
+	for(int rhythm = 0; rhythm < noOfRhythms; rhythm++)
+	{
+		double weight = 1;
+		int lengthLeft = barTicks;
+		for(int note = table.builtRhythmStart[rhythm]; note < table.builtRhythmStart[rhythm + 1] && weight > 0; note++)
+		{
+			double fitting = 0, chosen = 0;
+			for(int i = 0; i < noOfDurations; i++)
+			{
+				if(durationTicks[i] <= lengthLeft)
+					fitting += durationWeights[i];
+				if(durationTicks[i] == table.builtNoteDurations[note])
+					chosen = durationWeights[i];
+			}
+			weight = fitting > 0 ? weight * chosen / fitting : 0;
+			lengthLeft -= table.builtNoteDurations[note];
+		}
+		weights[rhythm] = weight;
+	}
+
+	if(!table.buildAliases(weights))
+		return false;
+	*this = table;
+	return true;
+}
+
+bool RhythmTable::build(int barTicks, const int* durationTicks, int noOfDurations, const vector<float>& rhythmWeights)
+{
+	RhythmTable table;
+	if(!table.listRhythms(barTicks, durationTicks, noOfDurations))
+		return false;
+
+	int noOfRhythms = table.builtRhythmStart.size() - 1;
+	if(rhythmWeights.size() != noOfRhythms)
+	{
+		std::cout << "ERROR: There are " << rhythmWeights.size() << " rhythm weights for " << noOfRhythms << " rhythms." << std::endl;
+		return false;
+	}
+
+	vector<double> weights(noOfRhythms);
+	for(int i = 0; i < noOfRhythms; i++)
+	{
+		if(!(rhythmWeights[i] >= 0) || isinf(rhythmWeights[i]))
+		{
+			std::cout << "ERROR: Rhythm " << i << " has an invalid weight." << std::endl;
+			return false;
+		}
+		weights[i] = rhythmWeights[i];
+	}
+
+	if(!table.buildAliases(weights))
+		return false;
+	*this = table;
+	return true;
+}
+
+unsigned long long RhythmTable::hash(unsigned long long hash) const
+{
+	hash = hashValue(hash, barTicks);
+	for(int i = 0; i <= noOfRhythms; i++)
+		hash = hashValue(hash, rhythmStart[i]);
+	for(int i = 0; i < rhythmStart[noOfRhythms]; i++)
+		hash = hashValue(hash, noteDurations[i]);
+	for(int i = 0; i < noOfRhythms; i++)
+	{
+		hash = hashValue(hash, (unsigned long long)entries[i].threshold);
+		hash = hashValue(hash, entries[i].alias);
+	}
+	return hash;
+}
+
+/* The layout written by write(), all in 4 byte words:
+       barTicks, the number of rhythms, the number of note durations, rhythmStart[rhythms + 1], noteDurations,
+   then each entry's threshold and alias. */
+static const int RHYTHMTABLE_HEADER_WORDS = 3;
+
+void RhythmTable::write(vector<unsigned char>& buffer) const
+{
+	static_assert(sizeof(Entry) == 8, "RhythmTable::Entry must be two 4 byte words");
+	int header[RHYTHMTABLE_HEADER_WORDS] = { barTicks, noOfRhythms, rhythmStart[noOfRhythms] };
+	const unsigned char* parts[4] = { (const unsigned char*)header, (const unsigned char*)rhythmStart,
+		(const unsigned char*)noteDurations, (const unsigned char*)entries };
+	size_t lengths[4] = { sizeof(header), (noOfRhythms + 1) * sizeof(int), header[2] * sizeof(int), noOfRhythms * sizeof(Entry) };
+	for(int i = 0; i < 4; i++)
+		buffer.insert(buffer.end(), parts[i], parts[i] + lengths[i]);
+}
+
+bool RhythmTable::attach(const unsigned char* data, size_t length)
+{
+	int header[RHYTHMTABLE_HEADER_WORDS];
+	if(length < sizeof(header))
+	{
+		std::cout << "ERROR: The rhythm table is cut short." << std::endl;
+		return false;
+	}
+	memcpy(header, data, sizeof(header));
+	int ticks = header[0], rhythms = header[1], notes = header[2];
+	if(ticks <= 0 || rhythms <= 0 || rhythms > RHYTHMTABLE_MAX_RHYTHMS || notes < rhythms
+		|| length != sizeof(header) + (rhythms + 1 + (size_t)notes) * sizeof(int) + rhythms * sizeof(Entry))
+	{
+		std::cout << "ERROR: The rhythm table has an invalid size." << std::endl;
+		return false;
+	}
+
+	//Check every rhythm fills the bar and every alias is a rhythm, so a damaged table can never index outside itself.
+	const int* newRhythmStart = (const int*)(data + sizeof(header));
+	const int* newNoteDurations = newRhythmStart + rhythms + 1;
+	const Entry* newEntries = (const Entry*)(newNoteDurations + notes);
+	if(newRhythmStart[0] != 0 || newRhythmStart[rhythms] != notes)
+	{
+		std::cout << "ERROR: The rhythms do not cover the rhythm table's notes." << std::endl;
+		return false;
+	}
+	for(int rhythm = 0; rhythm < rhythms; rhythm++)
+	{
+		int lengthLeft = ticks;
+		bool valid = newRhythmStart[rhythm + 1] > newRhythmStart[rhythm] && newRhythmStart[rhythm + 1] <= notes
+			&& newEntries[rhythm].alias >= 0 && newEntries[rhythm].alias < rhythms;
+		for(int note = newRhythmStart[rhythm]; valid && note < newRhythmStart[rhythm + 1]; note++)
+		{
+			valid = newNoteDurations[note] > 0 && newNoteDurations[note] <= lengthLeft;
+			lengthLeft -= newNoteDurations[note];
+		}
+		if(!valid || lengthLeft != 0)
+		{
+			std::cout << "ERROR: Rhythm " << rhythm << " does not fill the bar." << std::endl;
+			return false;
+		}
+	}
+
+	barTicks = ticks;
+	builtRhythmStart.assign(1, 0);
+	builtNoteDurations.clear();
+	builtEntries.clear();
+	rhythmStart = newRhythmStart;
+	noteDurations = newNoteDurations;
+	entries = newEntries;
+	noOfRhythms = rhythms;
+	return true;
+}
@@ -0,0 +1,106 @@
+#ifndef RHYTHMTABLE_H
+#define RHYTHMTABLE_H
+
+#include <vector>
+#include "include/MersenneTwister.h"
+using namespace std;
+
+//The most rhythms a table will list. Short notes in a long bar can fill it in far too many ways to list.
+const int RHYTHMTABLE_MAX_RHYTHMS = 1 << 16;
+
+/* Every way of filling a bar with notes from a set of durations, listed up front and compiled for sampling.
+   A rhythm is the list of note durations that fill the bar, in order. The rhythms are stored one after
+   the other in a single array, and chosen with a Vose alias table over all of them, so a whole bar's
+   rhythm costs one random number and nothing is allocated while generating.
+   Any bar length (and so any time signature) and any set of durations can be used, as long as the number
+   of rhythms stays below RHYTHMTABLE_MAX_RHYTHMS.
+   Like TransitionTable, a built table can be written out with write() and used in place with attach(). */
+class RhythmTable
+{
+	//One entry of the alias table. Entry i belongs to rhythm i.
+	struct Entry
+	{
+		//Rhythm i is kept when the low 32 bits of the scaled random number are below the threshold, otherwise the alias is used.
+		unsigned int threshold;
+		int alias;
+	};
+
+	//The length of the bar in ticks.
+	int barTicks;
+	//Where each rhythm's durations start. Has one more element than there are rhythms.
+	const int* rhythmStart;
+	//The note durations of every rhythm, one rhythm after the other.
+	const int* noteDurations;
+	//The alias table.
+	const Entry* entries;
+	int noOfRhythms;
+
+	//The arrays rhythmStart, noteDurations and entries point at for a built table. An attached table leaves them empty.
+	vector<int> builtRhythmStart;
+	vector<int> builtNoteDurations;
+	vector<Entry> builtEntries;
+
+	//Point rhythmStart, noteDurations and entries at the built arrays.
+	void useBuiltArrays();
+	//List every rhythm into builtRhythmStart and builtNoteDurations, in order of the index of each duration. Returns false if there are too many.
+	bool listRhythms(int barTicks, const int* durationTicks, int noOfDurations);
+	//Build the alias table from a weight for each listed rhythm. Returns false if no rhythm has any weight.
+	bool buildAliases(vector<double>& weights);
+
+	public:
+		RhythmTable(); //Class constructor. The table is empty until it is built.
+		RhythmTable(const RhythmTable& other); //Copy constructor. A copy of an attached table uses the same memory.
+		RhythmTable& operator=(const RhythmTable& other);
+		/* Build the table from a weight for each duration. A rhythm is weighted by how likely it is when
+		   each note's duration is drawn by weight from the durations that still fit in the bar.
+		   Returns false if the durations can not fill the bar. */
+		bool build(int barTicks, const int* durationTicks, const float* durationWeights, int noOfDurations);
+		/* Build the table from a weight for each rhythm, in the order getRhythm() lists them after a build
+		   with the same bar length and durations. Returns false if the weights are invalid or the wrong number. */
+		bool build(int barTicks, const int* durationTicks, int noOfDurations, const vector<float>& rhythmWeights);
+
+		//Get the length of the bar in ticks.
+		int getBarTicks() const
+		{
+			return barTicks;
+		}
+		//Get the number of rhythms in the table.
+		int getNoOfRhythms() const
+		{
+			return noOfRhythms;
+		}
+		//Add the contents of the built table to a hash (see hash.h).
+		unsigned long long hash(unsigned long long hash) const;
+
+		//Add the built table to the end of a buffer, in the layout attach() reads. Its length is a multiple of 4 bytes.
+		void write(vector<unsigned char>& buffer) const;
+		/* Use a table written by write() where it is, without copying it. The data must be 4 byte aligned and
+		   stay valid for as long as the table and any copies of it are used.
+		   Returns false, leaving this table as it was, if the data is not a valid table. */
+		bool attach(const unsigned char* data, size_t length);
+		//Get the note durations of a rhythm. Returns the number of notes.
+		int getRhythm(int rhythm, const int*& durations) const
+		{
+			durations = &noteDurations[rhythmStart[rhythm]];
+			return rhythmStart[rhythm + 1] - rhythmStart[rhythm];
+		}
+
+		//Choose a rhythm, pointing durations at its note durations. Returns the number of notes.
+		int choose(MTRand& mtrand, const int*& durations) const
+		{
+			return choose(mtrand.randInt(), durations);
+		}
+		//Choose a rhythm using a 32 bit random number that has already been drawn.
+		int choose(MTRand::uint32 random, const int*& durations) const
+		{
+			//Scale the random number by the number of rhythms. The high word picks the entry and the
+			//low word is compared against the entry's threshold.
+			unsigned long long scaled = (unsigned long long)(random & 0xffffffffUL) * noOfRhythms;
+			int rhythm = (int)(scaled >> 32);
+			if((scaled & 0xffffffffULL) >= entries[rhythm].threshold)
+				rhythm = entries[rhythm].alias;
+			return getRhythm(rhythm, durations);
+		}
+};
+
+#endif //RHYTHMTABLE_H
@@ -0,0 +1,264 @@
+#include "runner.h"
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+//Get a monotonic time in seconds.
+static double nowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+bool readManifest(const char* filename, vector<ManifestJob>& jobs)
+{
+	ifstream is(filename);
+	if(!is)
+	{
+		std::cout << "ERROR: Could not open " << filename << "." << std::endl;
+		return false;
+	}
+
+	string line;
+	for(int lineNumber = 1; getline(is, line); lineNumber++)
+	{
+		istringstream fields(line);
+		ManifestJob job;
+		if(!(fields >> job.styleName) || job.styleName[0] == '#')
+			continue;
+
+		fields >> job.noOfBars >> job.seed >> ws;
+		getline(fields, job.midiName);
+		while(!job.midiName.empty() && (job.midiName.back() == '\r' || job.midiName.back() == ' '))
+			job.midiName.pop_back();
+		if(!fields.eof() || job.midiName.empty() || job.noOfBars < 1)
+		{
+			std::cout << "ERROR: Line " << lineNumber << " of " << filename
+				<< " is not <style> <bars> <seed> <output file>." << std::endl;
+			return false;
+		}
+		job.style = -1;
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+//A generated piece waiting to be written.
+struct QueuedPiece
+{
+	int job;
+	vector<unsigned char> file;
+};
+
+/* The queue between the generators and the writer, bounded by the bytes and the number of pieces in it.
+   Buffers the writer has finished with are kept and handed back to the generators, so the steady state
+   allocates nothing. */
+class PieceQueue
+{
+	deque<QueuedPiece> pieces;
+	vector<vector<unsigned char> > spareBuffers;
+	size_t bytes;
+	size_t maxBytes;
+	//The number of generators that have not finished, so the writer knows when nothing more is coming.
+	int producers;
+	mutex lock;
+	condition_variable notFull;
+	condition_variable notEmpty;
+
+	public:
+		//How full the queue has been, and how long each side has spent waiting for the other.
+		unsigned long long pushes;
+		unsigned long long piecesSum;
+		size_t mostPieces;
+		size_t mostBytes;
+		double producerWait;
+		double consumerWait;
+
+		PieceQueue(size_t maxBytes, int producers) : bytes(0), maxBytes(maxBytes), producers(producers), pushes(0),
+			piecesSum(0), mostPieces(0), mostBytes(0), producerWait(0), consumerWait(0)
+		{
+		}
+
+		/* Add a piece, swapping the file out of the caller's buffer and giving it a spare one in its place.
+		   Waits while the queue is full. A piece bigger than the whole queue is let in once the queue is empty. */
+		void push(int job, vector<unsigned char>& file)
+		{
+			unique_lock<mutex> guard(lock);
+			if(!(pieces.empty() || (bytes + file.size() <= maxBytes && pieces.size() < RUNNER_QUEUE_PIECES)))
+			{
+				double start = nowSeconds();
+				while(!(pieces.empty() || (bytes + file.size() <= maxBytes && pieces.size() < RUNNER_QUEUE_PIECES)))
+					notFull.wait(guard);
+				producerWait += nowSeconds() - start;
+			}
+
+			pieces.push_back(QueuedPiece());
+			pieces.back().job = job;
+			pieces.back().file.swap(file);
+			bytes += pieces.back().file.size();
+			if(!spareBuffers.empty())
+			{
+				file.swap(spareBuffers.back());
+				spareBuffers.pop_back();
+			}
+
+			pushes++;
+			piecesSum += pieces.size();
+			if(pieces.size() > mostPieces)
+				mostPieces = pieces.size();
+			if(bytes > mostBytes)
+				mostBytes = bytes;
+			notEmpty.notify_one();
+		}
+
+		//Take the oldest piece. Waits while the queue is empty. Returns false once it is empty and every generator has finished.
+		bool pop(QueuedPiece& piece)
+		{
+			unique_lock<mutex> guard(lock);
+			if(pieces.empty() && producers > 0)
+			{
+				double start = nowSeconds();
+				while(pieces.empty() && producers > 0)
+					notEmpty.wait(guard);
+				consumerWait += nowSeconds() - start;
+			}
+			if(pieces.empty())
+				return false;
+
+			piece.job = pieces.front().job;
+			piece.file.swap(pieces.front().file);
+			pieces.pop_front();
+			bytes -= piece.file.size();
+			notFull.notify_all();
+			return true;
+		}
+
+		//Give back a buffer the writer has finished with, so a generator can reuse it.
+		void recycle(vector<unsigned char>& file)
+		{
+			lock_guard<mutex> guard(lock);
+			file.clear();
+			spareBuffers.push_back(vector<unsigned char>());
+			spareBuffers.back().swap(file);
+		}
+
+		//Called by each generator when it has no more jobs.
+		void finishProducing()
+		{
+			lock_guard<mutex> guard(lock);
+			producers--;
+			notEmpty.notify_all();
+		}
+
+		//Get what is in the queue now.
+		void occupancy(size_t& noOfPieces, size_t& noOfBytes)
+		{
+			lock_guard<mutex> guard(lock);
+			noOfPieces = pieces.size();
+			noOfBytes = bytes;
+		}
+};
+
+//Generate jobs until there are none left, passing each piece to the queue. Run by each of the generator threads.
+static void runnerGenerator(const vector<ManifestJob>* jobs, const vector<const Style*>* styles,
+	const vector<unsigned long long>* styleHashes, bool compact, GeneratorRng rng, PieceCache* cache,
+	PieceQueue* queue, atomic<int>* nextJob)
+{
+	MTRandSIMD mtrand(0U, rng == GENERATOR_RNG_SFMT ? MTRANDSIMD_SFMT : MTRANDSIMD_MT19937);
+	MidiFile midi;
+	vector<unsigned char> buffer;
+
+	for(int job = (*nextJob)++; job < jobs->size(); job = (*nextJob)++)
+	{
+		const ManifestJob& details = (*jobs)[job];
+		PieceKey key = { (*styleHashes)[details.style], (unsigned int)details.seed, 0, details.noOfBars, compact, rng };
+		if(cache && cache->get(key, buffer))
+			statsCount(STATS_CACHE_HITS);
+		else
+		{
+			generateBatchPiece(midi, buffer, details.noOfBars, *(*styles)[details.style], mtrand, details.seed, 0,
+				compact, rng);
+			if(cache)
+				cache->put(key, buffer);
+		}
+		queue->push(job, buffer);
+	}
+
+	queue->finishProducing();
+	statsFlush();
+}
+
+bool runManifest(const vector<ManifestJob>& jobs, const vector<const Style*>& styles, int noOfThreads,
+	bool compact, GeneratorRng rng, PieceCache* cache, size_t queueBytes, FileWriterBackend output, int outputDepth,
+	PackWriter* pack)
+{
+	if(noOfThreads < 1)
+		noOfThreads = 1;
+	if(queueBytes == 0)
+		queueBytes = RUNNER_QUEUE_BYTES;
+
+	//The hashes are only needed to key the cache.
+	vector<unsigned long long> styleHashes(styles.size(), 0);
+	for(int i = 0; cache && i < styles.size(); i++)
+		styleHashes[i] = styles[i]->hash();
+
+	PieceQueue queue(queueBytes, noOfThreads);
+	atomic<int> nextJob(0);
+	double start = nowSeconds();
+	vector<thread> generators;
+	for(int i = 0; i < noOfThreads; i++)
+		generators.push_back(thread(runnerGenerator, &jobs, &styles, &styleHashes, compact, rng, cache, &queue, &nextJob));
+
+	//Write the pieces out as they arrive, reporting progress every second.
+	FileWriter writer(output, outputDepth);
+	QueuedPiece piece;
+	int written = 0;
+	bool packed = true;
+	double lastReport = start;
+	while(queue.pop(piece))
+	{
+		const ManifestJob& job = jobs[piece.job];
+		if(pack)
+			packed = pack->append(piece.job, piece.file, job.seed, 0, job.style, job.noOfBars) && packed;
+		else
+			writer.write(job.midiName.c_str(), piece.file);
+		queue.recycle(piece.file);
+		written++;
+
+		double now = nowSeconds();
+		if(now - lastReport >= 1)
+		{
+			size_t queuedPieces, queuedBytes;
+			queue.occupancy(queuedPieces, queuedBytes);
+			std::cout << written << "/" << jobs.size() << " jobs, " << (int)(written / (now - start)) << " jobs/s, "
+				<< queuedPieces << " pieces (" << queuedBytes / 1024 << " KB) queued" << std::endl;
+			lastReport = now;
+		}
+	}
+	for(int i = 0; i < generators.size(); i++)
+		generators[i].join();
+	bool ok = writer.finish() && packed;
+
+	double elapsed = nowSeconds() - start;
+	std::cout << "Ran " << written << " jobs in " << elapsed << " s, " << written / elapsed << " jobs/s, "
+		<< (pack ? "appending to a pack" : string("writing with ") + getFileWriterBackendName(writer.getBackend()))
+		<< "." << std::endl
+		<< "The queue held " << (queue.pushes ? (double)queue.piecesSum / queue.pushes : 0) << " pieces on average and at most "
+		<< queue.mostPieces << " (" << queue.mostBytes / 1024 << " KB of " << queueBytes / 1024 << " KB)." << std::endl
+		<< "The generators waited " << queue.producerWait << " s for room and the writer waited "
+		<< queue.consumerWait << " s for pieces." << std::endl;
+	if(!ok)
+		std::cout << "ERROR: Some files could not be written." << std::endl;
+	return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "generator.h"
+#include "piececache.h"
+#include "packfile.h"
+
+//The default bound on the bytes of generated pieces waiting to be written.
+const size_t RUNNER_QUEUE_BYTES = 64 << 20;
+//The most pieces that can wait to be written, however small they are.
+const int RUNNER_QUEUE_PIECES = 4096;
+
+//One piece to generate and the file to write it to.
+struct ManifestJob
+{
+	std::string styleName; //The name of the style, as written in the manifest.
+	int style; //The index of the style in the list given to runManifest().
+	int noOfBars;
+	unsigned long seed;
+	std::string midiName;
+};
+
+/* Read a manifest of jobs. Each line is
+       <style> <bars> <seed> <output file>
+   and blank lines and lines starting with # are skipped. The output file is the rest of the line, so it can
+   contain spaces. Each job's style is left as -1 for the caller to fill in from its name.
+   Returns false, after printing the line at fault, if the manifest can not be read. */
+bool readManifest(const char* filename, std::vector<ManifestJob>& jobs);
+
+/* Run the jobs of a manifest. Generator threads take jobs in order and serialise each piece into a bounded queue,
+   and the calling thread writes them out, so generating and writing overlap. When the queue is full the
+   generators wait, which caps the memory held by pieces that have not been written. Each piece is the one
+   --batch 1 --seed <seed> would write as piece 0, so any job can be reproduced from the command line.
+   Progress is printed every second, and the jobs per second and how full the queue was are printed at the end.
+   PARAMETERS:
+   jobs - the jobs to run, with their styles filled in.
+   styles - the compiled styles the jobs refer to.
+   noOfThreads - the number of generator threads.
+   compact, rng - as for generateBatch().
+   cache - if not NULL, pieces are looked up here first and added when they have to be generated.
+   queueBytes - the bound on the bytes of pieces waiting to be written. 0 uses RUNNER_QUEUE_BYTES.
+   output, outputDepth - how the files are written, and how many can be in flight (see FileWriter).
+   pack - if not NULL, each piece is appended to the pack, with its job's index as its id and the job's style
+   number as its style, and the jobs' output files are not written. The caller finishes the pack.
+   RETURNS: false if any file could not be written. */
+bool runManifest(const std::vector<ManifestJob>& jobs, const std::vector<const Style*>& styles, int noOfThreads,
+	bool compact, GeneratorRng rng, PieceCache* cache = NULL, size_t queueBytes = 0,
+	FileWriterBackend output = FILEWRITER_SYNC, int outputDepth = 0, PackWriter* pack = NULL);
+
+#endif //RUNNER_H
@@ -0,0 +1,408 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+#include "server.h"
+
+//The most bytes of a request line, with its newline.
+static const int SERVER_MAX_REQUEST = 1024;
+//How long sending an answer can block before the client is given up on, so one that stops reading can not hold a worker.
+static const int SERVER_SEND_TIMEOUT = 10;
+
+//A client's connection, and the part of its next request received so far.
+struct ServerConnection
+{
+	int socket;
+	char request[SERVER_MAX_REQUEST];
+	size_t used;
+};
+
+//Connections with a request to read, waiting for a worker, and connections handed back by the workers to wait for their next request.
+struct ConnectionQueue
+{
+	deque<ServerConnection*> connections;
+	vector<ServerConnection*> returned;
+	mutex lock;
+	condition_variable ready;
+	//Written to when a connection is handed back, to wake up the thread waiting for requests.
+	int wakeUp[2];
+
+	void push(ServerConnection* connection)
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			connections.push_back(connection);
+		}
+		ready.notify_one();
+	}
+	ServerConnection* pop()
+	{
+		unique_lock<mutex> guard(lock);
+		while(connections.empty())
+			ready.wait(guard);
+		ServerConnection* connection = connections.front();
+		connections.pop_front();
+		return connection;
+	}
+	void handBack(ServerConnection* connection)
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			returned.push_back(connection);
+		}
+		//If the pipe is full, there is already a wake up waiting.
+		char byte = 0;
+		while(write(wakeUp[1], &byte, 1) < 0 && errno == EINTR)
+			;
+	}
+	//Move the connections handed back onto the end of a list.
+	void takeReturned(vector<ServerConnection*>& idle)
+	{
+		lock_guard<mutex> guard(lock);
+		idle.insert(idle.end(), returned.begin(), returned.end());
+		returned.clear();
+	}
+};
+
+//What every worker shares.
+struct ServerContext
+{
+	const Style* styles;
+	int noOfStyles;
+	vector<unsigned long long> styleHashes; //The hash of each style, for cache keys.
+	PieceCache* cache;
+};
+
+//Everything a worker reuses from one request to the next.
+struct ServerWorker
+{
+	MidiFile midi;
+	MTRandSIMD mtrand;
+	vector<unsigned char> buffer;
+
+	ServerWorker() : mtrand(0U)
+	{
+	}
+};
+
+//Send all of the buffers, carrying on after partial writes. Returns false if the connection has gone.
+static bool sendAll(int connection, struct iovec* buffers, int noOfBuffers)
+{
+	while(noOfBuffers > 0)
+	{
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = buffers;
+		message.msg_iovlen = noOfBuffers;
+		ssize_t sent = sendmsg(connection, &message, MSG_NOSIGNAL);
+		if(sent < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+
+		//Skip past what was sent.
+		while(noOfBuffers > 0 && (size_t)sent >= buffers->iov_len)
+		{
+			sent -= buffers->iov_len;
+			buffers++;
+			noOfBuffers--;
+		}
+		if(noOfBuffers > 0)
+		{
+			buffers->iov_base = (char*)buffers->iov_base + sent;
+			buffers->iov_len -= sent;
+		}
+	}
+	return true;
+}
+
+static bool sendError(int connection, const char* message)
+{
+	char line[256];
+	int length = snprintf(line, sizeof(line), "ERROR %s\n", message);
+	struct iovec buffer = { line, (size_t)length };
+	return sendAll(connection, &buffer, 1);
+}
+
+//Answer one request line. Returns false if the connection has gone.
+static bool answerRequest(int connection, const char* request, ServerWorker& worker, const ServerContext& context)
+{
+	int table, noOfBars, compact;
+	unsigned long seed;
+	char rngName[32];
+	GeneratorRng rng;
+	if(sscanf(request, "%d %d %lu %d %31s", &table, &noOfBars, &seed, &compact, rngName) != 5)
+		return sendError(connection, "expected <table> <bars> <seed> <compact> <rng>");
+	if(table < 1 || table > context.noOfStyles)
+		return sendError(connection, "unknown table");
+	if(noOfBars < 1 || noOfBars > SERVER_MAX_BARS)
+		return sendError(connection, "bad number of bars");
+	if(!parseGeneratorRng(rngName, rng))
+		return sendError(connection, "unknown rng");
+
+	//Generate the piece as a batch would generate piece 0, straight into memory, unless it is cached.
+	PieceKey key = { context.styleHashes[table - 1], (unsigned int)seed, 0, noOfBars, compact != 0, rng };
+	if(!context.cache || !context.cache->get(key, worker.buffer))
+	{
+		generateBatchPiece(worker.midi, worker.buffer, noOfBars, context.styles[table - 1], worker.mtrand, seed, 0,
+			compact != 0, rng);
+		if(context.cache)
+			context.cache->put(key, worker.buffer);
+	}
+
+	//The header and the file go out together.
+	char header[32];
+	int headerLength = snprintf(header, sizeof(header), "OK %zu\n", worker.buffer.size());
+	struct iovec buffers[2] = { { header, (size_t)headerLength }, { &worker.buffer[0], worker.buffer.size() } };
+	return sendAll(connection, buffers, 2);
+}
+
+/* Answer the requests a connection has sent so far, reading without waiting. Returns true if the connection should
+   wait for its next request, or false if the client has closed it or it has failed. */
+static bool serveRequests(ServerConnection& connection, ServerWorker& worker, const ServerContext& context)
+{
+	while(true)
+	{
+		char* end = (char*)memchr(connection.request, '\n', connection.used);
+		if(!end)
+		{
+			if(connection.used == sizeof(connection.request))
+			{
+				sendError(connection.socket, "request too long");
+				return false;
+			}
+			ssize_t received = recv(connection.socket, connection.request + connection.used,
+				sizeof(connection.request) - connection.used, MSG_DONTWAIT);
+			if(received < 0 && errno == EINTR)
+				continue;
+			if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return true;
+			if(received <= 0)
+				return false;
+			connection.used += received;
+			continue;
+		}
+
+		*end = '\0';
+		if(!answerRequest(connection.socket, connection.request, worker, context))
+			return false;
+
+		//Keep anything after the line, which is the start of the next request.
+		connection.used -= end + 1 - connection.request;
+		memmove(connection.request, end + 1, connection.used);
+	}
+}
+
+/* Take connections with requests from the queue and answer them, forever. Run by each of the worker threads.
+   A worker only holds a connection while it has requests to answer, so clients that are idle hold up no one. */
+static void serverWorker(ConnectionQueue* queue, const ServerContext* context)
+{
+	ServerWorker worker;
+	while(true)
+	{
+		ServerConnection* connection = queue->pop();
+		if(serveRequests(*connection, worker, *context))
+			queue->handBack(connection);
+		else
+		{
+			close(connection->socket);
+			delete connection;
+		}
+	}
+}
+
+//Fill in a socket address for the path. Returns false if the path is too long.
+static bool socketAddress(const char* socketPath, struct sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		std::cout << "ERROR: The socket path " << socketPath << " is too long." << std::endl;
+		return false;
+	}
+	strcpy(address.sun_path, socketPath);
+	return true;
+}
+
+bool runServer(const char* socketPath, const Style* styles, int noOfStyles, int noOfThreads, PieceCache* cache)
+{
+	struct sockaddr_un address;
+	if(!socketAddress(socketPath, address))
+		return false;
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener < 0)
+	{
+		std::cout << "ERROR: Could not create a socket." << std::endl;
+		return false;
+	}
+	unlink(socketPath);
+	if(bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 128) < 0)
+	{
+		std::cout << "ERROR: Could not listen on " << socketPath << "." << std::endl;
+		close(listener);
+		return false;
+	}
+
+	//A client going away part way through an answer should not stop the server.
+	signal(SIGPIPE, SIG_IGN);
+
+	if(noOfThreads < 1)
+		noOfThreads = 1;
+	ServerContext context;
+	context.styles = styles;
+	context.noOfStyles = noOfStyles;
+	for(int i = 0; i < noOfStyles; i++)
+		context.styleHashes.push_back(styles[i].hash());
+	context.cache = cache;
+	
+	ConnectionQueue queue;
+	if(pipe2(queue.wakeUp, O_NONBLOCK | O_CLOEXEC) < 0)
+	{
+		std::cout << "ERROR: Could not create a pipe." << std::endl;
+		close(listener);
+		return false;
+	}
+	vector<thread> workers;
+	for(int i = 0; i < noOfThreads; i++)
+		workers.push_back(thread(serverWorker, &queue, &context));
+
+	std::cout << "Serving " << noOfStyles << " styles on " << socketPath << " with " << noOfThreads << " threads." << std::endl;
+
+	//Wait for new connections, and for requests on the connections no worker holds, handing each request to the workers.
+	vector<ServerConnection*> idle;
+	vector<struct pollfd> waits;
+	while(true)
+	{
+		waits.clear();
+		struct pollfd listening = { listener, POLLIN, 0 };
+		struct pollfd woken = { queue.wakeUp[0], POLLIN, 0 };
+		waits.push_back(listening);
+		waits.push_back(woken);
+		for(int i = 0; i < idle.size(); i++)
+		{
+			struct pollfd waiting = { idle[i]->socket, POLLIN, 0 };
+			waits.push_back(waiting);
+		}
+		if(poll(&waits[0], waits.size(), -1) < 0)
+			continue;
+
+		//Pass on the connections with something to read, which includes those the client has closed.
+		int kept = 0;
+		for(int i = 0; i < idle.size(); i++)
+		{
+			if(waits[i + 2].revents)
+				queue.push(idle[i]);
+			else
+				idle[kept++] = idle[i];
+		}
+		idle.resize(kept);
+
+		if(waits[1].revents)
+		{
+			char bytes[64];
+			while(read(queue.wakeUp[0], bytes, sizeof(bytes)) > 0)
+				;
+			queue.takeReturned(idle);
+		}
+
+		if(waits[0].revents)
+		{
+			int socket = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+			if(socket >= 0)
+			{
+				struct timeval timeout = { SERVER_SEND_TIMEOUT, 0 };
+				setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				ServerConnection* connection = new ServerConnection;
+				connection->socket = socket;
+				connection->used = 0;
+				idle.push_back(connection);
+			}
+			else if(errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+			{
+				std::cout << "ERROR: Could not accept a connection." << std::endl;
+				sleep(1);
+			}
+		}
+	}
+}
+
+bool requestPiece(const char* socketPath, const char* midiName, int table, int noOfBars, unsigned long seed,
+	bool compact, GeneratorRng rng)
+{
+	struct sockaddr_un address;
+	if(!socketAddress(socketPath, address))
+		return false;
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) < 0)
+	{
+		std::cout << "ERROR: Could not connect to " << socketPath << "." << std::endl;
+		if(connection >= 0)
+			close(connection);
+		return false;
+	}
+
+	char request[128];
+	int length = snprintf(request, sizeof(request), "%d %d %lu %d %s\n", table, noOfBars, seed, compact ? 1 : 0,
+		getGeneratorRngName(rng));
+	struct iovec buffer = { request, (size_t)length };
+
+	//Read the answer's header line a byte at a time, so nothing after it is read.
+	string header;
+	char c;
+	bool ok = sendAll(connection, &buffer, 1);
+	while(ok && recv(connection, &c, 1, 0) == 1 && c != '\n')
+		header += c;
+
+	size_t fileLength;
+	if(!ok || sscanf(header.c_str(), "OK %zu", &fileLength) != 1)
+	{
+		std::cout << "ERROR: The server answered \"" << header << "\"." << std::endl;
+		close(connection);
+		return false;
+	}
+
+	vector<unsigned char> file(fileLength);
+	size_t received = 0;
+	while(received < fileLength)
+	{
+		ssize_t got = recv(connection, &file[received], fileLength - received, 0);
+		if(got <= 0)
+			break;
+		received += got;
+	}
+	close(connection);
+	if(received < fileLength)
+	{
+		std::cout << "ERROR: The server closed the connection part way through the file." << std::endl;
+		return false;
+	}
+
+	FILE* output = fopen(midiName, "wb");
+	if(!output || fwrite(&file[0], 1, fileLength, output) != fileLength)
+	{
+		std::cout << "ERROR: Could not write " << midiName << "." << std::endl;
+		if(output)
+			fclose(output);
+		return false;
+	}
+	fclose(output);
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "generator.h"
+#include "style.h"
+
+/* A generation server on a Unix domain socket, which keeps the compiled styles in memory between requests.
+   A client sends one request per line:
+       <table> <bars> <seed> <compact 0|1> <rng>
+   where table is the 1 based number of one of the server's styles and rng is mt19937, sfmt or philox. A client can
+   send any number of requests on one connection. Each is answered with a line "OK <length>" followed by the
+   <length> bytes of the MIDI file, or with a line "ERROR <message>". The file is the one --batch 1 --seed <seed>
+   would write as piece 0, so answers can be reproduced from the command line. */
+
+//The most bars a single request can ask for.
+const int SERVER_MAX_BARS = 1 << 20;
+
+/* Serve requests until the process is killed.
+   PARAMETERS:
+   socketPath - the path of the socket. Anything left at the path by an earlier server is removed.
+   styles - the compiled styles requests can choose from.
+   noOfStyles - the number of styles.
+   noOfThreads - the number of worker threads. Each request goes to the next free worker, and a connection waiting
+   for its next request holds none of them, so idle clients do not hold up the others.
+   cache - if not NULL, pieces are looked up here first and added when they have to be generated.
+   RETURNS: false if the socket could not be set up. */
+bool runServer(const char* socketPath, const Style* styles, int noOfStyles, int noOfThreads, PieceCache* cache = NULL);
+
+/* Ask a server for a piece and write it to a MIDI file.
+   PARAMETERS:
+   socketPath - the path of the server's socket.
+   midiName - the name of the MIDI file that will be written.
+   table, noOfBars, seed, compact, rng - the fields of the request.
+   RETURNS: false if the request failed, after printing why. */
+bool requestPiece(const char* socketPath, const char* midiName, int table, int noOfBars, unsigned long seed,
+	bool compact, GeneratorRng rng);
+
+#endif //SERVER_H
@@ -0,0 +1,84 @@
+#include "stats.h"
+#include <mutex>
+using namespace std;
+
+bool statsEnabled = false;
+thread_local ThreadStats threadStats;
+
+//The counts of every thread that has been flushed.
+static ThreadStats totals;
+static mutex totalsMutex;
+
+//The clock and cycle counter when stats were enabled, used to measure the length of a cycle.
+static unsigned long long startNs;
+static unsigned long long startCycles;
+
+static const char* COUNTER_NAMES[STATS_COUNTERS] = {
+	"pieces", "bars", "chord_draws", "rhythm_draws", "melody_notes", "bytes_written", "cache_hits"
+};
+static const char* PHASE_NAMES[STATS_PHASES] = {
+	"add_chord", "rhythm", "melody", "next_chord", "write"
+};
+
+static unsigned long long nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void statsEnable()
+{
+	startNs = nowNs();
+	startCycles = statsCycles();
+	statsEnabled = true;
+}
+
+void statsFlush()
+{
+	if(!statsEnabled)
+		return;
+
+	lock_guard<mutex> lock(totalsMutex);
+	for(int i = 0; i < STATS_COUNTERS; i++)
+		totals.counters[i] += threadStats.counters[i];
+	for(int i = 0; i < STATS_MAX_TRACKS; i++)
+		totals.trackEvents[i] += threadStats.trackEvents[i];
+	for(int i = 0; i < STATS_PHASES; i++)
+	{
+		totals.phaseCycles[i] += threadStats.phaseCycles[i];
+		totals.phaseCalls[i] += threadStats.phaseCalls[i];
+	}
+	threadStats = ThreadStats();
+}
+
+void statsReport(FILE* file, int threads)
+{
+	statsFlush();
+
+	unsigned long long wallNs = nowNs() - startNs;
+	unsigned long long cycles = statsCycles() - startCycles;
+	double nsPerCycle = cycles ? (double)wallNs / cycles : 0;
+
+	fprintf(file, "{\"wall_ns\":%llu,\"threads\":%d,\"ns_per_cycle\":%.6f,\"counters\":{", wallNs, threads, nsPerCycle);
+	for(int i = 0; i < STATS_COUNTERS; i++)
+		fprintf(file, "%s\"%s\":%llu", i ? "," : "", COUNTER_NAMES[i], totals.counters[i]);
+
+	fprintf(file, "},\"events_per_track\":[");
+
+	//Leave off the tracks no events were added to.
+	int noOfTracks = STATS_MAX_TRACKS;
+	while(noOfTracks > 0 && totals.trackEvents[noOfTracks - 1] == 0)
+		noOfTracks--;
+	for(int i = 0; i < noOfTracks; i++)
+		fprintf(file, "%s%llu", i ? "," : "", totals.trackEvents[i]);
+
+	//Phase times are summed over every thread, so they can add up to more than the wall time.
+	fprintf(file, "],\"phases\":{");
+	for(int i = 0; i < STATS_PHASES; i++)
+	{
+		fprintf(file, "%s\"%s\":{\"calls\":%llu,\"cycles\":%llu,\"ns\":%.0f}", i ? "," : "", PHASE_NAMES[i],
+			totals.phaseCalls[i], totals.phaseCycles[i], totals.phaseCycles[i] * nsPerCycle);
+	}
+	fprintf(file, "}}\n");
+}
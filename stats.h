@@ -0,0 +1,109 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Counters and phase timers for the hot paths of the generator.
+   Each thread adds to its own copy, so nothing is shared while generating. A thread's copy is added to the
+   totals by statsFlush(), which workers call when they finish. Everything is skipped unless statsEnable()
+   has been called, so the cost when stats are not wanted is one predictable branch. */
+
+//The things that are counted.
+enum StatsCounter
+{
+	STATS_PIECES, //Pieces generated.
+	STATS_BARS, //Bars generated.
+	STATS_CHORD_DRAWS, //Next chords sampled from the transition table.
+	STATS_RHYTHM_DRAWS, //Bar rhythms sampled.
+	STATS_MELODY_NOTES, //Melody notes sampled.
+	STATS_BYTES_WRITTEN, //Bytes of MIDI written to files.
+	STATS_CACHE_HITS, //Pieces found in the cache instead of being generated.
+	STATS_COUNTERS
+};
+
+//The phases of generation that are timed.
+enum StatsPhase
+{
+	STATS_PHASE_ADD_CHORD, //Adding the chord's events to the tracks.
+	STATS_PHASE_RHYTHM, //Choosing the rhythm of the bar.
+	STATS_PHASE_MELODY, //Choosing the melody notes and adding their events.
+	STATS_PHASE_NEXT_CHORD, //Sampling the next chord.
+	STATS_PHASE_WRITE, //Serialising and writing the file.
+	STATS_PHASES
+};
+
+//The number of tracks events are counted for. Events on later tracks are counted on the last one.
+const int STATS_MAX_TRACKS = 8;
+
+//One thread's counts. Plain data, so the thread local copy needs no constructor.
+struct ThreadStats
+{
+	unsigned long long counters[STATS_COUNTERS];
+	unsigned long long trackEvents[STATS_MAX_TRACKS];
+	unsigned long long phaseCycles[STATS_PHASES];
+	unsigned long long phaseCalls[STATS_PHASES];
+};
+
+extern bool statsEnabled;
+extern thread_local ThreadStats threadStats;
+
+//Read the cycle counter, or a nanosecond clock where there is none.
+inline unsigned long long statsCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+//Add to a counter.
+inline void statsCount(StatsCounter counter, unsigned long long amount = 1)
+{
+	if(__builtin_expect(statsEnabled, 0))
+		threadStats.counters[counter] += amount;
+}
+
+//Add to the number of events added to a track.
+inline void statsCountEvents(int track, unsigned long long amount)
+{
+	if(__builtin_expect(statsEnabled, 0))
+		threadStats.trackEvents[track < STATS_MAX_TRACKS ? track : STATS_MAX_TRACKS - 1] += amount;
+}
+
+//Times a phase from when it is created until it goes out of scope.
+class StatsTimer
+{
+	StatsPhase phase;
+	unsigned long long start;
+
+	public:
+		StatsTimer(StatsPhase phase) : phase(phase), start(0)
+		{
+			if(__builtin_expect(statsEnabled, 0))
+				start = statsCycles();
+		}
+		~StatsTimer()
+		{
+			if(__builtin_expect(statsEnabled, 0))
+			{
+				threadStats.phaseCycles[phase] += statsCycles() - start;
+				threadStats.phaseCalls[phase]++;
+			}
+		}
+};
+
+//Turn the counters and timers on, and start the clock used to convert cycles to time.
+void statsEnable();
+//Add the calling thread's counts to the totals and clear them.
+void statsFlush();
+//Flush the calling thread, then write the totals as JSON. threads is the number of threads that were used.
+void statsReport(FILE* file, int threads);
+
+#endif //STATS_H
@@ -0,0 +1,369 @@
+#include "style.h"
+#include "hash.h"
+#include <fstream>
+#include <string>
+#include <math.h>
+#include <string.h>
+using namespace std;
+
+//The first line of a style file.
+static const char* STYLE_FILE_SIGNATURE = "autocomposition-style";
+static const int STYLE_FILE_VERSION = 1;
+
+//Build cumulative thresholds from a list of weights. Returns false if a weight is invalid or they are all 0.
+static bool buildThresholds(const float* weights, int count, unsigned long long* thresholds)
+{
+	double sum = 0;
+	for(int i = 0; i < count; i++)
+	{
+		if(!(weights[i] >= 0) || isinf(weights[i]))
+			return false;
+		sum += weights[i];
+	}
+	if(sum == 0)
+		return false;
+
+	double cumulative = 0;
+	for(int i = 0; i < count; i++)
+	{
+		cumulative += weights[i];
+		thresholds[i] = (unsigned long long)(cumulative / sum * 4294967296.0);
+	}
+
+	//Make sure rounding can never push a random number past the last entry with any weight.
+	int last = count - 1;
+	while(weights[last] == 0)
+		last--;
+	for(int i = last; i < count; i++)
+		thresholds[i] = 4294967296ULL;
+	return true;
+}
+
+Style::Style() : startChord(0)
+{
+	//Chords the chain never plays keep thresholds of 0, so written styles are the same every time.
+	memset(melodyThresholds, 0, sizeof(melodyThresholds));
+
+	for(int chord = 0; chord < STYLE_CHORDS; chord++)
+	{
+		for(int i = 0; i < STYLE_CHORDS; i++)
+			transitions[chord][i] = 0;
+
+		//The melody uses the root, third and fifth of the chord.
+		int root = chord / 2;
+		for(int note = 0; note < 12; note++)
+			melody[chord][note] = 0;
+		melody[chord][root] = 1;
+		melody[chord][(root + (chord % 2 == 1 ? 3 : 4)) % 12] = 1;
+		melody[chord][(root + 7) % 12] = 1;
+	}
+
+	for(int i = 0; i < STYLE_DURATIONS; i++)
+		durations[i] = 1;
+}
+
+bool Style::load(const char* filename)
+{
+	ifstream is(filename);
+	if(!is)
+	{
+		std::cout << "ERROR: Could not open " << filename << "." << std::endl;
+		return false;
+	}
+
+	string signature, section;
+	int version = 0;
+	is >> signature >> version;
+	if(signature != STYLE_FILE_SIGNATURE || version != STYLE_FILE_VERSION)
+	{
+		std::cout << "ERROR: " << filename << " is not a version " << STYLE_FILE_VERSION << " style file." << std::endl;
+		return false;
+	}
+
+	//The sections are read in the order save() writes them.
+	is >> section >> startChord;
+	if(section != "start")
+		is.setstate(ios::failbit);
+
+	is >> section;
+	if(section != "transitions")
+		is.setstate(ios::failbit);
+	for(int i = 0; i < STYLE_CHORDS; i++)
+		for(int j = 0; j < STYLE_CHORDS; j++)
+			is >> transitions[i][j];
+
+	is >> section;
+	if(section != "melody")
+		is.setstate(ios::failbit);
+	for(int i = 0; i < STYLE_CHORDS; i++)
+		for(int j = 0; j < 12; j++)
+			is >> melody[i][j];
+
+	is >> section;
+	if(section != "durations")
+		is.setstate(ios::failbit);
+	for(int i = 0; i < STYLE_DURATIONS; i++)
+		is >> durations[i];
+
+	//The contexts come last and are optional, so a style file without any still loads.
+	contexts.clear();
+	if(is && !(is >> section) && is.eof())
+		is.clear(ios::eofbit);
+	else if(is)
+	{
+		int noOfContexts = -1;
+		is >> noOfContexts;
+		if(section != "contexts" || noOfContexts < 0)
+			is.setstate(ios::failbit);
+		for(int i = 0; is && i < noOfContexts; i++)
+		{
+			//Each context is its order, its chords from the oldest, the next chord and the weight.
+			ChordModel::Context context;
+			is >> context.order;
+			if(context.order < 2 || context.order > CHORDMODEL_MAX_ORDER)
+				is.setstate(ios::failbit);
+			for(int j = 0; is && j < context.order; j++)
+				is >> context.chords[j];
+			is >> context.next >> context.weight;
+			contexts.push_back(context);
+		}
+	}
+
+	if(!is)
+	{
+		std::cout << "ERROR: " << filename << " is not a valid style file." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool Style::save(const char* filename) const
+{
+	ofstream os(filename);
+	if(!os)
+	{
+		std::cout << "ERROR: Could not open " << filename << " for writing." << std::endl;
+		return false;
+	}
+
+	os << STYLE_FILE_SIGNATURE << " " << STYLE_FILE_VERSION << std::endl;
+	os << "start " << startChord << std::endl;
+
+	os << "transitions" << std::endl;
+	for(int i = 0; i < STYLE_CHORDS; i++)
+	{
+		for(int j = 0; j < STYLE_CHORDS; j++)
+			os << (j ? " " : "") << transitions[i][j];
+		os << std::endl;
+	}
+
+	os << "melody" << std::endl;
+	for(int i = 0; i < STYLE_CHORDS; i++)
+	{
+		for(int j = 0; j < 12; j++)
+			os << (j ? " " : "") << melody[i][j];
+		os << std::endl;
+	}
+
+	os << "durations" << std::endl;
+	for(int i = 0; i < STYLE_DURATIONS; i++)
+		os << (i ? " " : "") << durations[i];
+	os << std::endl;
+
+	if(!contexts.empty())
+	{
+		os << "contexts " << contexts.size() << std::endl;
+		for(int i = 0; i < contexts.size(); i++)
+		{
+			os << contexts[i].order;
+			for(int j = 0; j < contexts[i].order; j++)
+				os << " " << contexts[i].chords[j];
+			os << " " << contexts[i].next << " " << contexts[i].weight << std::endl;
+		}
+	}
+
+	return os.good();
+}
+
+/* Check the chain of chords can never get stuck. The transition table only checks the chords it can reach from
+   the start chord itself, but a context can jump to any chord, and the table can carry on from there, so walk
+   every chord the start chord and the contexts' chords lead to through either. Each must have successors in the
+   table, as the table picks the next chord when no context does. Returns false, after printing why, if not. */
+static bool checkChordChain(const TransitionTable& chords, const ChordModel& contextModel)
+{
+	bool reached[STYLE_CHORDS] = { false };
+	vector<int> toVisit;
+	auto visit = [&](int chord) {
+		if(!reached[chord])
+		{
+			reached[chord] = true;
+			toVisit.push_back(chord);
+		}
+	};
+	visit(chords.getStartState());
+	contextModel.forEachNext(visit);
+	while(!toVisit.empty())
+	{
+		int chord = toVisit.back();
+		toVisit.pop_back();
+		if(!chords.hasSuccessors(chord))
+		{
+			std::cout << "ERROR: Chord " << chord << " can be reached through the style's contexts but has no successors." << std::endl;
+			return false;
+		}
+		chords.forEachSuccessor(chord, visit);
+	}
+	return true;
+}
+
+bool Style::compile()
+{
+	if(!chords.build(transitions, startChord) || !contextModel.build(contexts, STYLE_CHORDS))
+		return false;
+
+	if(!checkChordChain(chords, contextModel))
+		return false;
+
+	for(int chord = 0; chord < STYLE_CHORDS; chord++)
+	{
+		//Chords without successors are never played, as checkChordChain() found, so they do not need melody notes.
+		//Every chord the chain can play has successors, so gets them.
+		if(!chords.hasSuccessors(chord))
+			continue;
+
+		if(!buildThresholds(melody[chord], 12, melodyThresholds[chord]))
+		{
+			std::cout << "ERROR: Chord " << chord << " has no valid melody notes." << std::endl;
+			return false;
+		}
+	}
+
+	if(!rhythms.build(STYLE_BAR_TICKS, STYLE_DURATION_TICKS, durations, STYLE_DURATIONS))
+	{
+		std::cout << "ERROR: The style has no valid note durations." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+unsigned long long Style::hash() const
+{
+	unsigned long long hash = chords.hash(HASH_START);
+	//Styles without contexts hash as they did before there were any.
+	if(contextModel.getMaxOrder() > 1)
+		hash = contextModel.hash(hash);
+	hash = rhythms.hash(hash);
+	for(int chord = 0; chord < STYLE_CHORDS; chord++)
+	{
+		//Only the chords the chain can play have melody thresholds.
+		if(!chords.hasSuccessors(chord))
+			continue;
+		for(int note = 0; note < 12; note++)
+			hash = hashValue(hash, melodyThresholds[chord][note]);
+	}
+	return hash;
+}
+
+/* The layout written by write(): startChord, the transition, melody and duration weights, the melody thresholds,
+   the lengths of the three compiled tables in bytes and a word of padding, and then the tables themselves, as
+   ChordModel::write(), TransitionTable::write() and RhythmTable::write() lay them out. Everything before the
+   tables is a multiple of 8 bytes long, and the chord model, which needs 8 byte alignment, comes first. */
+static const size_t STYLE_WEIGHTS_LENGTH = sizeof(int) + sizeof(float) * (STYLE_CHORDS * STYLE_CHORDS + STYLE_CHORDS * 12 + STYLE_DURATIONS);
+static const int STYLE_TABLES = 3;
+static const size_t STYLE_FIXED_LENGTH = STYLE_WEIGHTS_LENGTH + sizeof(unsigned long long) * STYLE_CHORDS * 12 + (STYLE_TABLES + 1) * sizeof(unsigned int);
+
+//Add bytes to the end of a buffer.
+static void append(vector<unsigned char>& buffer, const void* data, size_t length)
+{
+	buffer.insert(buffer.end(), (const unsigned char*)data, (const unsigned char*)data + length);
+}
+
+//Add the contents of another buffer, which may be empty, to the end of a buffer.
+static void append(vector<unsigned char>& buffer, const vector<unsigned char>& data)
+{
+	buffer.insert(buffer.end(), data.begin(), data.end());
+}
+
+void Style::write(vector<unsigned char>& buffer) const
+{
+	static_assert(STYLE_WEIGHTS_LENGTH % 8 == 0, "The melody thresholds of a written style must be 8 byte aligned");
+	append(buffer, &startChord, sizeof(startChord));
+	append(buffer, transitions, sizeof(transitions));
+	append(buffer, melody, sizeof(melody));
+	append(buffer, durations, sizeof(durations));
+	append(buffer, melodyThresholds, sizeof(melodyThresholds));
+
+	vector<unsigned char> contextTable, chordTable, rhythmTable;
+	contextModel.write(contextTable);
+	chords.write(chordTable);
+	rhythms.write(rhythmTable);
+	unsigned int lengths[STYLE_TABLES + 1] = { (unsigned int)contextTable.size(), (unsigned int)chordTable.size(), (unsigned int)rhythmTable.size(), 0 };
+	append(buffer, lengths, sizeof(lengths));
+	append(buffer, contextTable);
+	append(buffer, chordTable);
+	append(buffer, rhythmTable);
+}
+
+bool Style::attach(const unsigned char* data, size_t length)
+{
+	unsigned int lengths[STYLE_TABLES + 1];
+	if(length < STYLE_FIXED_LENGTH)
+	{
+		std::cout << "ERROR: The style is cut short." << std::endl;
+		return false;
+	}
+	memcpy(lengths, data + STYLE_FIXED_LENGTH - sizeof(lengths), sizeof(lengths));
+	if(length != STYLE_FIXED_LENGTH + (size_t)lengths[0] + lengths[1] + lengths[2] || lengths[0] % 8 != 0)
+	{
+		std::cout << "ERROR: The style has an invalid size." << std::endl;
+		return false;
+	}
+
+	//Attach the tables first, so nothing is changed if any is invalid.
+	ChordModel newContextModel;
+	TransitionTable newChords;
+	RhythmTable newRhythms;
+	const unsigned char* tables = data + STYLE_FIXED_LENGTH;
+	if(!newContextModel.attach(tables, lengths[0])
+		|| !newChords.attach(tables + lengths[0], lengths[1])
+		|| !newRhythms.attach(tables + lengths[0] + lengths[1], lengths[2]))
+		return false;
+	if(newContextModel.getNoOfStates() != STYLE_CHORDS || newChords.getNoOfStates() != STYLE_CHORDS || newRhythms.getBarTicks() != STYLE_BAR_TICKS)
+	{
+		std::cout << "ERROR: The style's tables do not have " << STYLE_CHORDS << " chords and " << STYLE_BAR_TICKS << " tick bars." << std::endl;
+		return false;
+	}
+	//The generator draws a random number for each note of a bar into a buffer of STYLE_MAX_BAR_NOTES, so every
+	//rhythm must be made of the style's own durations, which can never fill a bar with more notes than that.
+	for(int rhythm = 0; rhythm < newRhythms.getNoOfRhythms(); rhythm++)
+	{
+		const int* noteDurations;
+		int noOfNotes = newRhythms.getRhythm(rhythm, noteDurations);
+		bool valid = noOfNotes <= STYLE_MAX_BAR_NOTES;
+		for(int note = 0; valid && note < noOfNotes; note++)
+		{
+			valid = false;
+			for(int i = 0; i < STYLE_DURATIONS; i++)
+				valid = valid || noteDurations[note] == STYLE_DURATION_TICKS[i];
+		}
+		if(!valid)
+		{
+			std::cout << "ERROR: Rhythm " << rhythm << " of the style has too many notes or a duration the style can not use." << std::endl;
+			return false;
+		}
+	}
+	if(!checkChordChain(newChords, newContextModel))
+		return false;
+
+	const unsigned char* next = data;
+	memcpy(&startChord, next, sizeof(startChord));
+	memcpy(transitions, next += sizeof(startChord), sizeof(transitions));
+	memcpy(melody, next += sizeof(transitions), sizeof(melody));
+	memcpy(durations, next += sizeof(melody), sizeof(durations));
+	memcpy(melodyThresholds, next += sizeof(durations), sizeof(melodyThresholds));
+	contexts.clear();
+	contextModel = newContextModel;
+	chords = newChords;
+	rhythms = newRhythms;
+	return true;
+}
@@ -0,0 +1,130 @@
+#ifndef STYLE_H
+#define STYLE_H
+
+#include "include/MersenneTwister.h"
+#include "transitiontable.h"
+#include "chordmodel.h"
+#include "rhythmtable.h"
+
+//The number of chords in a style: a major and a minor chord on each of the 12 notes.
+const int STYLE_CHORDS = 24;
+//The note durations a style can use, in ticks of a 512 tick bar.
+const int STYLE_DURATIONS = 3;
+const int STYLE_DURATION_TICKS[STYLE_DURATIONS] = {64, 128, 256};
+//The length of a bar in ticks.
+const int STYLE_BAR_TICKS = 512;
+//The most notes a bar's rhythm can have.
+const int STYLE_MAX_BAR_NOTES = STYLE_BAR_TICKS / STYLE_DURATION_TICKS[0];
+
+//Get the chord number of a major or minor chord. Even numbers are major chords and odd numbers are minor chords.
+inline int chordNumber(int root, bool minor)
+{
+	return root * 2 + (minor ? 1 : 0);
+}
+
+/* Everything the generator needs to write a piece in a style: the chord transition table, optionally the chords
+   that follow longer runs of chords, how likely each note is in the melody over each chord, and how likely
+   each note duration is.
+   The weights can be set directly, or loaded from a style file such as the ones written by the trainer.
+   compile() checks them and builds the tables used for sampling. A compiled style can also be written with
+   write() and used again with attach(), which samples from the written tables in place (see StyleLibrary). */
+class Style
+{
+	//The compiled chord transition table.
+	TransitionTable chords;
+	//The compiled contexts, which are used before the transition table when one matches the chords so far.
+	ChordModel contextModel;
+	//Every rhythm that fills a bar, weighted by the note durations.
+	RhythmTable rhythms;
+	//Cumulative thresholds for choosing a melody note for each chord.
+	//The first entry whose threshold is above a 32 bit random number is chosen. The last entry with any weight has a threshold of 2^32.
+	unsigned long long melodyThresholds[STYLE_CHORDS][12];
+
+	public:
+		//The chord the generated chain starts from.
+		int startChord;
+		//The probability of moving from each chord (the row) to each other chord (the column).
+		float transitions[STYLE_CHORDS][STYLE_CHORDS];
+		/* The weights of the chords following runs of 2 to CHORDMODEL_MAX_ORDER chords. Empty for a style whose
+		   chords only depend on the chord before. Not kept by attach(), which samples from the compiled model. */
+		vector<ChordModel::Context> contexts;
+		//The weight of each note (C to B) in the melody over each chord.
+		float melody[STYLE_CHORDS][12];
+		//The weight of each of the note durations in STYLE_DURATION_TICKS.
+		float durations[STYLE_DURATIONS];
+
+		//Class constructor. There are no transitions, the melody uses the notes of each chord and every duration is equally likely.
+		Style();
+
+		//Read the weights from a style file. Returns false if the file can not be read.
+		bool load(const char* filename);
+		//Write the weights to a style file. Returns false if the file can not be written.
+		bool save(const char* filename) const;
+		//Check the weights and build the tables used for sampling. Returns false if the style is invalid.
+		bool compile();
+
+		//Add the weights and the compiled tables to the end of a buffer, in the layout attach() reads.
+		void write(vector<unsigned char>& buffer) const;
+		/* Use a style written by write(), copying its weights and sampling from its tables where they are.
+		   The data must be 8 byte aligned and stay valid for as long as the style and any copies of it are used.
+		   Returns false if the data is not a valid style. */
+		bool attach(const unsigned char* data, size_t length);
+
+		//Get a hash of the compiled tables. Styles that generate the same pieces from the same random numbers hash the same.
+		unsigned long long hash() const;
+
+		//Get the compiled chord transition table.
+		const TransitionTable& getTransitionTable() const
+		{
+			return chords;
+		}
+		//Get the compiled contexts.
+		const ChordModel& getChordModel() const
+		{
+			return contextModel;
+		}
+		//Get the compiled bar rhythms.
+		const RhythmTable& getRhythmTable() const
+		{
+			return rhythms;
+		}
+
+		/* Choose the chord following the chords so far, using a 32 bit random number that has already been drawn.
+		   The longest run of the last chords with a context in the style picks it, and the last chord picks it
+		   from the transition table if none has. */
+		int chooseNextChord(ChordHistory history, MTRand::uint32 random) const
+		{
+			int next;
+			if(contextModel.chooseNext(history, random, next))
+				return next;
+			return chords.chooseNext(getChordFromHistory(history, 0), random);
+		}
+
+		//Choose a melody note (0 to 11) to play over the given chord.
+		int chooseMelodyNote(int chord, MTRand& mtrand) const
+		{
+			return chooseMelodyNote(chord, mtrand.randInt());
+		}
+		//Choose a melody note using a 32 bit random number that has already been drawn.
+		int chooseMelodyNote(int chord, MTRand::uint32 random) const
+		{
+			unsigned long long value = random & 0xffffffffUL;
+			int note = 0;
+			while(note < 11 && value >= melodyThresholds[chord][note])
+				note++;
+			return note;
+		}
+
+		//Choose the rhythm of a bar, pointing noteDurations at the duration of each note in ticks. Returns the number of notes.
+		int chooseRhythm(MTRand& mtrand, const int*& noteDurations) const
+		{
+			return rhythms.choose(mtrand, noteDurations);
+		}
+		//Choose the rhythm of a bar using a 32 bit random number that has already been drawn.
+		int chooseRhythm(MTRand::uint32 random, const int*& noteDurations) const
+		{
+			return rhythms.choose(random, noteDurations);
+		}
+};
+
+#endif //STYLE_H
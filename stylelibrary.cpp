@@ -0,0 +1,235 @@
+#include "stylelibrary.h"
+#include "hash.h"
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+
+//The first bytes of a library file.
+static const char STYLELIBRARY_SIGNATURE[8] = { 'A', 'C', 'S', 'T', 'Y', 'L', 'I', 'B' };
+static const unsigned int STYLELIBRARY_VERSION = 2;
+//Read back as a different number on a machine with another byte order.
+static const unsigned int STYLELIBRARY_BYTE_ORDER = 0x01020304;
+
+struct StyleLibrary::Header
+{
+	char signature[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	unsigned int noOfStyles;
+	unsigned int reserved;
+	//The hash of the fields above.
+	unsigned long long checksum;
+};
+
+struct StyleLibrary::IndexEntry
+{
+	char name[STYLELIBRARY_MAX_NAME + 1];
+	//Where the style starts in the file and its length, both in bytes. Styles start on 8 byte boundaries.
+	unsigned long long offset;
+	unsigned long long length;
+	//The hash of the style's bytes.
+	unsigned long long styleChecksum;
+	//The hash of the fields above.
+	unsigned long long checksum;
+};
+
+/* The header and each index entry have their own checksums, so opening a library only checks the header and
+   looking up a style only checks the entries the search reads. Each checksum is the hash of everything before
+   it in its structure, which has no padding. */
+template<class T> static unsigned long long checksum(const T& value)
+{
+	return hashBytes(HASH_START, &value, offsetof(T, checksum));
+}
+
+StyleLibrary::StyleLibrary() : data(NULL), length(0), noOfStyles(0), index(NULL)
+{
+}
+
+StyleLibrary::~StyleLibrary()
+{
+	close();
+}
+
+void StyleLibrary::close()
+{
+	if(data)
+		munmap((void*)data, length);
+	data = NULL;
+	length = 0;
+	noOfStyles = 0;
+	index = NULL;
+}
+
+bool StyleLibrary::open(const char* filename)
+{
+	close();
+
+	int descriptor = ::open(filename, O_RDONLY);
+	struct stat info;
+	if(descriptor < 0 || fstat(descriptor, &info) != 0)
+	{
+		std::cout << "ERROR: Could not open " << filename << "." << std::endl;
+		if(descriptor >= 0)
+			::close(descriptor);
+		return false;
+	}
+	if((size_t)info.st_size < sizeof(Header))
+	{
+		std::cout << "ERROR: " << filename << " is not a style library." << std::endl;
+		::close(descriptor);
+		return false;
+	}
+
+	//The mapping stays valid after the descriptor is closed.
+	void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	::close(descriptor);
+	if(mapped == MAP_FAILED)
+	{
+		std::cout << "ERROR: Could not map " << filename << " into memory." << std::endl;
+		return false;
+	}
+	data = (const unsigned char*)mapped;
+	length = info.st_size;
+
+	const Header* header = (const Header*)data;
+	if(memcmp(header->signature, STYLELIBRARY_SIGNATURE, sizeof(STYLELIBRARY_SIGNATURE)) != 0
+		|| header->byteOrder != STYLELIBRARY_BYTE_ORDER || header->version != STYLELIBRARY_VERSION)
+	{
+		std::cout << "ERROR: " << filename << " is not a version " << STYLELIBRARY_VERSION
+			<< " style library written on a machine with this byte order." << std::endl;
+		close();
+		return false;
+	}
+	if(header->checksum != checksum(*header) || header->noOfStyles > (length - sizeof(Header)) / sizeof(IndexEntry))
+	{
+		std::cout << "ERROR: The header of " << filename << " is damaged." << std::endl;
+		close();
+		return false;
+	}
+
+	noOfStyles = header->noOfStyles;
+	index = (const IndexEntry*)(data + sizeof(Header));
+	return true;
+}
+
+const char* StyleLibrary::getName(int style) const
+{
+	//A damaged entry's name may not end where it should, so it is not given out.
+	return checksum(index[style]) == index[style].checksum ? index[style].name : "(damaged)";
+}
+
+int StyleLibrary::find(const char* name) const
+{
+	//The index is sorted by name. A damaged entry is treated as if it were the name being searched for, so the
+	//search stops there and getStyle() reports it.
+	int low = 0, high = noOfStyles;
+	while(low < high)
+	{
+		int middle = (low + high) / 2;
+		if(checksum(index[middle]) != index[middle].checksum)
+			return middle;
+		int order = strncmp(index[middle].name, name, STYLELIBRARY_MAX_NAME + 1);
+		if(order == 0)
+			return middle;
+		if(order < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return -1;
+}
+
+bool StyleLibrary::getStyle(int style, Style& result) const
+{
+	if(style < 0 || style >= noOfStyles)
+	{
+		std::cout << "ERROR: The library has no style " << style << "." << std::endl;
+		return false;
+	}
+
+	const IndexEntry& entry = index[style];
+	if(checksum(entry) != entry.checksum)
+	{
+		std::cout << "ERROR: Entry " << style << " of the library's index is damaged." << std::endl;
+		return false;
+	}
+	if(entry.offset % 8 != 0 || entry.offset > length || entry.length > length - entry.offset
+		|| hashBytes(HASH_START, data + entry.offset, entry.length) != entry.styleChecksum)
+	{
+		std::cout << "ERROR: The style " << entry.name << " in the library is damaged." << std::endl;
+		return false;
+	}
+	return result.attach(data + entry.offset, entry.length);
+}
+
+bool StyleLibrary::write(const char* filename, const vector<string>& names, const vector<const Style*>& styles)
+{
+	//Sort the styles by name, checking the names as we go.
+	vector<pair<string, const Style*> > sorted;
+	for(int i = 0; i < names.size(); i++)
+	{
+		if(names[i].empty() || names[i].size() > STYLELIBRARY_MAX_NAME)
+		{
+			std::cout << "ERROR: The style name \"" << names[i] << "\" is empty or longer than "
+				<< STYLELIBRARY_MAX_NAME << " characters." << std::endl;
+			return false;
+		}
+		sorted.push_back(make_pair(names[i], styles[i]));
+	}
+	sort(sorted.begin(), sorted.end());
+	for(int i = 1; i < sorted.size(); i++)
+	{
+		if(sorted[i].first == sorted[i - 1].first)
+		{
+			std::cout << "ERROR: There are two styles named " << sorted[i].first << "." << std::endl;
+			return false;
+		}
+	}
+
+	//Write the styles after the header and index, each starting on an 8 byte boundary.
+	static_assert(sizeof(Header) % 8 == 0 && sizeof(IndexEntry) % 8 == 0, "The styles must follow the index on an 8 byte boundary");
+	vector<IndexEntry> index(sorted.size());
+	vector<unsigned char> body;
+	size_t start = sizeof(Header) + index.size() * sizeof(IndexEntry);
+	for(int i = 0; i < sorted.size(); i++)
+	{
+		body.resize((body.size() + 7) / 8 * 8, 0);
+		size_t offset = body.size();
+		sorted[i].second->write(body);
+
+		memset(index[i].name, 0, sizeof(index[i].name));
+		strcpy(index[i].name, sorted[i].first.c_str());
+		index[i].offset = start + offset;
+		index[i].length = body.size() - offset;
+		index[i].styleChecksum = hashBytes(HASH_START, &body[offset], index[i].length);
+		index[i].checksum = checksum(index[i]);
+	}
+
+	Header header;
+	memcpy(header.signature, STYLELIBRARY_SIGNATURE, sizeof(STYLELIBRARY_SIGNATURE));
+	header.version = STYLELIBRARY_VERSION;
+	header.byteOrder = STYLELIBRARY_BYTE_ORDER;
+	header.noOfStyles = sorted.size();
+	header.reserved = 0;
+	header.checksum = checksum(header);
+
+	FILE* file = fopen(filename, "wb");
+	bool ok = file && fwrite(&header, sizeof(header), 1, file) == 1
+		&& (index.empty() || fwrite(&index[0], sizeof(IndexEntry), index.size(), file) == index.size())
+		&& (body.empty() || fwrite(&body[0], 1, body.size(), file) == body.size());
+	if(file && fclose(file) != 0)
+		ok = false;
+	if(!ok)
+	{
+		std::cout << "ERROR: Could not write " << filename << "." << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#ifndef STYLELIBRARY_H
+#define STYLELIBRARY_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "style.h"
+
+//The longest name a style in a library can have.
+const int STYLELIBRARY_MAX_NAME = 47;
+
+/* A file of named, compiled styles, which is mapped into memory and used where it is.
+   The file starts with a header and an index of the styles sorted by name, followed by each style as
+   Style::write() lays it out. The header, each index entry and each style carry their own checksums, which
+   are checked when they are first read, so opening a library costs the same however many styles it holds
+   and finding one costs a binary search. Nothing is parsed or compiled: a style from a library samples
+   straight from the mapped tables.
+   The file is written in the machine's own byte order, which the header records, so a library is only read
+   on machines with the same byte order as the one that wrote it. */
+class StyleLibrary
+{
+	struct Header;
+	struct IndexEntry;
+
+	//The mapped file and its length.
+	const unsigned char* data;
+	size_t length;
+	int noOfStyles;
+	const IndexEntry* index;
+
+	public:
+		StyleLibrary(); //Class constructor. The library is empty until it is opened.
+		~StyleLibrary(); //Class destructor. Unmaps the file, so any styles taken from the library can no longer be used.
+
+		//Map a library file and check its header and index. Returns false, after printing why, if it can not be used.
+		bool open(const char* filename);
+		//Unmap the file.
+		void close();
+
+		//Get the number of styles in the library.
+		int getNoOfStyles() const
+		{
+			return noOfStyles;
+		}
+		//Get the name of a style, numbered in order of name from 0.
+		const char* getName(int style) const;
+		//Get the number of the style with a name. Returns -1 if there is no such style.
+		int find(const char* name) const;
+		/* Check a style and attach it to the library's tables. The library must stay open while the style is used.
+		   Returns false, after printing why, if the style is damaged. */
+		bool getStyle(int style, Style& result) const;
+
+		/* Write compiled styles to a library file. The names must be unique and at most STYLELIBRARY_MAX_NAME
+		   characters. Returns false, after printing why, if the library could not be written. */
+		static bool write(const char* filename, const std::vector<std::string>& names, const std::vector<const Style*>& styles);
+
+	private:
+		//A library can not be copied, as it owns the mapping.
+		StyleLibrary(const StyleLibrary&);
+		StyleLibrary& operator=(const StyleLibrary&);
+};
+
+#endif //STYLELIBRARY_H
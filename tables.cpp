@@ -0,0 +1,114 @@
+#include <string.h>
+#include "tables.h"
+#include "generator.h"
+
+bool buildBuiltInStyles(Style styles[BUILTIN_STYLES])
+{
+	/* First chord transition table array.
+	   Table is implemented with even numbers as major chords and odd numbers as minor chords.
+	   E.g. MIDIFILE_NOTE_F (which is 5) * 2 = 10, so it is F major.
+	        MIDIFILE_NOTE_A (9) * 2 + 1 = 19, so it is A minor.
+       This transition table has all notes at the same probability. 
+       There is the same chance of any allowed note occuring.*/
+	float transitionTable1[24][24];
+	
+	/* Second chord transition table array
+	   This transition table favours the transition "Dm -> G -> Am -> F"
+	   If any of these notes are chosen, it will always follow the path.
+	   The only notes that do not have one chord they will always move onto are F and C.*/
+	float transitionTable2[24][24];
+	
+	/* Third chord transition table array
+	   This transiton table favours the two minor chords, Dm and Am.
+	   Whenever a chord can move on to a minor chord, there is about twice the chance of it happening. */
+	float transitionTable3[24][24];
+	
+	//Initialise all elements of the transition tables to 0.
+	for(int i = 0; i < 24; i++)
+	{
+		for(int j = 0;j < 24; j++)
+		{
+			transitionTable1[i][j] = 0;
+			transitionTable2[i][j] = 0;
+			transitionTable3[i][j] = 0;
+		}
+	}
+	
+	//Transition table 1 definition.
+	
+	//Transition table values for C major.
+	transitionTable1[CHORD_C] [CHORD_Dm] = 0.25;
+	transitionTable1[CHORD_C] [CHORD_F]  = 0.25;
+	transitionTable1[CHORD_C] [CHORD_G]  = 0.25;
+	transitionTable1[CHORD_C] [CHORD_Am] = 0.25;
+	//Values for D minor.
+	transitionTable1[CHORD_Dm][CHORD_G]  = 0.5;
+	transitionTable1[CHORD_Dm][CHORD_Am] = 0.5;
+	//Values for F major.
+	transitionTable1[CHORD_F] [CHORD_F]  = 1.0/3;
+	transitionTable1[CHORD_F] [CHORD_Dm] = 1.0/3;
+	transitionTable1[CHORD_F] [CHORD_C]  = 1.0/3;
+	//Values for G major.
+	transitionTable1[CHORD_G] [CHORD_C]  = 0.5;
+	transitionTable1[CHORD_G] [CHORD_Am] = 0.5;
+	//Values for A minor.
+	transitionTable1[CHORD_Am][CHORD_Dm] = 0.5;
+	transitionTable1[CHORD_Am][CHORD_F]  = 0.5;
+	
+	//Transition table 2 definition.
+	
+	//Transition table values for C major.
+	transitionTable2[CHORD_C] [CHORD_Dm] = 0.25;
+	transitionTable2[CHORD_C] [CHORD_F]  = 0.25;
+	transitionTable2[CHORD_C] [CHORD_G]  = 0.25;
+	transitionTable2[CHORD_C] [CHORD_Am] = 0.25;
+	//Values for D minor.
+	transitionTable2[CHORD_Dm][CHORD_G]  = 1.0;
+	transitionTable2[CHORD_Dm][CHORD_Am] = 0.0;
+	//Values for F major.
+	transitionTable2[CHORD_F] [CHORD_F]  = 0.1;
+	transitionTable2[CHORD_F] [CHORD_Dm] = 0.4;
+	transitionTable2[CHORD_F] [CHORD_C]  = 0.5;
+	//Values for G major.
+	transitionTable2[CHORD_G] [CHORD_C]  = 0.0;
+	transitionTable2[CHORD_G] [CHORD_Am] = 1.0;
+	//Values for A minor.
+	transitionTable2[CHORD_Am][CHORD_Dm] = 0.0;
+	transitionTable2[CHORD_Am][CHORD_F]  = 1.0;
+	
+	//Transition table 3 definition.
+	
+	//Transition table values for C major.
+	transitionTable3[CHORD_C] [CHORD_Dm] = 0.4;
+	transitionTable3[CHORD_C] [CHORD_F]  = 0.1;
+	transitionTable3[CHORD_C] [CHORD_G]  = 0.1;
+	transitionTable3[CHORD_C] [CHORD_Am] = 0.4;
+	//Values for D minor.
+	transitionTable3[CHORD_Dm][CHORD_G]  = 0.3;
+	transitionTable3[CHORD_Dm][CHORD_Am] = 0.7;
+	//Values for F major.
+	transitionTable3[CHORD_F] [CHORD_F]  = 0.1;
+	transitionTable3[CHORD_F] [CHORD_Dm] = 0.6;
+	transitionTable3[CHORD_F] [CHORD_C]  = 0.3;
+	//Values for G major.
+	transitionTable3[CHORD_G] [CHORD_C]  = 0.3;
+	transitionTable3[CHORD_G] [CHORD_Am] = 0.7;
+	//Values for A minor.
+	transitionTable3[CHORD_Am][CHORD_Dm] = 0.7;
+	transitionTable3[CHORD_Am][CHORD_F]  = 0.3;
+	
+	//Make a style from each transition table, with the default melody and note durations. Every table starts on C.
+	memcpy(styles[0].transitions, transitionTable1, sizeof(transitionTable1));
+	memcpy(styles[1].transitions, transitionTable2, sizeof(transitionTable2));
+	memcpy(styles[2].transitions, transitionTable3, sizeof(transitionTable3));
+	
+	//Compile the styles, which also checks that they are valid.
+	for(int i = 0; i < BUILTIN_STYLES; i++)
+	{
+		styles[i].startChord = CHORD_C;
+		if(!styles[i].compile())
+			return false;
+	}
+	
+	return true;
+}
@@ -0,0 +1,13 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include "style.h"
+
+//The number of built-in transition tables.
+const int BUILTIN_STYLES = 3;
+
+/* Build a compiled style from each of the built-in transition tables, with the default melody and note durations.
+   Returns false if one of them is invalid. */
+bool buildBuiltInStyles(Style styles[BUILTIN_STYLES]);
+
+#endif //TABLES_H
@@ -0,0 +1,448 @@
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <filesystem>
+using namespace std;
+#include "midireader.h"
+#include "style.h"
+
+//The lowest note which can be part of the melody (middle C).
+const int TRAINER_LOWEST_MELODY_NOTE = 60;
+//Files longer than this many bars are only trained on up to this point.
+const int TRAINER_MAX_BARS = 100000;
+//The MIDI channel used for drums, which is left out of training.
+const int TRAINER_DRUM_CHANNEL = 9;
+//Runs of chords seen fewer times than this are left out of a style's contexts, as the chords after them say little.
+const int TRAINER_MIN_CONTEXT_COUNT = 2;
+
+//Counts gathered from the files. Each worker thread has its own, and they are added together at the end.
+struct TrainingCounts
+{
+	double transitions[STYLE_CHORDS][STYLE_CHORDS]; //Chord to chord transitions between consecutive bars.
+	double melody[STYLE_CHORDS][12]; //Melody notes played over each chord.
+	double durations[STYLE_DURATIONS]; //Melody note durations, rounded to the nearest one a style can use.
+	double firstChords[STYLE_CHORDS]; //The first chord of each file.
+	unsigned long files; //The number of files trained on.
+	unsigned long skipped; //The number of files which could not be used.
+	unsigned long bars; //The number of bars a chord was found in.
+	//Chords following runs of 2 or more chords, keyed by the run's context key (see ChordModel) and the chord.
+	map<pair<unsigned long long, int>, double> contexts;
+
+	TrainingCounts() : files(0), skipped(0), bars(0)
+	{
+		memset(transitions, 0, sizeof(transitions));
+		memset(melody, 0, sizeof(melody));
+		memset(durations, 0, sizeof(durations));
+		memset(firstChords, 0, sizeof(firstChords));
+	}
+
+	//Add another worker's counts to these.
+	void add(const TrainingCounts& other)
+	{
+		for(int i = 0; i < STYLE_CHORDS; i++)
+		{
+			for(int j = 0; j < STYLE_CHORDS; j++)
+				transitions[i][j] += other.transitions[i][j];
+			for(int j = 0; j < 12; j++)
+				melody[i][j] += other.melody[i][j];
+			firstChords[i] += other.firstChords[i];
+		}
+		for(int i = 0; i < STYLE_DURATIONS; i++)
+			durations[i] += other.durations[i];
+		files += other.files;
+		skipped += other.skipped;
+		bars += other.bars;
+		for(map<pair<unsigned long long, int>, double>::const_iterator i = other.contexts.begin(); i != other.contexts.end(); i++)
+			contexts[i->first] += i->second;
+	}
+};
+
+//A note found in a file.
+struct TrainingNote
+{
+	unsigned long start;
+	unsigned long end;
+	unsigned char pitch;
+
+	//Notes are sorted by when they start, highest first when they start together.
+	bool operator<(const TrainingNote& other) const
+	{
+		return start < other.start || (start == other.start && pitch > other.pitch);
+	}
+};
+
+//Pairs up the note ons and note offs of a file into notes, and picks up its time signature. Used as a MidiFileReader visitor.
+struct NoteCollector
+{
+	vector<TrainingNote>* notes; //Where the notes are stored.
+	long noteStarts[16][128]; //When the note sounding on each channel and pitch started, -1 if it is not sounding.
+	int track; //The track being read.
+	int numerator; //The time signature, from the first time signature event.
+	int denominatorPower;
+
+	NoteCollector(vector<TrainingNote>* notes) : notes(notes), track(-1), numerator(0), denominatorPower(0)
+	{
+	}
+
+	void operator()(int eventTrack, const MidiReaderEvent& event)
+	{
+		//Notes can not carry on from one track to the next.
+		if(eventTrack != track)
+		{
+			memset(noteStarts, -1, sizeof(noteStarts));
+			track = eventTrack;
+		}
+
+		if(event.status == MIDIREADER_STATUS_META)
+		{
+			if(event.data1 == 0x58 && event.length >= 2 && numerator == 0)
+			{
+				numerator = event.data[0];
+				denominatorPower = event.data[1];
+			}
+			return;
+		}
+
+		int command = event.status & 0xF0;
+		int channel = event.status & 0x0F;
+		if((command != 0x80 && command != 0x90) || channel == TRAINER_DRUM_CHANNEL)
+			return;
+
+		//Any note on or off ends the note already sounding at that pitch. A note on with a velocity of 0 is a note off.
+		int pitch = event.data1 & 0x7F;
+		long start = noteStarts[channel][pitch];
+		if(start >= 0 && event.time > start)
+		{
+			TrainingNote note = { (unsigned long)start, event.time, (unsigned char)pitch };
+			notes->push_back(note);
+		}
+		noteStarts[channel][pitch] = (command == 0x90 && event.data2 > 0) ? (long)event.time : -1;
+	}
+};
+
+//Find the major or minor chord which best matches how long each note sounds for in a bar. Returns -1 for an empty bar.
+static int detectChord(const double* noteWeights)
+{
+	double total = 0;
+	for(int i = 0; i < 12; i++)
+		total += noteWeights[i];
+	if(total == 0)
+		return -1;
+
+	//Score each chord by how much of the bar its notes fill, less half of what the other notes fill.
+	int bestChord = -1;
+	double bestScore = 0;
+	for(int chord = 0; chord < STYLE_CHORDS; chord++)
+	{
+		int root = chord / 2;
+		double inChord = noteWeights[root] + noteWeights[(root + (chord % 2 == 1 ? 3 : 4)) % 12] + noteWeights[(root + 7) % 12];
+		double score = inChord - 0.5 * (total - inChord);
+		if(bestChord < 0 || score > bestScore)
+		{
+			bestChord = chord;
+			bestScore = score;
+		}
+	}
+	return bestChord;
+}
+
+//Find the duration a style can use which is closest to a note's length, as a fraction of a bar.
+static int closestDuration(unsigned long length, unsigned long barTicks)
+{
+	double ticks = (double)length * STYLE_BAR_TICKS / barTicks;
+	int closest = 0;
+	for(int i = 1; i < STYLE_DURATIONS; i++)
+	{
+		//Compare on a log scale, so a note is as far from half its length as it is from double it.
+		if(fabs(log(ticks / STYLE_DURATION_TICKS[i])) < fabs(log(ticks / STYLE_DURATION_TICKS[closest])))
+			closest = i;
+	}
+	return closest;
+}
+
+//Scratch space used for each file, kept by each worker so it is only allocated once.
+struct TrainingScratch
+{
+	vector<TrainingNote> notes;
+	vector<double> noteWeights;
+	vector<int> chords;
+};
+
+//Add the counts from one file, counting runs of up to order chords. Returns false if the file could not be used.
+static bool trainFile(const MidiFileReader& reader, TrainingCounts& counts, TrainingScratch& scratch, int order)
+{
+	//Files timed in SMPTE frames do not have bars.
+	if(reader.getDivision() == 0 || (reader.getDivision() & 0x8000))
+		return false;
+
+	scratch.notes.clear();
+	NoteCollector collector(&scratch.notes);
+	if(!reader.visit(collector) || scratch.notes.empty())
+		return false;
+
+	//Work out the length of a bar from the time signature, assuming 4/4 if there is none.
+	unsigned long barTicks = (unsigned long)reader.getDivision() * 4;
+	if(collector.numerator > 0 && collector.denominatorPower < 8)
+		barTicks = ((unsigned long)reader.getDivision() * 4 * collector.numerator) >> collector.denominatorPower;
+	if(barTicks == 0)
+		return false;
+
+	unsigned long lastTime = 0;
+	for(int i = 0; i < scratch.notes.size(); i++)
+		lastTime = max(lastTime, scratch.notes[i].end);
+	int noOfBars = min((unsigned long)TRAINER_MAX_BARS, lastTime / barTicks + 1);
+
+	//Add up how long each note sounds for in each bar.
+	scratch.noteWeights.assign(noOfBars * 12, 0);
+	for(int i = 0; i < scratch.notes.size(); i++)
+	{
+		const TrainingNote& note = scratch.notes[i];
+		for(unsigned long bar = note.start / barTicks; bar <= (note.end - 1) / barTicks && bar < noOfBars; bar++)
+		{
+			unsigned long from = max(note.start, bar * barTicks);
+			unsigned long to = min(note.end, (bar + 1) * barTicks);
+			scratch.noteWeights[bar * 12 + note.pitch % 12] += to - from;
+		}
+	}
+
+	//Find the chord in each bar, counting the transitions between bars which both have one, and the chord after
+	//each run of up to order bars before it which all have one.
+	scratch.chords.resize(noOfBars);
+	bool first = true;
+	ChordHistory history = 0;
+	int run = 0;
+	for(int bar = 0; bar < noOfBars; bar++)
+	{
+		int chord = detectChord(&scratch.noteWeights[bar * 12]);
+		scratch.chords[bar] = chord;
+		if(chord < 0)
+		{
+			run = 0;
+			continue;
+		}
+
+		counts.bars++;
+		if(first)
+			counts.firstChords[chord]++;
+		else if(scratch.chords[bar - 1] >= 0)
+			counts.transitions[scratch.chords[bar - 1]][chord]++;
+		first = false;
+
+		for(int length = 2; length <= run && length <= order; length++)
+			counts.contexts[make_pair(ChordModel::getContextKey(history, length), chord)]++;
+		history = run == 0 ? startChordHistory(chord) : addToChordHistory(history, chord);
+		run++;
+	}
+
+	//The melody is the highest note starting at any time, as long as it is not below middle C.
+	sort(scratch.notes.begin(), scratch.notes.end());
+	for(int i = 0; i < scratch.notes.size(); i++)
+	{
+		const TrainingNote& note = scratch.notes[i];
+		if((i > 0 && scratch.notes[i - 1].start == note.start) || note.pitch < TRAINER_LOWEST_MELODY_NOTE)
+			continue;
+
+		unsigned long bar = note.start / barTicks;
+		if(bar >= noOfBars || scratch.chords[bar] < 0)
+			continue;
+
+		counts.melody[scratch.chords[bar]][note.pitch % 12]++;
+		counts.durations[closestDuration(note.end - note.start, barTicks)]++;
+	}
+
+	return true;
+}
+
+//Train on files until there are none left. Run by each of the worker threads.
+static void trainWorker(const vector<string>* files, atomic<int>* nextFile, TrainingCounts* counts, int order)
+{
+	TrainingScratch scratch;
+
+	//Two readers, so the next file can be read in the background while the current one is parsed.
+	MidiFileReader readers[2];
+	MidiFileReader* current = &readers[0];
+	MidiFileReader* next = &readers[1];
+
+	int file = (*nextFile)++;
+	bool opened = file < files->size() && current->open((*files)[file].c_str());
+
+	while(file < files->size())
+	{
+		//Claim the next file and start it loading before parsing the current one.
+		int nextIndex = (*nextFile)++;
+		bool nextOpened = nextIndex < files->size() && next->open((*files)[nextIndex].c_str());
+		if(nextOpened)
+			next->prefetch();
+
+		if(opened && trainFile(*current, *counts, scratch, order))
+			counts->files++;
+		else
+			counts->skipped++;
+		current->close();
+
+		swap(current, next);
+		file = nextIndex;
+		opened = nextOpened;
+	}
+}
+
+//Whether a file name ends in .mid or .midi, ignoring case.
+static bool isMidiFileName(const string& name)
+{
+	string lower = name;
+	for(int i = 0; i < lower.size(); i++)
+		lower[i] = tolower(lower[i]);
+	return (lower.size() > 4 && lower.compare(lower.size() - 4, 4, ".mid") == 0) ||
+		(lower.size() > 5 && lower.compare(lower.size() - 5, 5, ".midi") == 0);
+}
+
+//Turn the counts into the weights of a style.
+static void countsToStyle(const TrainingCounts& counts, Style& style)
+{
+	//Start on the chord files most often start on.
+	style.startChord = 0;
+	for(int i = 1; i < STYLE_CHORDS; i++)
+	{
+		if(counts.firstChords[i] > counts.firstChords[style.startChord])
+			style.startChord = i;
+	}
+
+	for(int i = 0; i < STYLE_CHORDS; i++)
+	{
+		double transitionTotal = 0, melodyTotal = 0;
+		for(int j = 0; j < STYLE_CHORDS; j++)
+			transitionTotal += counts.transitions[i][j];
+		for(int j = 0; j < 12; j++)
+			melodyTotal += counts.melody[i][j];
+
+		for(int j = 0; j < STYLE_CHORDS; j++)
+			style.transitions[i][j] = transitionTotal > 0 ? counts.transitions[i][j] / transitionTotal : 0;
+
+		//A chord which was only ever seen at the end of a file goes back to the start chord, so the chain can not get stuck.
+		bool reached = counts.firstChords[i] > 0;
+		for(int j = 0; j < STYLE_CHORDS && !reached; j++)
+			reached = counts.transitions[j][i] > 0;
+		if(transitionTotal == 0 && reached)
+			style.transitions[i][style.startChord] = 1;
+
+		//Chords with no melody seen keep the default melody notes.
+		if(melodyTotal > 0)
+		{
+			for(int j = 0; j < 12; j++)
+				style.melody[i][j] = counts.melody[i][j] / melodyTotal;
+		}
+	}
+
+	double durationTotal = 0;
+	for(int i = 0; i < STYLE_DURATIONS; i++)
+		durationTotal += counts.durations[i];
+	if(durationTotal > 0)
+	{
+		for(int i = 0; i < STYLE_DURATIONS; i++)
+			style.durations[i] = counts.durations[i] / durationTotal;
+	}
+
+	//With no chords found at all, C goes to itself.
+	if(counts.bars == 0)
+		style.transitions[style.startChord][style.startChord] = 1;
+
+	//The counts of each run of chords are together in the map, so each run's total is found before its chords are added.
+	style.contexts.clear();
+	map<pair<unsigned long long, int>, double>::const_iterator i = counts.contexts.begin();
+	while(i != counts.contexts.end())
+	{
+		map<pair<unsigned long long, int>, double>::const_iterator end = i;
+		double total = 0;
+		for(; end != counts.contexts.end() && end->first.first == i->first.first; end++)
+			total += end->second;
+		if(total < TRAINER_MIN_CONTEXT_COUNT)
+		{
+			i = end;
+			continue;
+		}
+
+		ChordModel::Context context;
+		context.order = (int)(i->first.first >> (CHORDMODEL_STATE_BITS * CHORDMODEL_MAX_ORDER));
+		for(int j = 0; j < context.order; j++)
+			context.chords[j] = getChordFromHistory(i->first.first, context.order - 1 - j);
+		for(; i != end; i++)
+		{
+			context.next = i->first.second;
+			context.weight = i->second / total;
+			style.contexts.push_back(context);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 3)
+	{
+		std::cout << "Usage: " << argv[0] << " <directory of MIDI files> <style file to write> [threads] [order]" << std::endl
+			<< "The order is the longest run of chords the next chord depends on, from 1 (the default) to "
+			<< CHORDMODEL_MAX_ORDER << "." << std::endl;
+		return 1;
+	}
+	int noOfThreads = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+	if(noOfThreads < 1)
+		noOfThreads = 1;
+	int order = argc > 4 ? atoi(argv[4]) : 1;
+	if(order < 1 || order > CHORDMODEL_MAX_ORDER)
+	{
+		std::cout << "ERROR: The order must be from 1 to " << CHORDMODEL_MAX_ORDER << "." << std::endl;
+		return 1;
+	}
+
+	//Find every MIDI file in the directory and the directories inside it.
+	vector<string> files;
+	error_code error;
+	for(filesystem::recursive_directory_iterator i(argv[1], error), end; !error && i != end; i.increment(error))
+	{
+		if(i->is_regular_file() && isMidiFileName(i->path().filename().string()))
+			files.push_back(i->path().string());
+	}
+	if(error)
+	{
+		std::cout << "ERROR: Could not read the directory " << argv[1] << ": " << error.message() << std::endl;
+		return 1;
+	}
+
+	timespec startTime, endTime;
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+	//Map: every worker counts into its own totals.
+	atomic<int> nextFile(0);
+	vector<TrainingCounts> workerCounts(noOfThreads);
+	vector<thread> workers;
+	for(int i = 0; i < noOfThreads; i++)
+		workers.push_back(thread(trainWorker, &files, &nextFile, &workerCounts[i], order));
+	for(int i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	//Reduce: add the totals together.
+	TrainingCounts counts;
+	for(int i = 0; i < workerCounts.size(); i++)
+		counts.add(workerCounts[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &endTime);
+	double seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) * 1e-9;
+
+	Style style;
+	countsToStyle(counts, style);
+	if(!style.compile() || !style.save(argv[2]))
+		return 1;
+
+	std::cout << "Trained on " << counts.files << " files (" << counts.skipped << " skipped), " << counts.bars
+		<< " bars in " << seconds << " s, " << (seconds > 0 ? counts.files / seconds : 0) << " files/s" << std::endl;
+	if(order > 1)
+		std::cout << "Kept " << style.getChordModel().getNoOfContexts() << " runs of 2 to " << order << " chords." << std::endl;
+	return 0;
+}
@@ -0,0 +1,297 @@
+#include "transitiontable.h"
+#include "hash.h"
+#include <math.h>
+#include <string.h>
+using namespace std;
+
+TransitionTable::TransitionTable() : noOfStates(0), startState(0), builtRowStart(1, 0)
+{
+	useBuiltArrays();
+}
+
+TransitionTable::TransitionTable(const TransitionTable& other)
+{
+	*this = other;
+}
+
+TransitionTable& TransitionTable::operator=(const TransitionTable& other)
+{
+	noOfStates = other.noOfStates;
+	startState = other.startState;
+	builtRowStart = other.builtRowStart;
+	builtEntries = other.builtEntries;
+	if(other.rowStart == &other.builtRowStart[0])
+		useBuiltArrays();
+	else
+	{
+		rowStart = other.rowStart;
+		entries = other.entries;
+		noOfEntries = other.noOfEntries;
+	}
+	return *this;
+}
+
+void TransitionTable::useBuiltArrays()
+{
+	rowStart = &builtRowStart[0];
+	entries = builtEntries.empty() ? NULL : &builtEntries[0];
+	noOfEntries = builtEntries.size();
+}
+
+bool TransitionTable::build(float transitionTable[24][24], int start)
+{
+	return build(&transitionTable[0][0], 24, start);
+}
+
+bool TransitionTable::build(const float* transitionTable, int states, int start)
+{
+	if(states <= 0)
+	{
+		std::cout << "ERROR: Invalid transition table size." << std::endl;
+		return false;
+	}
+
+	//Collect the non-zero probabilities. Anything that is not a positive number is passed on so it gets reported.
+	vector<Transition> transitions;
+	for(int from = 0; from < states; from++)
+	{
+		for(int to = 0; to < states; to++)
+		{
+			float probability = transitionTable[from * states + to];
+			if(probability != 0)
+			{
+				Transition transition = { from, to, probability };
+				transitions.push_back(transition);
+			}
+		}
+	}
+
+	return build(transitions, states, start);
+}
+
+bool TransitionTable::build(const vector<Transition>& transitions, int states, int start)
+{
+	if(states <= 0 || start < 0 || start >= states)
+	{
+		std::cout << "ERROR: Invalid transition table size or start chord." << std::endl;
+		return false;
+	}
+
+	//Count the transitions out of each state, checking them as we go.
+	vector<int> newRowStart(states + 1, 0);
+	for(int i = 0; i < transitions.size(); i++)
+	{
+		const Transition& transition = transitions[i];
+		if(transition.from < 0 || transition.from >= states || transition.to < 0 || transition.to >= states)
+		{
+			std::cout << "ERROR: Transition " << i << " refers to a state outside the table." << std::endl;
+			return false;
+		}
+		if(!(transition.probability >= 0) || isinf(transition.probability))
+		{
+			std::cout << "ERROR: Transition table row " << transition.from << " has an invalid probability." << std::endl;
+			return false;
+		}
+		if(transition.probability > 0)
+			newRowStart[transition.from + 1]++;
+	}
+
+	//Turn the counts into row offsets and place every transition into its row.
+	for(int i = 0; i < states; i++)
+		newRowStart[i + 1] += newRowStart[i];
+
+	vector<int> fill(newRowStart.begin(), newRowStart.end() - 1);
+	vector<Entry> newEntries(newRowStart[states]);
+	vector<double> scaled(newRowStart[states]);
+	for(int i = 0; i < transitions.size(); i++)
+	{
+		if(transitions[i].probability > 0)
+		{
+			int index = fill[transitions[i].from]++;
+			newEntries[index].state = transitions[i].to;
+			scaled[index] = transitions[i].probability;
+		}
+	}
+
+	//Work lists of the entries with less and more than the average probability. Reused for every row.
+	vector<int> small, large;
+
+	for(int row = 0; row < states; row++)
+	{
+		int first = newRowStart[row];
+		int count = newRowStart[row + 1] - first;
+
+		//Rows without any successors are left empty. They are checked below if the chain can reach them.
+		if(count == 0)
+			continue;
+
+		//Normalise the row and scale it so the average entry has a probability of 1.
+		double sum = 0;
+		for(int i = first; i < first + count; i++)
+			sum += scaled[i];
+
+		small.clear();
+		large.clear();
+		for(int i = first; i < first + count; i++)
+		{
+			scaled[i] = scaled[i] / sum * count;
+			if(scaled[i] < 1)
+				small.push_back(i);
+			else
+				large.push_back(i);
+		}
+
+		//Vose's alias method. Pair each small entry with a large entry which fills up the rest of it.
+		while(!small.empty() && !large.empty())
+		{
+			int less = small.back();
+			int more = large.back();
+			small.pop_back();
+
+			newEntries[less].threshold = (unsigned int)(scaled[less] * 4294967296.0);
+			newEntries[less].alias = newEntries[more].state;
+
+			scaled[more] -= 1 - scaled[less];
+			if(scaled[more] < 1)
+			{
+				large.pop_back();
+				small.push_back(more);
+			}
+		}
+
+		//Whatever is left over is full (up to rounding), so it always keeps its own state.
+		for(int i = 0; i < large.size(); i++)
+		{
+			newEntries[large[i]].threshold = 0xffffffffUL;
+			newEntries[large[i]].alias = newEntries[large[i]].state;
+		}
+		for(int i = 0; i < small.size(); i++)
+		{
+			newEntries[small[i]].threshold = 0xffffffffUL;
+			newEntries[small[i]].alias = newEntries[small[i]].state;
+		}
+	}
+
+	if(!checkReachable(&newRowStart[0], newEntries.empty() ? NULL : &newEntries[0], states, start))
+		return false;
+
+	noOfStates = states;
+	startState = start;
+	builtRowStart.swap(newRowStart);
+	builtEntries.swap(newEntries);
+	useBuiltArrays();
+	return true;
+}
+
+bool TransitionTable::checkReachable(const int* rowStart, const Entry* entries, int states, int start)
+{
+	//Walk every state that can be reached from the start state, making sure none of them is a dead end.
+	vector<bool> reached(states, false);
+	vector<int> toVisit(1, start);
+	reached[start] = true;
+	while(!toVisit.empty())
+	{
+		int state = toVisit.back();
+		toVisit.pop_back();
+
+		if(rowStart[state + 1] == rowStart[state])
+		{
+			std::cout << "ERROR: Transition table row " << state << " can be reached but has no successors." << std::endl;
+			return false;
+		}
+
+		for(int i = rowStart[state]; i < rowStart[state + 1]; i++)
+		{
+			if(!reached[entries[i].state])
+			{
+				reached[entries[i].state] = true;
+				toVisit.push_back(entries[i].state);
+			}
+		}
+	}
+	return true;
+}
+
+unsigned long long TransitionTable::hash(unsigned long long hash) const
+{
+	hash = hashValue(hash, noOfStates);
+	hash = hashValue(hash, startState);
+	for(int i = 0; i <= noOfStates; i++)
+		hash = hashValue(hash, rowStart[i]);
+	for(int i = 0; i < noOfEntries; i++)
+	{
+		hash = hashValue(hash, (unsigned long long)entries[i].threshold);
+		hash = hashValue(hash, entries[i].state);
+		hash = hashValue(hash, entries[i].alias);
+	}
+	return hash;
+}
+
+/* The layout written by write(), all in 4 byte words:
+       noOfStates, startState, noOfEntries, rowStart[noOfStates + 1], then each entry's threshold, state and alias.
+   The entries are stored exactly as Entry lays them out, so attach() can point straight at them. */
+static const int TRANSITIONTABLE_HEADER_WORDS = 3;
+
+void TransitionTable::write(vector<unsigned char>& buffer) const
+{
+	static_assert(sizeof(Entry) == 12, "TransitionTable::Entry must be three 4 byte words");
+	int header[TRANSITIONTABLE_HEADER_WORDS] = { noOfStates, startState, noOfEntries };
+	const unsigned char* parts[3] = { (const unsigned char*)header, (const unsigned char*)rowStart, (const unsigned char*)entries };
+	size_t lengths[3] = { sizeof(header), (noOfStates + 1) * sizeof(int), noOfEntries * sizeof(Entry) };
+	for(int i = 0; i < 3; i++)
+		buffer.insert(buffer.end(), parts[i], parts[i] + lengths[i]);
+}
+
+bool TransitionTable::attach(const unsigned char* data, size_t length)
+{
+	int header[TRANSITIONTABLE_HEADER_WORDS];
+	if(length < sizeof(header))
+	{
+		std::cout << "ERROR: The transition table is cut short." << std::endl;
+		return false;
+	}
+	memcpy(header, data, sizeof(header));
+	int states = header[0], start = header[1], count = header[2];
+	if(states <= 0 || start < 0 || start >= states || count < 0
+		|| length != sizeof(header) + (states + 1) * sizeof(int) + (size_t)count * sizeof(Entry))
+	{
+		std::cout << "ERROR: The transition table has an invalid size." << std::endl;
+		return false;
+	}
+
+	//Check everything chooseNext() relies on, so a damaged table can never index outside itself.
+	const int* newRowStart = (const int*)(data + sizeof(header));
+	const Entry* newEntries = (const Entry*)(newRowStart + states + 1);
+	if(newRowStart[0] != 0 || newRowStart[states] != count)
+	{
+		std::cout << "ERROR: The transition table rows do not cover its entries." << std::endl;
+		return false;
+	}
+	for(int i = 0; i < states; i++)
+	{
+		if(newRowStart[i + 1] < newRowStart[i])
+		{
+			std::cout << "ERROR: Transition table row " << i << " has an invalid length." << std::endl;
+			return false;
+		}
+	}
+	for(int i = 0; i < count; i++)
+	{
+		if(newEntries[i].state < 0 || newEntries[i].state >= states || newEntries[i].alias < 0 || newEntries[i].alias >= states)
+		{
+			std::cout << "ERROR: Transition table entry " << i << " refers to a state outside the table." << std::endl;
+			return false;
+		}
+	}
+	if(!checkReachable(newRowStart, newEntries, states, start))
+		return false;
+
+	noOfStates = states;
+	startState = start;
+	builtRowStart.assign(1, 0);
+	builtEntries.clear();
+	rowStart = newRowStart;
+	entries = newEntries;
+	noOfEntries = count;
+	return true;
+}
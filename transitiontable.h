@@ -0,0 +1,125 @@
+#ifndef TRANSITIONTABLE_H
+#define TRANSITIONTABLE_H
+
+#include <assert.h>
+#include <vector>
+#include "include/MersenneTwister.h"
+using namespace std;
+
+/* A chord transition table compiled for sampling.
+   Only the non-zero successors of each state are stored, in compressed sparse row form: the entries of
+   state s are entries[rowStart[s]] up to entries[rowStart[s+1]]. Each row is a Vose alias table over its
+   own entries, so choosing the next chord costs one random number and one comparison, and memory grows
+   with the number of transitions rather than the square of the number of states.
+   Rows are validated and normalised when the table is built, so a bad table is rejected before any
+   generation starts.
+   A built table can be written out with write() and used again later with attach(), which samples from the
+   written bytes where they are (such as in a mapped style library) instead of building or copying anything. */
+class TransitionTable
+{
+	public:
+		//One transition from a state to another, used to build large tables without a dense array.
+		struct Transition
+		{
+			int from;
+			int to;
+			float probability;
+		};
+
+	private:
+		//One entry of a row's alias table.
+		struct Entry
+		{
+			//The entry is kept when the low 32 bits of the scaled random number are below the threshold, otherwise the alias is used.
+			unsigned int threshold;
+			//The successor state for this entry and the state used instead of it.
+			int state;
+			int alias;
+		};
+
+		//The number of states (chords) in the table.
+		int noOfStates;
+		//The state the generated chain starts from.
+		int startState;
+		//Where each state's entries start. Has noOfStates + 1 elements.
+		const int* rowStart;
+		//The alias table entries of every row, one after the other.
+		const Entry* entries;
+		int noOfEntries;
+
+		//The arrays rowStart and entries point at for a built table. An attached table leaves them empty.
+		vector<int> builtRowStart;
+		vector<Entry> builtEntries;
+
+		//Point rowStart and entries at the built arrays.
+		void useBuiltArrays();
+		//Check every state reachable from the start state has a successor. Returns false, after printing which one does not, if any is a dead end.
+		static bool checkReachable(const int* rowStart, const Entry* entries, int states, int start);
+
+	public:
+		TransitionTable(); //Class constructor. The table is empty until it is built.
+		TransitionTable(const TransitionTable& other); //Copy constructor. A copy of an attached table uses the same memory.
+		TransitionTable& operator=(const TransitionTable& other);
+		//Build the table from the 24 chord layout used by generateMidi(). Returns false if the table is invalid.
+		bool build(float transitionTable[24][24], int start = 0);
+		//Build the table from a noOfStates x noOfStates row major array. Returns false if the table is invalid.
+		bool build(const float* transitionTable, int states, int start = 0);
+		//Build the table from a list of transitions between states numbered 0 to states - 1. Returns false if the table is invalid.
+		bool build(const vector<Transition>& transitions, int states, int start = 0);
+
+		//Choose the state following the given one.
+		int chooseNext(int state, MTRand& mtrand) const
+		{
+			return chooseNext(state, mtrand.randInt());
+		}
+		//Choose the state following the given one, using a 32 bit random number that has already been drawn.
+		int chooseNext(int state, MTRand::uint32 random) const
+		{
+			int first = rowStart[state];
+			//build() and attach() make sure the chain can never reach a state without successors.
+			assert(rowStart[state + 1] > first);
+			//Scale the random number by the row length. The high word picks the entry and the low word
+			//is compared against the entry's threshold.
+			unsigned long long scaled = (unsigned long long)(random & 0xffffffffUL) * (rowStart[state + 1] - first);
+			const Entry& entry = entries[first + (int)(scaled >> 32)];
+			return (scaled & 0xffffffffULL) < entry.threshold ? entry.state : entry.alias;
+		}
+
+		//Get the number of states in the table.
+		int getNoOfStates() const
+		{
+			return noOfStates;
+		}
+		//Get the number of non-zero transitions stored in the table.
+		int getNoOfTransitions() const
+		{
+			return noOfEntries;
+		}
+		//Get the state the generated chain should start from.
+		int getStartState() const
+		{
+			return startState;
+		}
+		//Whether the state has any successors.
+		bool hasSuccessors(int state) const
+		{
+			return state >= 0 && state < noOfStates && rowStart[state + 1] > rowStart[state];
+		}
+		//Call a function with each state that can follow the given one.
+		template<class Function> void forEachSuccessor(int state, Function function) const
+		{
+			for(int i = rowStart[state]; i < rowStart[state + 1]; i++)
+				function(entries[i].state);
+		}
+		//Add the contents of the built table to a hash (see hash.h), so tables that sample the same way hash the same.
+		unsigned long long hash(unsigned long long hash) const;
+
+		//Add the built table to the end of a buffer, in the layout attach() reads. Its length is a multiple of 4 bytes.
+		void write(vector<unsigned char>& buffer) const;
+		/* Use a table written by write() where it is, without copying it. The data must be 4 byte aligned and
+		   stay valid for as long as the table and any copies of it are used.
+		   Returns false, leaving this table as it was, if the data is not a valid table. */
+		bool attach(const unsigned char* data, size_t length);
+};
+
+#endif //TRANSITIONTABLE_H
@@ -0,0 +1,320 @@
+#include "vlq.h"
+#include <string.h>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VLQ_X86
+#endif
+
+//The thresholds at which a delta time needs a 2nd, 3rd and 4th byte.
+static const unsigned int VLQ_TWO_BYTES   = 0x80;
+static const unsigned int VLQ_THREE_BYTES = 0x4000;
+static const unsigned int VLQ_FOUR_BYTES  = 0x200000;
+
+/* Encode one event into a word, returning its length.
+   The four possible bytes of the delta time are laid out most significant first, then shifted down so the
+   word starts with the first byte actually used. The status and data bytes go straight after it. */
+static inline int encodeEvent(const MidiEvent& event, unsigned long long& word)
+{
+	unsigned long long delta = event.deltaTime;
+	int length = 1 + (delta >= VLQ_TWO_BYTES) + (delta >= VLQ_THREE_BYTES) + (delta >= VLQ_FOUR_BYTES);
+	unsigned long long full = (0x80 | ((delta >> 21) & 0x7F))
+		| (unsigned long long)(0x80 | ((delta >> 14) & 0x7F)) << 8
+		| (unsigned long long)(0x80 | ((delta >> 7) & 0x7F)) << 16
+		| (unsigned long long)(delta & 0x7F) << 24;
+	unsigned long long data = event.status | (unsigned long long)event.data1 << 8 | (unsigned long long)event.data2 << 16;
+	word = (full >> (8 * (4 - length))) | (data << (8 * length));
+	return length + 3;
+}
+
+//Store a word in the buffer, least significant byte first, which is the order the bytes were laid out in.
+static inline void storeWord(unsigned char* buffer, unsigned long long word)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	memcpy(buffer, &word, 8);
+}
+
+//Scalar versions.
+static size_t eventsLengthScalar(const MidiEvent* events, size_t count)
+{
+	size_t length = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		unsigned int delta = events[i].deltaTime;
+		length += 4 + (delta >= VLQ_TWO_BYTES) + (delta >= VLQ_THREE_BYTES) + (delta >= VLQ_FOUR_BYTES);
+	}
+	return length;
+}
+
+static unsigned char* writeEventsScalar(unsigned char* buffer, const MidiEvent* events, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+	{
+		unsigned long long word;
+		int length = encodeEvent(events[i], word);
+		storeWord(buffer, word);
+		buffer += length;
+	}
+	return buffer;
+}
+
+#ifdef VLQ_X86
+//AVX2 versions, which work on four events at a time in 64 bit lanes.
+__attribute__((target("avx2")))
+static size_t eventsLengthAVX2(const MidiEvent* events, size_t count)
+{
+	const __m256i deltaMask = _mm256_set1_epi64x(0xFFFFFFFF);
+	const __m256i two = _mm256_set1_epi64x(VLQ_TWO_BYTES - 1);
+	const __m256i three = _mm256_set1_epi64x(VLQ_THREE_BYTES - 1);
+	const __m256i four = _mm256_set1_epi64x(VLQ_FOUR_BYTES - 1);
+
+	//Each comparison that is true subtracts -1, adding a byte to the lane's total.
+	__m256i total = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4)
+	{
+		__m256i delta = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(events + i)), deltaMask);
+		total = _mm256_sub_epi64(total, _mm256_cmpgt_epi64(delta, two));
+		total = _mm256_sub_epi64(total, _mm256_cmpgt_epi64(delta, three));
+		total = _mm256_sub_epi64(total, _mm256_cmpgt_epi64(delta, four));
+	}
+
+	unsigned long long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, total);
+	return 4 * i + lanes[0] + lanes[1] + lanes[2] + lanes[3] + eventsLengthScalar(events + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned char* writeEventsAVX2(unsigned char* buffer, const MidiEvent* events, size_t count)
+{
+	const __m256i deltaMask = _mm256_set1_epi64x(0xFFFFFFFF);
+	const __m256i dataMask = _mm256_set1_epi64x(0xFFFFFF);
+	const __m256i sevenBits = _mm256_set1_epi64x(0x7F);
+	const __m256i continued = _mm256_set1_epi64x(0x80);
+	const __m256i two = _mm256_set1_epi64x(VLQ_TWO_BYTES - 1);
+	const __m256i three = _mm256_set1_epi64x(VLQ_THREE_BYTES - 1);
+	const __m256i four = _mm256_set1_epi64x(VLQ_FOUR_BYTES - 1);
+	const __m256i one = _mm256_set1_epi64x(1);
+	const __m256i three64 = _mm256_set1_epi64x(3);
+	const __m256i thirtyTwo = _mm256_set1_epi64x(32);
+
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4)
+	{
+		__m256i event = _mm256_loadu_si256((const __m256i*)(events + i));
+		__m256i delta = _mm256_and_si256(event, deltaMask);
+		__m256i data = _mm256_and_si256(_mm256_srli_epi64(event, 32), dataMask);
+
+		//The length of each delta time, from 1 to 4 bytes.
+		__m256i length = _mm256_sub_epi64(one, _mm256_cmpgt_epi64(delta, two));
+		length = _mm256_sub_epi64(length, _mm256_cmpgt_epi64(delta, three));
+		length = _mm256_sub_epi64(length, _mm256_cmpgt_epi64(delta, four));
+
+		//All four bytes of each delta time, most significant first.
+		__m256i full = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(delta, 21), sevenBits), continued);
+		full = _mm256_or_si256(full, _mm256_slli_epi64(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(delta, 14), sevenBits), continued), 8));
+		full = _mm256_or_si256(full, _mm256_slli_epi64(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(delta, 7), sevenBits), continued), 16));
+		full = _mm256_or_si256(full, _mm256_slli_epi64(_mm256_and_si256(delta, sevenBits), 24));
+
+		//Drop the unused bytes from the front and put the status and data bytes after the delta time.
+		__m256i lengthBits = _mm256_slli_epi64(length, 3);
+		__m256i word = _mm256_or_si256(_mm256_srlv_epi64(full, _mm256_sub_epi64(thirtyTwo, lengthBits)),
+			_mm256_sllv_epi64(data, lengthBits));
+
+		//A running sum of the event lengths gives where each word goes.
+		__m256i size = _mm256_add_epi64(length, three64);
+		__m256i offset = _mm256_add_epi64(size, _mm256_blend_epi32(_mm256_permute4x64_epi64(size, 0x90), _mm256_setzero_si256(), 0x03));
+		offset = _mm256_add_epi64(offset, _mm256_blend_epi32(_mm256_permute4x64_epi64(offset, 0x40), _mm256_setzero_si256(), 0x0F));
+
+		unsigned long long words[4], ends[4];
+		_mm256_storeu_si256((__m256i*)words, word);
+		_mm256_storeu_si256((__m256i*)ends, offset);
+		storeWord(buffer, words[0]);
+		storeWord(buffer + ends[0], words[1]);
+		storeWord(buffer + ends[1], words[2]);
+		storeWord(buffer + ends[2], words[3]);
+		buffer += ends[3];
+	}
+
+	return writeEventsScalar(buffer, events + i, count - i);
+}
+
+//SSSE3 versions, which work on two events at a time.
+__attribute__((target("ssse3")))
+static size_t eventsLengthSSSE3(const MidiEvent* events, size_t count)
+{
+	//The delta times are at most 28 bits, so they can be compared as signed 32 bit numbers. Only the
+	//comparisons of the low half of each 64 bit lane are counted.
+	const __m128i deltaMask = _mm_set1_epi64x(0xFFFFFFFF);
+	const __m128i two = _mm_set1_epi32(VLQ_TWO_BYTES - 1);
+	const __m128i three = _mm_set1_epi32(VLQ_THREE_BYTES - 1);
+	const __m128i four = _mm_set1_epi32(VLQ_FOUR_BYTES - 1);
+
+	__m128i total = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 2 <= count; i += 2)
+	{
+		__m128i delta = _mm_and_si128(_mm_loadu_si128((const __m128i*)(events + i)), deltaMask);
+		total = _mm_sub_epi32(total, _mm_cmpgt_epi32(delta, two));
+		total = _mm_sub_epi32(total, _mm_cmpgt_epi32(delta, three));
+		total = _mm_sub_epi32(total, _mm_cmpgt_epi32(delta, four));
+	}
+
+	unsigned int lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, total);
+	return 4 * i + lanes[0] + lanes[2] + eventsLengthScalar(events + i, count - i);
+}
+
+/* Shuffles which take the bytes of an event with a delta time of each length out of its lane, which holds
+   the four delta time bytes followed by the status and data bytes. Indexed by the lengths of both events. */
+static unsigned char ssse3Shuffles[5][5][16];
+
+static void buildSSSE3Shuffles()
+{
+	for(int low = 1; low <= 4; low++)
+	{
+		for(int high = 1; high <= 4; high++)
+		{
+			for(int j = 0; j < 8; j++)
+			{
+				ssse3Shuffles[low][high][j] = j < low + 3 ? 4 - low + j : 0x80;
+				ssse3Shuffles[low][high][8 + j] = j < high + 3 ? 8 + 4 - high + j : 0x80;
+			}
+		}
+	}
+}
+
+__attribute__((target("ssse3")))
+static unsigned char* writeEventsSSSE3(unsigned char* buffer, const MidiEvent* events, size_t count)
+{
+	const __m128i deltaMask = _mm_set1_epi64x(0xFFFFFFFF);
+	const __m128i dataMask = _mm_set1_epi64x(0xFFFFFF00000000LL);
+	const __m128i sevenBits = _mm_set1_epi64x(0x7F);
+	const __m128i continued = _mm_set1_epi64x(0x80);
+	const __m128i two = _mm_set1_epi32(VLQ_TWO_BYTES - 1);
+	const __m128i three = _mm_set1_epi32(VLQ_THREE_BYTES - 1);
+	const __m128i four = _mm_set1_epi32(VLQ_FOUR_BYTES - 1);
+	const __m128i one = _mm_set1_epi32(1);
+
+	size_t i = 0;
+	for(; i + 2 <= count; i += 2)
+	{
+		__m128i event = _mm_loadu_si128((const __m128i*)(events + i));
+		__m128i delta = _mm_and_si128(event, deltaMask);
+
+		__m128i length = _mm_sub_epi32(one, _mm_cmpgt_epi32(delta, two));
+		length = _mm_sub_epi32(length, _mm_cmpgt_epi32(delta, three));
+		length = _mm_sub_epi32(length, _mm_cmpgt_epi32(delta, four));
+
+		//All four bytes of each delta time, most significant first, with the status and data bytes left where they were.
+		__m128i full = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(delta, 21), sevenBits), continued);
+		full = _mm_or_si128(full, _mm_slli_epi64(_mm_or_si128(_mm_and_si128(_mm_srli_epi64(delta, 14), sevenBits), continued), 8));
+		full = _mm_or_si128(full, _mm_slli_epi64(_mm_or_si128(_mm_and_si128(_mm_srli_epi64(delta, 7), sevenBits), continued), 16));
+		full = _mm_or_si128(full, _mm_slli_epi64(_mm_and_si128(delta, sevenBits), 24));
+		full = _mm_or_si128(full, _mm_and_si128(event, dataMask));
+
+		//Move each event's bytes to the start of its lane.
+		int lowLength = _mm_cvtsi128_si32(length);
+		int highLength = _mm_cvtsi128_si32(_mm_srli_si128(length, 8));
+		__m128i word = _mm_shuffle_epi8(full, _mm_loadu_si128((const __m128i*)ssse3Shuffles[lowLength][highLength]));
+
+		unsigned long long words[2];
+		_mm_storeu_si128((__m128i*)words, word);
+		storeWord(buffer, words[0]);
+		buffer += lowLength + 3;
+		storeWord(buffer, words[1]);
+		buffer += highLength + 3;
+	}
+
+	return writeEventsScalar(buffer, events + i, count - i);
+}
+#endif
+
+//The functions for each version, in order of preference.
+struct VarLenImplementation
+{
+	const char* name;
+	size_t (*eventsLength)(const MidiEvent*, size_t);
+	unsigned char* (*writeEvents)(unsigned char*, const MidiEvent*, size_t);
+	bool (*supported)();
+};
+
+static bool alwaysSupported()
+{
+	return true;
+}
+
+#ifdef VLQ_X86
+static bool avx2Supported()
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool ssse3Supported()
+{
+	return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+static const VarLenImplementation implementations[] = {
+#ifdef VLQ_X86
+	{ "avx2", eventsLengthAVX2, writeEventsAVX2, avx2Supported },
+	{ "ssse3", eventsLengthSSSE3, writeEventsSSSE3, ssse3Supported },
+#endif
+	{ "scalar", eventsLengthScalar, writeEventsScalar, alwaysSupported }
+};
+static const int noOfImplementations = sizeof(implementations) / sizeof(implementations[0]);
+
+//Pick the first version the processor supports. Run once, the first time the functions are used.
+static const VarLenImplementation* chooseImplementation()
+{
+#ifdef VLQ_X86
+	__builtin_cpu_init();
+	buildSSSE3Shuffles();
+#endif
+	for(int i = 0; i < noOfImplementations; i++)
+		if(implementations[i].supported())
+			return &implementations[i];
+	return &implementations[noOfImplementations - 1];
+}
+
+/* Get the version in use, choosing it on the first call. A local static is set up once, even when several
+   threads get here first, and before any other file's static initializers can use it. It is atomic, as
+   setVarLenImplementation() can change it while worker threads are encoding. */
+static std::atomic<const VarLenImplementation*>& current()
+{
+	static std::atomic<const VarLenImplementation*> implementation(chooseImplementation());
+	return implementation;
+}
+
+size_t varLenEventsLength(const MidiEvent* events, size_t count)
+{
+	return current().load(std::memory_order_relaxed)->eventsLength(events, count);
+}
+
+unsigned char* writeVarLenEvents(unsigned char* buffer, const MidiEvent* events, size_t count)
+{
+	return current().load(std::memory_order_relaxed)->writeEvents(buffer, events, count);
+}
+
+const char* getVarLenImplementation()
+{
+	return current().load(std::memory_order_relaxed)->name;
+}
+
+bool setVarLenImplementation(const char* name)
+{
+	//Choose first, so the processor's features are known before any version's supported() is asked.
+	std::atomic<const VarLenImplementation*>& chosen = current();
+	for(int i = 0; i < noOfImplementations; i++)
+	{
+		if(strcmp(implementations[i].name, name) == 0 && implementations[i].supported())
+		{
+			chosen.store(&implementations[i], std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
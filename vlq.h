@@ -0,0 +1,35 @@
+#ifndef VLQ_H
+#define VLQ_H
+
+#include <stddef.h>
+
+//A MIDI channel event. Stored by value so a track's events sit in one contiguous array, 8 bytes to an event.
+struct MidiEvent
+{
+	unsigned int deltaTime; //The deltatime before the event is executed.
+	unsigned char status; //The status byte, which holds the command and the channel.
+	unsigned char data1; //The first data byte (the note number for note on and note off).
+	unsigned char data2; //The second data byte (the velocity for note on and note off).
+};
+
+//The number of bytes past the end of the encoded events that writeVarLenEvents() may write over.
+const int VLQ_WRITE_PADDING = 8;
+
+/* Batch encoding of a track's events, each a variable length delta time followed by its three bytes.
+   Every event is turned into one 8 byte word holding its encoded bytes, and the words are stored one after
+   the other at the offsets given by a running sum of the encoded lengths. Blocks of events are encoded at
+   once with AVX2 or SSSE3 where the processor has them, with a scalar version for everything else. The
+   best version is chosen the first time one of these functions is called. */
+
+//Get the number of bytes the events take up once encoded.
+size_t varLenEventsLength(const MidiEvent* events, size_t count);
+/* Encode the events into the buffer, which must have room for varLenEventsLength() bytes and
+   VLQ_WRITE_PADDING more. Returns the end of what was written. */
+unsigned char* writeVarLenEvents(unsigned char* buffer, const MidiEvent* events, size_t count);
+
+//Get the name of the version in use: "avx2", "ssse3" or "scalar".
+const char* getVarLenImplementation();
+//Choose the version to use by name. Returns false if the processor can not run it.
+bool setVarLenImplementation(const char* name);
+
+#endif //VLQ_H